@@ -37,59 +37,187 @@
 
 #include <string.h>
 
-static void
-escaped_printf (GOutputStream *out, const char *fmt, ...) G_GNUC_PRINTF (2, 3);
+/* The dump is written either as XML or, when the input asks for
+ * "dump-format:binary", as a sequence of length-prefixed records that
+ * can be read without an XML parser:
+ *
+ *   "GI-DUMP\1" magic
+ *   records: guint32 length of the payload, then the payload
+ *     'S' string name, then string name/value pairs: element start
+ *     'E': element end
+ *   strings: guint32 length, then the bytes (not NUL-terminated)
+ *
+ * All integers are little-endian.  Both formats describe the same
+ * tree of elements and attributes.
+ */
+#define DUMP_BINARY_MAGIC "GI-DUMP\1"
+#define DUMP_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+  GOutputStream *out;
+  gboolean binary;
+  guint depth;
+  /* XML: a start tag waiting for its ">" or "/>" */
+  gboolean start_open;
+  /* Binary: the pending start element record */
+  GString *record;
+} DumpWriter;
 
 static void
-escaped_printf (GOutputStream *out, const char *fmt, ...)
+goutput_write_len (GOutputStream *out, const char *str, gsize len)
 {
-  char *str;
-  va_list args;
   gsize written;
   GError *error = NULL;
-
-  va_start (args, fmt);
-
-  str = g_markup_vprintf_escaped (fmt, args);
-  if (!g_output_stream_write_all (out, str, strlen (str), &written, NULL, &error))
+  if (!g_output_stream_write_all (out, str, len, &written, NULL, &error))
     {
       g_critical ("failed to write to iochannel: %s", error->message);
       g_clear_error (&error);
     }
-  g_free (str);
-
-  va_end (args);
 }
 
 static void
 goutput_write (GOutputStream *out, const char *str)
 {
-  gsize written;
-  GError *error = NULL;
-  if (!g_output_stream_write_all (out, str, strlen (str), &written, NULL, &error))
+  goutput_write_len (out, str, strlen (str));
+}
+
+static void
+record_append_uint32 (GString *record, guint32 value)
+{
+  value = GUINT32_TO_LE (value);
+  g_string_append_len (record, (const char *) &value, sizeof (value));
+}
+
+static void
+record_append_string (GString *record, const char *str)
+{
+  gsize len = strlen (str);
+
+  record_append_uint32 (record, len);
+  g_string_append_len (record, str, len);
+}
+
+static void
+writer_flush_record (DumpWriter *writer)
+{
+  guint32 len;
+
+  if (writer->record->len == 0)
+    return;
+
+  len = GUINT32_TO_LE (writer->record->len);
+  goutput_write_len (writer->out, (const char *) &len, sizeof (len));
+  goutput_write_len (writer->out, writer->record->str, writer->record->len);
+  g_string_truncate (writer->record, 0);
+}
+
+static void
+writer_indent (DumpWriter *writer)
+{
+  static const char spaces[] = "                                ";
+
+  goutput_write_len (writer->out, spaces,
+                     MIN (writer->depth * 2, sizeof (spaces) - 1));
+}
+
+static void
+start_element (DumpWriter *writer, const char *name)
+{
+  if (writer->binary)
     {
-      g_critical ("failed to write to iochannel: %s", error->message);
-      g_clear_error (&error);
+      writer_flush_record (writer);
+      g_string_append_c (writer->record, 'S');
+      record_append_string (writer->record, name);
+    }
+  else
+    {
+      if (writer->start_open)
+        goutput_write (writer->out, ">\n");
+      writer_indent (writer);
+      goutput_write (writer->out, "<");
+      goutput_write (writer->out, name);
+      writer->start_open = TRUE;
+    }
+  writer->depth++;
+}
+
+static void
+attribute (DumpWriter *writer, const char *name, const char *value)
+{
+  if (writer->binary)
+    {
+      record_append_string (writer->record, name);
+      record_append_string (writer->record, value);
+    }
+  else
+    {
+      char *str = g_markup_printf_escaped (" %s=\"%s\"", name, value);
+      goutput_write (writer->out, str);
+      g_free (str);
+    }
+}
+
+static void
+attribute_int (DumpWriter *writer, const char *name, gint value)
+{
+  char buf[32];
+
+  g_snprintf (buf, sizeof (buf), "%d", value);
+  attribute (writer, name, buf);
+}
+
+static void
+end_element (DumpWriter *writer, const char *name)
+{
+  writer->depth--;
+  if (writer->binary)
+    {
+      writer_flush_record (writer);
+      g_string_append_c (writer->record, 'E');
+      writer_flush_record (writer);
+    }
+  else if (writer->start_open)
+    {
+      goutput_write (writer->out, "/>\n");
+      writer->start_open = FALSE;
+    }
+  else
+    {
+      writer_indent (writer);
+      goutput_write (writer->out, "</");
+      goutput_write (writer->out, name);
+      goutput_write (writer->out, ">\n");
     }
 }
 
 typedef GType (*GetTypeFunc)(void);
 typedef GQuark (*ErrorQuarkFunc)(void);
 
-static GType
-invoke_get_type (GModule *self, const char *symbol, GError **error)
-{
-  GetTypeFunc sym;
-  GType ret;
+typedef struct {
+  gboolean is_error_quark;
+  const char *function;
+  gpointer symbol;
+} DumpRequest;
 
-  if (!g_module_symbol (self, symbol, (void**)&sym))
+static gboolean
+resolve_symbol (GModule *self, DumpRequest *request, GError **error)
+{
+  if (!g_module_symbol (self, request->function, &request->symbol))
     {
       g_set_error (error,
 		   G_IO_ERROR,
 		   G_IO_ERROR_FAILED,
-		   "Failed to find symbol '%s'", symbol);
-      return G_TYPE_INVALID;
+		   "Failed to find symbol '%s'", request->function);
+      return FALSE;
     }
+  return TRUE;
+}
+
+static GType
+invoke_get_type (const DumpRequest *request, GError **error)
+{
+  GetTypeFunc sym = (GetTypeFunc) request->symbol;
+  GType ret;
 
   ret = sym ();
   if (ret == G_TYPE_INVALID)
@@ -97,30 +225,21 @@ invoke_get_type (GModule *self, const char *symbol, GError **error)
       g_set_error (error,
 		   G_IO_ERROR,
 		   G_IO_ERROR_FAILED,
-		   "Function '%s' returned G_TYPE_INVALID", symbol);
+		   "Function '%s' returned G_TYPE_INVALID", request->function);
     }
   return ret;
 }
 
 static GQuark
-invoke_error_quark (GModule *self, const char *symbol, GError **error)
+invoke_error_quark (const DumpRequest *request, GError **error)
 {
-  ErrorQuarkFunc sym;
-
-  if (!g_module_symbol (self, symbol, (void**)&sym))
-    {
-      g_set_error (error,
-		   G_IO_ERROR,
-		   G_IO_ERROR_FAILED,
-		   "Failed to find symbol '%s'", symbol);
-      return G_TYPE_INVALID;
-    }
+  ErrorQuarkFunc sym = (ErrorQuarkFunc) request->symbol;
 
   return sym ();
 }
 
 static void
-dump_properties (GType type, GOutputStream *out)
+dump_properties (GType type, DumpWriter *writer)
 {
   guint i;
   guint n_properties;
@@ -147,14 +266,17 @@ dump_properties (GType type, GOutputStream *out)
       if (prop->owner_type != type)
 	continue;
 
-      escaped_printf (out, "    <property name=\"%s\" type=\"%s\" flags=\"%d\"/>\n",
-		      prop->name, g_type_name (prop->value_type), prop->flags);
+      start_element (writer, "property");
+      attribute (writer, "name", prop->name);
+      attribute (writer, "type", g_type_name (prop->value_type));
+      attribute_int (writer, "flags", prop->flags);
+      end_element (writer, "property");
     }
   g_free (props);
 }
 
 static void
-dump_signals (GType type, GOutputStream *out)
+dump_signals (GType type, DumpWriter *writer)
 {
   guint i;
   guint n_sigs;
@@ -170,99 +292,109 @@ dump_signals (GType type, GOutputStream *out)
       sigid = sig_ids[i];
       g_signal_query (sigid, &query);
 
-      escaped_printf (out, "    <signal name=\"%s\" return=\"%s\"",
-		      query.signal_name, g_type_name (query.return_type));
+      start_element (writer, "signal");
+      attribute (writer, "name", query.signal_name);
+      attribute (writer, "return", g_type_name (query.return_type));
 
       if (query.signal_flags & G_SIGNAL_RUN_FIRST)
-        escaped_printf (out, " when=\"first\"");
+        attribute (writer, "when", "first");
       else if (query.signal_flags & G_SIGNAL_RUN_LAST)
-        escaped_printf (out, " when=\"last\"");
+        attribute (writer, "when", "last");
       else if (query.signal_flags & G_SIGNAL_RUN_CLEANUP)
-        escaped_printf (out, " when=\"cleanup\"");
+        attribute (writer, "when", "cleanup");
 #if GLIB_CHECK_VERSION(2, 29, 15)
       else if (query.signal_flags & G_SIGNAL_MUST_COLLECT)
-        escaped_printf (out, " when=\"must-collect\"");
+        attribute (writer, "when", "must-collect");
 #endif
       if (query.signal_flags & G_SIGNAL_NO_RECURSE)
-        escaped_printf (out, " no-recurse=\"1\"");
+        attribute (writer, "no-recurse", "1");
 
       if (query.signal_flags & G_SIGNAL_DETAILED)
-        escaped_printf (out, " detailed=\"1\"");
+        attribute (writer, "detailed", "1");
 
       if (query.signal_flags & G_SIGNAL_ACTION)
-        escaped_printf (out, " action=\"1\"");
+        attribute (writer, "action", "1");
 
       if (query.signal_flags & G_SIGNAL_NO_HOOKS)
-        escaped_printf (out, " no-hooks=\"1\"");
-
-      goutput_write (out, ">\n");
+        attribute (writer, "no-hooks", "1");
 
       for (j = 0; j < query.n_params; j++)
 	{
-	  escaped_printf (out, "      <param type=\"%s\"/>\n",
-			  g_type_name (query.param_types[j]));
+	  start_element (writer, "param");
+	  attribute (writer, "type", g_type_name (query.param_types[j]));
+	  end_element (writer, "param");
 	}
-      goutput_write (out, "    </signal>\n");
+      end_element (writer, "signal");
     }
+  g_free (sig_ids);
 }
 
 static void
-dump_object_type (GType type, const char *symbol, GOutputStream *out)
+dump_parents (GType type, DumpWriter *writer)
 {
-  guint n_interfaces;
-  guint i;
-  GType *interfaces;
+  GString *parent_str;
+  GType parent;
+  gboolean first = TRUE;
 
-  escaped_printf (out, "  <class name=\"%s\" get-type=\"%s\"",
-		  g_type_name (type), symbol);
-  if (type != G_TYPE_OBJECT)
+  parent = g_type_parent (type);
+  parent_str = g_string_new ("");
+  while (parent != G_TYPE_INVALID)
     {
-      GString *parent_str;
-      GType parent;
-      gboolean first = TRUE;
+      if (first)
+        first = FALSE;
+      else
+        g_string_append_c (parent_str, ',');
+      if (!g_type_name (parent))
+        break;
+      g_string_append (parent_str, g_type_name (parent));
+      parent = g_type_parent (parent);
+    }
 
-      parent = g_type_parent (type);
-      parent_str = g_string_new ("");
-      while (parent != G_TYPE_INVALID)
-        {
-          if (first)
-            first = FALSE;
-          else
-            g_string_append_c (parent_str, ',');
-          g_string_append (parent_str, g_type_name (parent));
-          parent = g_type_parent (parent);
-        }
+  if (parent_str->len > 0)
+    attribute (writer, "parents", parent_str->str);
+  g_string_free (parent_str, TRUE);
+}
 
-      escaped_printf (out, " parents=\"%s\"", parent_str->str);
+static void
+dump_object_type (GType type, const char *symbol, DumpWriter *writer)
+{
+  guint n_interfaces;
+  guint i;
+  GType *interfaces;
 
-      g_string_free (parent_str, TRUE);
-    }
+  start_element (writer, "class");
+  attribute (writer, "name", g_type_name (type));
+  attribute (writer, "get-type", symbol);
+  if (type != G_TYPE_OBJECT)
+    dump_parents (type, writer);
 
   if (G_TYPE_IS_ABSTRACT (type))
-    escaped_printf (out, " abstract=\"1\"");
-  goutput_write (out, ">\n");
+    attribute (writer, "abstract", "1");
 
   interfaces = g_type_interfaces (type, &n_interfaces);
   for (i = 0; i < n_interfaces; i++)
     {
       GType itype = interfaces[i];
-      escaped_printf (out, "    <implements name=\"%s\"/>\n",
-		      g_type_name (itype));
+      start_element (writer, "implements");
+      attribute (writer, "name", g_type_name (itype));
+      end_element (writer, "implements");
     }
-  dump_properties (type, out);
-  dump_signals (type, out);
-  goutput_write (out, "  </class>\n");
+  g_free (interfaces);
+  dump_properties (type, writer);
+  dump_signals (type, writer);
+  end_element (writer, "class");
 }
 
 static void
-dump_interface_type (GType type, const char *symbol, GOutputStream *out)
+dump_interface_type (GType type, const char *symbol, DumpWriter *writer)
 {
   guint n_interfaces;
   guint i;
   GType *interfaces;
 
-  escaped_printf (out, "  <interface name=\"%s\" get-type=\"%s\">\n",
-		  g_type_name (type), symbol);
+  start_element (writer, "interface");
+  attribute (writer, "name", g_type_name (type));
+  attribute (writer, "get-type", symbol);
 
   interfaces = g_type_interface_prerequisites (type, &n_interfaces);
   for (i = 0; i < n_interfaces; i++)
@@ -277,145 +409,188 @@ dump_interface_type (GType type, const char *symbol, GOutputStream *out)
 	   */
 	  continue;
 	}
-      escaped_printf (out, "    <prerequisite name=\"%s\"/>\n",
-		      g_type_name (itype));
+      start_element (writer, "prerequisite");
+      attribute (writer, "name", g_type_name (itype));
+      end_element (writer, "prerequisite");
     }
-  dump_properties (type, out);
-  dump_signals (type, out);
-  goutput_write (out, "  </interface>\n");
+  g_free (interfaces);
+  dump_properties (type, writer);
+  dump_signals (type, writer);
+  end_element (writer, "interface");
 }
 
 static void
-dump_boxed_type (GType type, const char *symbol, GOutputStream *out)
+dump_boxed_type (GType type, const char *symbol, DumpWriter *writer)
 {
-  escaped_printf (out, "  <boxed name=\"%s\" get-type=\"%s\"/>\n",
-		  g_type_name (type), symbol);
+  start_element (writer, "boxed");
+  attribute (writer, "name", g_type_name (type));
+  attribute (writer, "get-type", symbol);
+  end_element (writer, "boxed");
 }
 
 static void
-dump_flags_type (GType type, const char *symbol, GOutputStream *out)
+dump_flags_type (GType type, const char *symbol, DumpWriter *writer)
 {
   guint i;
   GFlagsClass *klass;
 
   klass = g_type_class_ref (type);
-  escaped_printf (out, "  <flags name=\"%s\" get-type=\"%s\">\n",
-		  g_type_name (type), symbol);
+  start_element (writer, "flags");
+  attribute (writer, "name", g_type_name (type));
+  attribute (writer, "get-type", symbol);
 
   for (i = 0; i < klass->n_values; i++)
     {
       GFlagsValue *value = &(klass->values[i]);
 
-      escaped_printf (out, "    <member name=\"%s\" nick=\"%s\" value=\"%d\"/>\n",
-		      value->value_name, value->value_nick, value->value);
+      start_element (writer, "member");
+      attribute (writer, "name", value->value_name);
+      attribute (writer, "nick", value->value_nick);
+      attribute_int (writer, "value", value->value);
+      end_element (writer, "member");
     }
-  goutput_write (out, "  </flags>\n");
+  end_element (writer, "flags");
 }
 
 static void
-dump_enum_type (GType type, const char *symbol, GOutputStream *out)
+dump_enum_type (GType type, const char *symbol, DumpWriter *writer)
 {
   guint i;
   GEnumClass *klass;
 
   klass = g_type_class_ref (type);
-  escaped_printf (out, "  <enum name=\"%s\" get-type=\"%s\">\n",
-		  g_type_name (type), symbol);
+  start_element (writer, "enum");
+  attribute (writer, "name", g_type_name (type));
+  attribute (writer, "get-type", symbol);
 
   for (i = 0; i < klass->n_values; i++)
     {
       GEnumValue *value = &(klass->values[i]);
 
-      escaped_printf (out, "    <member name=\"%s\" nick=\"%s\" value=\"%d\"/>\n",
-		      value->value_name, value->value_nick, value->value);
+      start_element (writer, "member");
+      attribute (writer, "name", value->value_name);
+      attribute (writer, "nick", value->value_nick);
+      attribute_int (writer, "value", value->value);
+      end_element (writer, "member");
     }
-  goutput_write (out, "  </enum>");
+  end_element (writer, "enum");
 }
 
 static void
-dump_fundamental_type (GType type, const char *symbol, GOutputStream *out)
+dump_fundamental_type (GType type, const char *symbol, DumpWriter *writer)
 {
   guint n_interfaces;
   guint i;
   GType *interfaces;
-  GString *parent_str;
-  GType parent;
-  gboolean first = TRUE;
-
 
-  escaped_printf (out, "  <fundamental name=\"%s\" get-type=\"%s\"",
-		  g_type_name (type), symbol);
+  start_element (writer, "fundamental");
+  attribute (writer, "name", g_type_name (type));
+  attribute (writer, "get-type", symbol);
 
   if (G_TYPE_IS_ABSTRACT (type))
-    escaped_printf (out, " abstract=\"1\"");
+    attribute (writer, "abstract", "1");
 
   if (G_TYPE_IS_INSTANTIATABLE (type))
-    escaped_printf (out, " instantiatable=\"1\"");
+    attribute (writer, "instantiatable", "1");
 
-  parent = g_type_parent (type);
-  parent_str = g_string_new ("");
-  while (parent != G_TYPE_INVALID)
-    {
-      if (first)
-        first = FALSE;
-      else
-        g_string_append_c (parent_str, ',');
-      if (!g_type_name (parent))
-        break;
-      g_string_append (parent_str, g_type_name (parent));
-      parent = g_type_parent (parent);
-    }
-
-  if (parent_str->len > 0)
-    escaped_printf (out, " parents=\"%s\"", parent_str->str);
-  g_string_free (parent_str, TRUE);
-
-  goutput_write (out, ">\n");
+  dump_parents (type, writer);
 
   interfaces = g_type_interfaces (type, &n_interfaces);
   for (i = 0; i < n_interfaces; i++)
     {
       GType itype = interfaces[i];
-      escaped_printf (out, "    <implements name=\"%s\"/>\n",
-		      g_type_name (itype));
+      start_element (writer, "implements");
+      attribute (writer, "name", g_type_name (itype));
+      end_element (writer, "implements");
     }
-  goutput_write (out, "  </fundamental>\n");
+  g_free (interfaces);
+  end_element (writer, "fundamental");
 }
 
 static void
-dump_type (GType type, const char *symbol, GOutputStream *out)
+dump_type (GType type, const char *symbol, DumpWriter *writer)
 {
   switch (g_type_fundamental (type))
     {
     case G_TYPE_OBJECT:
-      dump_object_type (type, symbol, out);
+      dump_object_type (type, symbol, writer);
       break;
     case G_TYPE_INTERFACE:
-      dump_interface_type (type, symbol, out);
+      dump_interface_type (type, symbol, writer);
       break;
     case G_TYPE_BOXED:
-      dump_boxed_type (type, symbol, out);
+      dump_boxed_type (type, symbol, writer);
       break;
     case G_TYPE_FLAGS:
-      dump_flags_type (type, symbol, out);
+      dump_flags_type (type, symbol, writer);
       break;
     case G_TYPE_ENUM:
-      dump_enum_type (type, symbol, out);
+      dump_enum_type (type, symbol, writer);
       break;
     case G_TYPE_POINTER:
       /* GValue, etc.  Just skip them. */
       break;
     default:
-      dump_fundamental_type (type, symbol, out);
+      dump_fundamental_type (type, symbol, writer);
       break;
     }
 }
 
 static void
-dump_error_quark (GQuark quark, const char *symbol, GOutputStream *out)
+dump_error_quark (GQuark quark, const char *symbol, DumpWriter *writer)
+{
+  start_element (writer, "error-quark");
+  attribute (writer, "function", symbol);
+  attribute (writer, "domain", g_quark_to_string (quark));
+  end_element (writer, "error-quark");
+}
+
+/* Parses the input file, which has been loaded into @contents; the
+ * requests point into it.
+ */
+static GArray *
+parse_requests (char *contents, gboolean *binary)
 {
-  escaped_printf (out, "  <error-quark function=\"%s\" domain=\"%s\"/>\n",
-		  symbol, g_quark_to_string (quark));
+  GArray *requests;
+  char *line, *next;
+
+  requests = g_array_new (FALSE, FALSE, sizeof (DumpRequest));
+  *binary = FALSE;
+
+  for (line = contents; line != NULL && *line != '\0'; line = next)
+    {
+      DumpRequest request;
+
+      next = strchr (line, '\n');
+      if (next != NULL)
+        *next++ = '\0';
+
+      g_strchomp (line);
+      if (*line == '\0')
+        break;
+
+      if (g_str_has_prefix (line, "get-type:"))
+        {
+          request.is_error_quark = FALSE;
+          request.function = line + strlen ("get-type:");
+        }
+      else if (g_str_has_prefix (line, "error-quark:"))
+        {
+          request.is_error_quark = TRUE;
+          request.function = line + strlen ("error-quark:");
+        }
+      else
+        {
+          if (strcmp (line, "dump-format:binary") == 0)
+            *binary = TRUE;
+          continue;
+        }
+
+      request.symbol = NULL;
+      g_array_append_val (requests, request);
+    }
+
+  return requests;
 }
 
 /**
@@ -430,6 +605,13 @@ dump_error_quark (GQuark quark, const char *symbol, GOutputStream *out)
  * "error-quark:" followed by the name of an error quark function.  No
  * extra whitespace is allowed.
  *
+ * If the input file contains a line "dump-format:binary", the output
+ * is written in a compact binary format instead of XML; see the top
+ * of gdump.c for its description.
+ *
+ * All the functions are looked up before any of them is called, so a
+ * missing symbol is reported without running the others.
+ *
  * The output file should already exist, but be empty.  This function will
  * overwrite its contents.
  *
@@ -449,11 +631,14 @@ g_irepository_dump (const char *arg, GError **error)
   char **args;
   GFile *input_file;
   GFile *output_file;
-  GFileInputStream *input;
+  char *contents;
+  GArray *requests;
   GFileOutputStream *output;
-  GDataInputStream *in;
+  DumpWriter writer;
   GModule *self;
+  gboolean binary;
   gboolean caught_error = FALSE;
+  guint i;
 
   self = g_module_open (NULL, 0);
   if (!self)
@@ -471,97 +656,118 @@ g_irepository_dump (const char *arg, GError **error)
   input_file = g_file_new_for_path (args[0]);
   output_file = g_file_new_for_path (args[1]);
 
-  input = g_file_read (input_file, NULL, error);
-  if (input == NULL)
-    return FALSE;
+  g_strfreev (args);
 
-  output = g_file_replace (output_file, NULL, FALSE, 0, NULL, error);
-  if (output == NULL)
+  if (!g_file_load_contents (input_file, NULL, &contents, NULL, NULL, error))
     {
-      g_input_stream_close (G_INPUT_STREAM (input), NULL, NULL);
+      g_object_unref (input_file);
+      g_object_unref (output_file);
       return FALSE;
     }
+  g_object_unref (input_file);
 
-  goutput_write (G_OUTPUT_STREAM (output), "<?xml version=\"1.0\"?>\n");
-  goutput_write (G_OUTPUT_STREAM (output), "<dump>\n");
+  requests = parse_requests (contents, &binary);
 
-  output_types = g_hash_table_new (NULL, NULL);
-
-  in = g_data_input_stream_new (G_INPUT_STREAM (input));
-  g_object_unref (input);
-
-  while (TRUE)
+  for (i = 0; i < requests->len; i++)
     {
-      gsize len;
-      char *line = g_data_input_stream_read_line (in, &len, NULL, NULL);
-      const char *function;
+      DumpRequest *request = &g_array_index (requests, DumpRequest, i);
 
-      if (line == NULL || *line == '\0')
+      if (!resolve_symbol (self, request, error))
         {
-          g_free (line);
-          break;
+          if (request->is_error_quark)
+            g_printerr ("Invalid error quark function: '%s'\n", request->function);
+          else
+            g_printerr ("Invalid GType function: '%s'\n", request->function);
+          g_array_free (requests, TRUE);
+          g_free (contents);
+          return FALSE;
         }
+    }
 
-      g_strchomp (line);
+  output = g_file_replace (output_file, NULL, FALSE, 0, NULL, error);
+  g_object_unref (output_file);
+  if (output == NULL)
+    {
+      g_array_free (requests, TRUE);
+      g_free (contents);
+      return FALSE;
+    }
 
-      if (strncmp (line, "get-type:", strlen ("get-type:")) == 0)
+  /* Many small writes; let them reach the file in large chunks */
+  writer.out = g_buffered_output_stream_new_sized (G_OUTPUT_STREAM (output),
+                                                   DUMP_BUFFER_SIZE);
+  g_object_unref (output);
+  writer.binary = binary;
+  writer.depth = 0;
+  writer.start_open = FALSE;
+  writer.record = g_string_new (NULL);
+
+  if (binary)
+    goutput_write_len (writer.out, DUMP_BINARY_MAGIC, strlen (DUMP_BINARY_MAGIC));
+  else
+    goutput_write (writer.out, "<?xml version=\"1.0\"?>\n");
+  start_element (&writer, "dump");
+
+  output_types = g_hash_table_new (NULL, NULL);
+
+  for (i = 0; i < requests->len; i++)
+    {
+      DumpRequest *request = &g_array_index (requests, DumpRequest, i);
+
+      if (!request->is_error_quark)
         {
           GType type;
 
-          function = line + strlen ("get-type:");
-
-          type = invoke_get_type (self, function, error);
+          type = invoke_get_type (request, error);
 
           if (type == G_TYPE_INVALID)
             {
-              g_printerr ("Invalid GType function: '%s'\n", function);
+              g_printerr ("Invalid GType function: '%s'\n", request->function);
               caught_error = TRUE;
-              g_free (line);
               break;
             }
 
           if (g_hash_table_lookup (output_types, (gpointer) type))
-            goto next;
+            continue;
           g_hash_table_insert (output_types, (gpointer) type, (gpointer) type);
 
-          dump_type (type, function, G_OUTPUT_STREAM (output));
+          dump_type (type, request->function, &writer);
         }
-      else if (strncmp (line, "error-quark:", strlen ("error-quark:")) == 0)
+      else
         {
           GQuark quark;
-          function = line + strlen ("error-quark:");
-          quark = invoke_error_quark (self, function, error);
+
+          quark = invoke_error_quark (request, error);
 
           if (quark == 0)
             {
-              g_printerr ("Invalid error quark function: '%s'\n", function);
+              g_printerr ("Invalid error quark function: '%s'\n", request->function);
               caught_error = TRUE;
-              g_free (line);
               break;
             }
 
-          dump_error_quark (quark, function, G_OUTPUT_STREAM (output));
+          dump_error_quark (quark, request->function, &writer);
         }
-
-
-    next:
-      g_free (line);
     }
 
   g_hash_table_destroy (output_types);
+  g_array_free (requests, TRUE);
+  g_free (contents);
 
-  goutput_write (G_OUTPUT_STREAM (output), "</dump>\n");
+  end_element (&writer, "dump");
+  g_string_free (writer.record, TRUE);
 
   {
     GError **ioerror;
+    gboolean closed;
     /* Avoid overwriting an earlier set error */
     if (caught_error)
       ioerror = NULL;
     else
       ioerror = error;
-    if (!g_input_stream_close (G_INPUT_STREAM (in), NULL, ioerror))
-      return FALSE;
-    if (!g_output_stream_close (G_OUTPUT_STREAM (output), NULL, ioerror))
+    closed = g_output_stream_close (writer.out, NULL, ioerror);
+    g_object_unref (writer.out);
+    if (!closed)
       return FALSE;
   }
 
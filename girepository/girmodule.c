@@ -30,7 +30,8 @@
 #define ALIGN_VALUE(this, boundary) \
   (( ((unsigned long)(this)) + (((unsigned long)(boundary)) -1)) & (~(((unsigned long)(boundary))-1)))
 
-#define NUM_SECTIONS 2
+/* Room for one of each known section, plus the terminator */
+#define NUM_SECTIONS GI_SECTION_N_TYPES
 
 GIrModule *
 _g_ir_module_new (const gchar *name,
@@ -231,8 +232,10 @@ alloc_section (guint8 *data, SectionType section_id, guint32 offset)
   Section *section_data = (Section*)&data[header->sections];
 
   g_assert (section_id != GI_SECTION_END);
+  g_assert (section_id < GI_SECTION_N_TYPES);
 
-  for (i = 0; i < NUM_SECTIONS; i++)
+  /* The last slot is reserved for the terminator */
+  for (i = 0; i < NUM_SECTIONS - 1; i++)
     {
       if (section_data->id == GI_SECTION_END)
 	{
@@ -252,7 +255,7 @@ add_directory_index_section (guint8 *data, GIrModule *module, guint32 *offset2)
   Header *header = (Header*)data;
   GITypelibHashBuilder *dirindex_builder;
   guint i, n_interfaces;
-  guint16 required_size;
+  guint32 required_size;
   guint32 new_offset;
 
   dirindex_builder = _gi_typelib_hash_builder_new ();
@@ -310,6 +313,7 @@ _g_ir_module_build_typelib (GIrModule  *module)
   guint32 size, offset, offset2, old_offset;
   GHashTable *strings;
   GHashTable *types;
+  GHashTable *resolved_nodes;
   GList *nodes_with_attributes;
   char *dependencies;
   guchar *data;
@@ -344,6 +348,8 @@ _g_ir_module_build_typelib (GIrModule  *module)
   _g_irnode_init_stats ();
   strings = g_hash_table_new (g_str_hash, g_str_equal);
   types = g_hash_table_new (g_str_hash, g_str_equal);
+  resolved_nodes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                          g_free, NULL);
   nodes_with_attributes = NULL;
   n_entries = g_list_length (module->entries);
 
@@ -431,8 +437,7 @@ _g_ir_module_build_typelib (GIrModule  *module)
   header->sections = offset2;
 
   /* Initialize all the sections to _END/0; we fill them in later using
-   * alloc_section().  (Right now there's just the directory index
-   * though, note)
+   * alloc_section().
    */
   for (i = 0; i < NUM_SECTIONS; i++)
     {
@@ -466,6 +471,7 @@ _g_ir_module_build_typelib (GIrModule  *module)
 
 	  g_hash_table_destroy (strings);
 	  g_hash_table_destroy (types);
+	  g_hash_table_destroy (resolved_nodes);
 
 	  /* Reset the cached offsets */
 	  for (link = nodes_with_attributes; link; link = link->next)
@@ -505,6 +511,7 @@ _g_ir_module_build_typelib (GIrModule  *module)
 	  build.module = module;
 	  build.strings = strings;
 	  build.types = types;
+	  build.resolved_nodes = resolved_nodes;
 	  build.nodes_with_attributes = nodes_with_attributes;
 	  build.n_attributes = header->n_attributes;
 	  build.data = data;
@@ -556,6 +563,7 @@ _g_ir_module_build_typelib (GIrModule  *module)
 
   g_hash_table_destroy (strings);
   g_hash_table_destroy (types);
+  g_hash_table_destroy (resolved_nodes);
   g_list_free (nodes_with_attributes);
 
   return typelib;
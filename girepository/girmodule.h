@@ -38,6 +38,8 @@ struct _GIrTypelibBuild {
   guint32      n_attributes;
   guchar      *data;
   GList       *stack; 
+  /* Qualified name -> GIrNode, see _g_ir_find_node() */
+  GHashTable  *resolved_nodes;
 };
 
 struct _GIrModule
@@ -58,6 +60,12 @@ struct _GIrModule
   /* Structures with the 'disguised' flag (typedef struct _X *X)
   * in the module or in included modules */
   GHashTable *disguised_structures;
+
+  /* Set for modules parsed as includes only; their toplevel entries
+   * are built on first lookup, see _g_ir_find_node() */
+  struct _GIrNode *(*materialize_entry) (GIrModule   *module,
+                                         const gchar *name);
+  gpointer lazy_data;
 };
 
 GIrModule *_g_ir_module_new            (const gchar *name,
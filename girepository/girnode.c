@@ -1135,10 +1135,33 @@ _g_ir_find_node (GIrTypelibBuild  *build,
 {
   GList *l;
   GIrNode *return_node = NULL;
-  char **names = g_strsplit (name, ".", 0);
-  gint n_names = g_strv_length (names);
+  char **names;
+  gint n_names;
   const char *target_name;
   GIrModule *target_module;
+  gchar *key = NULL;
+  gpointer cached;
+
+  /* The same types are looked up over and over while computing
+   * struct layouts, so remember the answers for the whole build.
+   */
+  if (build->resolved_nodes != NULL)
+    {
+      if (strchr (name, '.') == NULL)
+	key = g_strconcat (src_module->name, ".", name, NULL);
+      else
+	key = g_strdup (name);
+
+      if (g_hash_table_lookup_extended (build->resolved_nodes, key,
+					NULL, &cached))
+	{
+	  g_free (key);
+	  return cached;
+	}
+    }
+
+  names = g_strsplit (name, ".", 0);
+  n_names = g_strv_length (names);
 
   if (n_names == 1)
     {
@@ -1166,9 +1189,15 @@ _g_ir_find_node (GIrTypelibBuild  *build,
 	}
     }
 
+  if (return_node == NULL && target_module->materialize_entry != NULL)
+    return_node = target_module->materialize_entry (target_module, target_name);
+
 done:
   g_strfreev (names);
 
+  if (key != NULL)
+    g_hash_table_insert (build->resolved_nodes, key, return_node);
+
   return return_node;
 }
 
@@ -497,23 +497,86 @@ check_needs_computation (GIrTypelibBuild *build,
   return alignment == 0;
 }
 
-/*
- * _g_ir_node_compute_offsets:
- * @build: Current typelib build
- * @node: a #GIrNode
- *
- * If a node is a a structure or union, makes sure that the field
- * offsets have been computed, and also computes the overall size and
- * alignment for the type.
+/* Returns the location of the memoized alignment of @node, which also
+ * records the state of its computation (see check_needs_computation()),
+ * or %NULL if @node does not have a layout of its own.
  */
-void
-_g_ir_node_compute_offsets (GIrTypelibBuild *build,
-			    GIrNode         *node)
+static gint *
+get_alignment_location (GIrNode *node)
+{
+  switch (node->type)
+    {
+    case G_IR_NODE_BOXED:
+      return &((GIrNodeBoxed *)node)->alignment;
+    case G_IR_NODE_STRUCT:
+      return &((GIrNodeStruct *)node)->alignment;
+    case G_IR_NODE_OBJECT:
+    case G_IR_NODE_INTERFACE:
+      return &((GIrNodeInterface *)node)->alignment;
+    case G_IR_NODE_UNION:
+      return &((GIrNodeUnion *)node)->alignment;
+    default:
+      return NULL;
+    }
+}
+
+static GList *
+get_members (GIrNode *node)
+{
+  switch (node->type)
+    {
+    case G_IR_NODE_BOXED:
+      return ((GIrNodeBoxed *)node)->members;
+    case G_IR_NODE_STRUCT:
+      return ((GIrNodeStruct *)node)->members;
+    case G_IR_NODE_OBJECT:
+    case G_IR_NODE_INTERFACE:
+      return ((GIrNodeInterface *)node)->members;
+    case G_IR_NODE_UNION:
+      return ((GIrNodeUnion *)node)->members;
+    default:
+      return NULL;
+    }
+}
+
+/* Pushes the type embedded by value in a field of type @type onto
+ * @pending, if its layout has not been computed yet.
+ */
+static GSList *
+push_field_dependency (GIrTypelibBuild *build,
+		       GIrNodeType     *type,
+		       GSList          *pending)
+{
+  GIrNode *iface;
+  gint *alignment;
+
+  while (type != NULL && !type->is_pointer &&
+	 type->tag == GI_TYPE_TAG_ARRAY && type->has_size)
+    type = type->parameter_type1;
+
+  if (type == NULL || type->is_pointer || type->tag != GI_TYPE_TAG_INTERFACE)
+    return pending;
+
+  /* Unresolved types are reported when the field itself is computed */
+  iface = _g_ir_find_node (build, ((GIrNode*)type)->module, type->giinterface);
+  if (iface == NULL)
+    return pending;
+
+  alignment = get_alignment_location (iface);
+  if (alignment != NULL && *alignment == 0)
+    pending = g_slist_prepend (pending, iface);
+
+  return pending;
+}
+
+static void
+compute_node_offsets (GIrTypelibBuild *build,
+		      GIrNode         *node)
 {
   gboolean appended_stack;
 
   if (build->stack)
-    appended_stack = node != (GIrNode*)build->stack->data; 
+    appended_stack = node != (GIrNode*)build->stack->data;
   else
     appended_stack = TRUE;
   if (appended_stack)
@@ -525,9 +588,6 @@ _g_ir_node_compute_offsets (GIrTypelibBuild *build,
       {
 	GIrNodeBoxed *boxed = (GIrNodeBoxed *)node;
 
-	if (!check_needs_computation (build, node, boxed->alignment))
-	  return;
-
 	compute_struct_field_offsets (build, node, boxed->members,
 				      &boxed->size, &boxed->alignment);
 	break;
@@ -536,9 +596,6 @@ _g_ir_node_compute_offsets (GIrTypelibBuild *build,
       {
 	GIrNodeStruct *struct_ = (GIrNodeStruct *)node;
 
-	if (!check_needs_computation (build, node, struct_->alignment))
-	  return;
-
 	compute_struct_field_offsets (build, node, struct_->members,
 				      &struct_->size, &struct_->alignment);
 	break;
@@ -548,9 +605,6 @@ _g_ir_node_compute_offsets (GIrTypelibBuild *build,
       {
 	GIrNodeInterface *iface = (GIrNodeInterface *)node;
 
-	if (!check_needs_computation (build, node, iface->alignment))
-	  return;
-
 	compute_struct_field_offsets (build, node, iface->members,
 				      &iface->size, &iface->alignment);
 	break;
@@ -559,29 +613,84 @@ _g_ir_node_compute_offsets (GIrTypelibBuild *build,
       {
 	GIrNodeUnion *union_ = (GIrNodeUnion *)node;
 
-	if (!check_needs_computation (build, node, union_->alignment))
-	  return;
-
-	compute_union_field_offsets (build, (GIrNode*)union_, union_->members,
+	compute_union_field_offsets (build, node, union_->members,
 				     &union_->size, &union_->alignment);
 	break;
       }
-    case G_IR_NODE_ENUM:
-    case G_IR_NODE_FLAGS:
-      {
-	GIrNodeEnum *enum_ = (GIrNodeEnum *)node;
-
-	if (enum_->storage_type != GI_TYPE_TAG_VOID) /* already done */
-	  return;
-
-	compute_enum_storage_type (enum_);
-
-	break;
-      }
     default:
-      break;
+      g_assert_not_reached ();
     }
-  
+
   if (appended_stack)
     build->stack = g_list_delete_link (build->stack, build->stack);
 }
+
+/*
+ * _g_ir_node_compute_offsets:
+ * @build: Current typelib build
+ * @node: a #GIrNode
+ *
+ * If a node is a a structure or union, makes sure that the field
+ * offsets have been computed, and also computes the overall size and
+ * alignment for the type.
+ *
+ * The types that @node embeds by value are computed first, walking
+ * them with an explicit work list rather than recursing once per
+ * nesting level. Results are stored on the nodes themselves, so every
+ * type (including those from included modules) is only computed once
+ * per build.
+ */
+void
+_g_ir_node_compute_offsets (GIrTypelibBuild *build,
+			    GIrNode         *node)
+{
+  GSList *pending;
+  gint *alignment;
+
+  if (node->type == G_IR_NODE_ENUM || node->type == G_IR_NODE_FLAGS)
+    {
+      compute_enum_storage_type ((GIrNodeEnum *)node);
+      return;
+    }
+
+  alignment = get_alignment_location (node);
+  if (alignment == NULL || !check_needs_computation (build, node, *alignment))
+    return;
+
+  pending = g_slist_prepend (NULL, node);
+  while (pending != NULL)
+    {
+      GIrNode *current = pending->data;
+
+      alignment = get_alignment_location (current);
+
+      if (*alignment == 0)
+	{
+	  GSList *before = pending;
+	  GList *l;
+
+	  /* Dependencies that are already in progress form a cycle,
+	   * which is reported when the fields are computed below.
+	   */
+	  *alignment = -2;
+	  for (l = get_members (current); l; l = l->next)
+	    {
+	      GIrNode *member = (GIrNode *)l->data;
+
+	      if (member->type == G_IR_NODE_FIELD &&
+		  ((GIrNodeField *)member)->callback == NULL)
+		pending = push_field_dependency (build,
+						 ((GIrNodeField *)member)->type,
+						 pending);
+	    }
+
+	  if (pending != before)
+	    continue;
+	}
+
+      if (*alignment == -2)
+	compute_node_offsets (build, current);
+
+      pending = g_slist_delete_link (pending, pending);
+    }
+}
@@ -30,6 +30,7 @@
 #include "girparser.h"
 #include "girmodule.h"
 #include "girnode.h"
+#include "girtokenizer.h"
 #include "gitypelib-internal.h"
 
 /* This is a "major" version in the sense that it's only bumped
@@ -59,6 +60,8 @@ struct _GIrParser
 {
   gchar **includes;
   GList *parsed_modules; /* All previously parsed modules */
+  GList *lazy_modules; /* LazyModule data of modules parsed as includes */
+  gboolean validate_markup; /* Use GMarkup instead of GIrTokenizer */
 };
 
 typedef enum
@@ -126,7 +129,27 @@ struct _ParseContext
   GList *type_parameters;
   int type_depth;
   ParseState in_embedded_state;
+
+  /* Only set when not parsing through GMarkup */
+  GIrTokenizer *tokenizer;
+  const GIrToken *current_token;
+  /* Set when parsing an include: toplevel entry name -> start token + 1 */
+  GHashTable *lazy_entries;
 };
+
+/* Included modules are only needed for resolving the types referenced
+ * by the module being compiled, so instead of building nodes for all
+ * of their entries we keep the tokens around and replay the ones of an
+ * entry when it is first looked up.
+ */
+typedef struct
+{
+  GIrParser *parser;
+  gchar *buffer;           /* The contents of the file, tokenized in place */
+  GIrTokenizer *tokenizer;
+  gchar *file_path;
+  GHashTable *entries;
+} LazyModule;
 #define CURRENT_NODE(ctx) ((GIrNode *)((ctx)->node_stack->data))
 
 static void start_element_handler (GMarkupParseContext *context,
@@ -187,6 +210,8 @@ _g_ir_parser_new (void)
   return parser;
 }
 
+static void lazy_module_free (LazyModule *lazy);
+
 void
 _g_ir_parser_free (GIrParser *parser)
 {
@@ -198,6 +223,10 @@ _g_ir_parser_free (GIrParser *parser)
   for (l = parser->parsed_modules; l; l = l->next)
     _g_ir_module_free (l->data);
 
+  for (l = parser->lazy_modules; l; l = l->next)
+    lazy_module_free (l->data);
+  g_list_free (parser->lazy_modules);
+
   g_slice_free (GIrParser, parser);
 }
 
@@ -312,10 +341,23 @@ locate_gir (GIrParser  *parser,
   return NULL;
 }
 
-#define MISSING_ATTRIBUTE(context,error,element,attribute)			        \
+static void
+get_position (GMarkupParseContext *context,
+	      ParseContext        *ctx,
+	      int                 *line_number,
+	      int                 *char_number)
+{
+  if (context != NULL)
+    g_markup_parse_context_get_position (context, line_number, char_number);
+  else
+    _g_ir_tokenizer_get_position (ctx->tokenizer, ctx->current_token,
+				  line_number, char_number);
+}
+
+#define MISSING_ATTRIBUTE(context,ctx,error,element,attribute)			        \
   do {                                                                          \
     int line_number, char_number;                                                \
-    g_markup_parse_context_get_position (context, &line_number, &char_number);  \
+    get_position (context, ctx, &line_number, &char_number);                    \
     g_set_error (error,                                                         \
    	         G_MARKUP_ERROR,                                                \
 	         G_MARKUP_ERROR_INVALID_CONTENT,                                \
@@ -762,17 +804,17 @@ start_glib_boxed (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "glib:name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "glib:name");
       return FALSE;
     }
   else if (typename == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "glib:type-name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "glib:type-name");
       return FALSE;
     }
   else if (typeinit == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "glib:get-type");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "glib:get-type");
       return FALSE;
     }
 
@@ -857,12 +899,12 @@ start_function (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
   else if (strcmp (element_name, "callback") != 0 && symbol == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "c:identifier");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "c:identifier");
       return FALSE;
     }
 
@@ -1319,7 +1361,7 @@ start_field (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
 
@@ -1421,7 +1463,7 @@ start_alias (GMarkupParseContext *context,
   name = find_attribute ("name", attribute_names, attribute_values);
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
 
@@ -1461,7 +1503,7 @@ start_enum (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
 
@@ -1531,7 +1573,7 @@ start_property (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
 
@@ -1616,7 +1658,7 @@ start_member (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
 
@@ -1689,12 +1731,12 @@ start_constant (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
   else if (value == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "value");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "value");
       return FALSE;
     }
 
@@ -1758,17 +1800,17 @@ start_interface (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
   else if (typename == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "glib:type-name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "glib:type-name");
       return FALSE;
     }
   else if (typeinit == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "glib:get-type");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "glib:get-type");
       return FALSE;
     }
 
@@ -1834,17 +1876,17 @@ start_class (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
   else if (typename == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "glib:type-name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "glib:type-name");
       return FALSE;
     }
   else if (typeinit == NULL && strcmp (typename, "GObject"))
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "glib:get-type");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "glib:get-type");
       return FALSE;
     }
 
@@ -1939,7 +1981,7 @@ start_type (GMarkupParseContext *context,
 
       if (name == NULL)
 	{
-	  MISSING_ATTRIBUTE (context, error, element_name, "name");
+	  MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
 	  return FALSE;
 	}
 
@@ -2035,7 +2077,7 @@ start_type (GMarkupParseContext *context,
 
       if (name == NULL)
 	{
-	  MISSING_ATTRIBUTE (context, error, element_name, "name");
+	  MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
 	  return FALSE;
 	}
 
@@ -2212,12 +2254,12 @@ start_attribute (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
   if (value == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "value");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "value");
       return FALSE;
     }
 
@@ -2326,7 +2368,7 @@ start_implements (GMarkupParseContext *context,
   name = find_attribute ("name", attribute_names, attribute_values);
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
 
@@ -2372,7 +2414,7 @@ start_glib_signal (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
   signal = (GIrNodeSignal *)_g_ir_node_new (G_IR_NODE_SIGNAL,
@@ -2455,7 +2497,7 @@ start_vfunc (GMarkupParseContext *context,
 
   if (name == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
 
@@ -2547,17 +2589,17 @@ start_struct (GMarkupParseContext *context,
 
   if (name == NULL && ctx->node_stack == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
   if ((gtype_name == NULL && gtype_init != NULL))
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "glib:type-name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "glib:type-name");
       return FALSE;
     }
   if ((gtype_name != NULL && gtype_init == NULL))
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "glib:get-type");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "glib:get-type");
       return FALSE;
     }
 
@@ -2618,7 +2660,7 @@ start_union (GMarkupParseContext *context,
 
   if (name == NULL && ctx->node_stack == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "name");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
       return FALSE;
     }
 
@@ -2658,12 +2700,12 @@ start_discriminator (GMarkupParseContext *context,
   offset = find_attribute ("offset", attribute_names, attribute_values);
   if (type == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "type");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "type");
       return FALSE;
     }
   else if (offset == NULL)
     {
-      MISSING_ATTRIBUTE (context, error, element_name, "offset");
+      MISSING_ATTRIBUTE (context, ctx, error, element_name, "offset");
       return FALSE;
     }
 
@@ -2675,6 +2717,12 @@ start_discriminator (GMarkupParseContext *context,
   return TRUE;
 }
 
+static GIrModule *parse_gir_file (GIrParser    *parser,
+				  const gchar  *namespace,
+				  const gchar  *filename,
+				  gboolean      include_only,
+				  GError      **error);
+
 static gboolean
 parse_include (GMarkupParseContext *context,
 	       ParseContext        *ctx,
@@ -2682,8 +2730,6 @@ parse_include (GMarkupParseContext *context,
 	       const char          *version)
 {
   GError *error = NULL;
-  gchar *buffer;
-  gsize length;
   gchar *girpath, *girname;
   GIrModule *module;
   GList *l;
@@ -2723,21 +2769,17 @@ parse_include (GMarkupParseContext *context,
 
   g_debug ("Parsing include %s\n", girpath);
 
-  if (!g_file_get_contents (girpath, &buffer, &length, &error))
-    {
-      g_printerr ("%s: %s\n", girpath, error->message);
-      g_clear_error (&error);
-      g_free (girpath);
-      return FALSE;
-    }
-
-  module = _g_ir_parser_parse_string (ctx->parser, name, girpath, buffer, length, &error);
-  g_free (buffer);
+  module = parse_gir_file (ctx->parser, name, girpath, TRUE, &error);
   if (error != NULL)
     {
-      int line_number, char_number;
-      g_markup_parse_context_get_position (context, &line_number, &char_number);
-      g_printerr ("%s:%d:%d: error: %s\n", girpath, line_number, char_number, error->message);
+      if (error->domain == G_FILE_ERROR)
+	g_printerr ("%s: %s\n", girpath, error->message);
+      else
+	{
+	  int line_number, char_number;
+	  get_position (context, ctx, &line_number, &char_number);
+	  g_printerr ("%s:%d:%d: error: %s\n", girpath, line_number, char_number, error->message);
+	}
       g_clear_error (&error);
       g_free (girpath);
       return FALSE;
@@ -2879,12 +2921,12 @@ start_element_handler (GMarkupParseContext *context,
 
 	  if (name == NULL)
 	    {
-	      MISSING_ATTRIBUTE (context, error, element_name, "name");
+	      MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
 	      break;
 	    }
 	  if (version == NULL)
 	    {
-	      MISSING_ATTRIBUTE (context, error, element_name, "version");
+	      MISSING_ATTRIBUTE (context, ctx, error, element_name, "version");
 	      break;
 	    }
 
@@ -2959,9 +3001,9 @@ start_element_handler (GMarkupParseContext *context,
             cprefix = find_attribute ("c:prefix", attribute_names, attribute_values);
 
 	  if (name == NULL)
-	    MISSING_ATTRIBUTE (context, error, element_name, "name");
+	    MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
 	  else if (version == NULL)
-	    MISSING_ATTRIBUTE (context, error, element_name, "version");
+	    MISSING_ATTRIBUTE (context, ctx, error, element_name, "version");
 	  else
 	    {
 	      GList *l;
@@ -3021,7 +3063,7 @@ start_element_handler (GMarkupParseContext *context,
 	  state_switch (ctx, STATE_PREREQUISITE);
 
 	  if (name == NULL)
-	    MISSING_ATTRIBUTE (context, error, element_name, "name");
+	    MISSING_ATTRIBUTE (context, ctx, error, element_name, "name");
 	  else
 	    {
 	      GIrNodeInterface *iface;
@@ -3047,7 +3089,7 @@ start_element_handler (GMarkupParseContext *context,
 	  version = find_attribute ("version", attribute_names, attribute_values);
 
 	  if (version == NULL)
-	    MISSING_ATTRIBUTE (context, error, element_name, "version");
+	    MISSING_ATTRIBUTE (context, ctx, error, element_name, "version");
 	  else if (strcmp (version, SUPPORTED_GIR_VERSION) != 0)
 	    g_set_error (error,
 			 G_MARKUP_ERROR,
@@ -3097,7 +3139,7 @@ start_element_handler (GMarkupParseContext *context,
 
   if (*error == NULL && ctx->state != STATE_PASSTHROUGH)
     {
-      g_markup_parse_context_get_position (context, &line_number, &char_number);
+      get_position (context, ctx, &line_number, &char_number);
       if (!g_str_has_prefix (element_name, "c:"))
 	g_printerr ("%s:%d:%d: warning: element %s from state %d is unknown, ignoring\n",
 		    ctx->file_path, line_number, char_number, element_name,
@@ -3108,7 +3150,7 @@ start_element_handler (GMarkupParseContext *context,
  out:
   if (*error)
     {
-      g_markup_parse_context_get_position (context, &line_number, &char_number);
+      get_position (context, ctx, &line_number, &char_number);
 
       g_printerr ("%s:%d:%d: error: %s\n", ctx->file_path, line_number, char_number, (*error)->message);
     }
@@ -3142,7 +3184,7 @@ require_one_of_end_elements (GMarkupParseContext *context,
   if (matched)
     return TRUE;
 
-  g_markup_parse_context_get_position (context, &line_number, &char_number);
+  get_position (context, ctx, &line_number, &char_number);
   g_set_error (error,
 	       G_MARKUP_ERROR,
 	       G_MARKUP_ERROR_INVALID_CONTENT,
@@ -3174,7 +3216,7 @@ state_switch_end_struct_or_union (GMarkupParseContext *context,
       else
         {
           int line_number, char_number;
-          g_markup_parse_context_get_position (context, &line_number, &char_number);
+          get_position (context, ctx, &line_number, &char_number);
           g_set_error (error,
                        G_MARKUP_ERROR,
                        G_MARKUP_ERROR_INVALID_CONTENT,
@@ -3312,7 +3354,7 @@ end_element_handler (GMarkupParseContext *context,
 	    else
 	      {
 		int line_number, char_number;
-		g_markup_parse_context_get_position (context, &line_number, &char_number);
+		get_position (context, ctx, &line_number, &char_number);
 		g_set_error (error,
 			     G_MARKUP_ERROR,
 			     G_MARKUP_ERROR_INVALID_CONTENT,
@@ -3524,6 +3566,315 @@ cleanup (GMarkupParseContext *context,
   ctx->current_module = NULL;
 }
 
+static void
+parse_context_init (ParseContext *ctx,
+		    GIrParser    *parser,
+		    const gchar  *namespace,
+		    const gchar  *filename)
+{
+  ctx->parser = parser;
+  ctx->state = STATE_START;
+  ctx->file_path = filename;
+  ctx->namespace = namespace;
+  ctx->include_modules = NULL;
+  ctx->aliases = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  ctx->disguised_structures = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  ctx->type_depth = 0;
+  ctx->dependencies = NULL;
+  ctx->current_module = NULL;
+}
+
+static GIrModule *
+parse_context_finish (ParseContext  *ctx,
+		      GError       **error)
+{
+  if (ctx->modules == NULL)
+    {
+      /* An error occurred before we created a module, so we haven't
+       * transferred ownership of these hash tables to the module.
+       */
+      if (ctx->aliases != NULL)
+	g_hash_table_destroy (ctx->aliases);
+      if (ctx->disguised_structures != NULL)
+	g_hash_table_destroy (ctx->disguised_structures);
+      g_list_free (ctx->include_modules);
+    }
+
+  if (ctx->modules)
+    return ctx->modules->data;
+
+  if (error && *error == NULL)
+    g_set_error (error,
+                 G_MARKUP_ERROR,
+                 G_MARKUP_ERROR_INVALID_CONTENT,
+                 "Expected namespace element in the gir file");
+  return NULL;
+}
+
+static guint
+find_end_token (GIrTokenizer *tokenizer,
+		guint         start)
+{
+  guint i;
+  gint depth = 0;
+
+  for (i = start; i < tokenizer->tokens->len; i++)
+    {
+      const GIrToken *token = &g_array_index (tokenizer->tokens, GIrToken, i);
+
+      if (token->type == G_IR_TOKEN_START_ELEMENT)
+	depth++;
+      else if (--depth == 0)
+	break;
+    }
+
+  return i;
+}
+
+/* Feeds the tokens @first to @last of ctx->tokenizer through the same
+ * callbacks that GMarkup would call; the handlers get a %NULL
+ * #GMarkupParseContext and use get_position() to report locations.
+ *
+ * If ctx->lazy_entries is set, toplevel entries of the namespace are
+ * only indexed there and not handed to @markup.
+ */
+static gboolean
+replay_tokens (ParseContext        *ctx,
+	       const GMarkupParser *markup,
+	       guint                first,
+	       guint                last,
+	       GError             **error)
+{
+  GIrTokenizer *tokenizer = ctx->tokenizer;
+  GError *local_error = NULL;
+  guint i;
+
+  for (i = first; i <= last && i < tokenizer->tokens->len; i++)
+    {
+      const GIrToken *token = &g_array_index (tokenizer->tokens, GIrToken, i);
+      const gchar **attribute_names;
+      const gchar **attribute_values;
+
+      ctx->current_token = token;
+
+      if (token->type == G_IR_TOKEN_END_ELEMENT)
+	{
+	  if (markup->end_element)
+	    markup->end_element (NULL, token->name, ctx, &local_error);
+	}
+      else
+	{
+	  attribute_names = _g_ir_tokenizer_get_attribute_names (tokenizer, token);
+	  attribute_values = _g_ir_tokenizer_get_attribute_values (tokenizer, token);
+
+	  if (ctx->lazy_entries != NULL && ctx->state == STATE_NAMESPACE)
+	    {
+	      const gchar *name;
+
+	      name = find_attribute ("name", attribute_names, attribute_values);
+	      if (name == NULL)
+		name = find_attribute ("glib:name", attribute_names, attribute_values);
+
+	      /* Like _g_ir_find_node(), the first entry of a name wins */
+	      if (name != NULL && g_hash_table_lookup (ctx->lazy_entries, name) == NULL)
+		g_hash_table_insert (ctx->lazy_entries, (gchar *)name,
+				     GUINT_TO_POINTER (i + 1));
+
+	      i = find_end_token (tokenizer, i);
+	      continue;
+	    }
+
+	  if (markup->start_element)
+	    markup->start_element (NULL, token->name,
+				   attribute_names, attribute_values,
+				   ctx, &local_error);
+	}
+
+      if (local_error != NULL)
+	{
+	  if (markup->error)
+	    markup->error (NULL, local_error, ctx);
+	  g_propagate_error (error, local_error);
+	  return FALSE;
+	}
+    }
+
+  ctx->current_token = NULL;
+  return TRUE;
+}
+
+/* Runs both parser passes over the tokens of @tokenizer.  If
+ * @lazy_entries is given, the module is parsed as an include: its
+ * toplevel entries are indexed in @lazy_entries instead of being built.
+ */
+static GIrModule *
+parse_tokenized (GIrParser    *parser,
+		 const gchar  *namespace,
+		 const gchar  *filename,
+		 GIrTokenizer *tokenizer,
+		 GHashTable   *lazy_entries,
+		 GError      **error)
+{
+  ParseContext ctx = { 0 };
+
+  parse_context_init (&ctx, parser, namespace, filename);
+  ctx.tokenizer = tokenizer;
+
+  if (!_g_ir_tokenizer_tokenize (tokenizer, error))
+    goto out;
+
+  if (!replay_tokens (&ctx, &firstpass_parser, 0, G_MAXUINT, error))
+    goto out;
+
+  ctx.state = STATE_START;
+  ctx.lazy_entries = lazy_entries;
+  if (!replay_tokens (&ctx, &markup_parser, 0, G_MAXUINT, error))
+    goto out;
+
+  parser->parsed_modules = g_list_concat (g_list_copy (ctx.modules),
+					  parser->parsed_modules);
+
+ out:
+  return parse_context_finish (&ctx, error);
+}
+
+static LazyModule *
+lazy_module_new (GIrParser   *parser,
+		 const gchar *filename,
+		 gchar       *buffer,
+		 gsize        length)
+{
+  LazyModule *lazy = g_slice_new0 (LazyModule);
+
+  lazy->parser = parser;
+  lazy->buffer = buffer;
+  lazy->tokenizer = _g_ir_tokenizer_new (buffer, length);
+  lazy->file_path = g_strdup (filename);
+  /* Keys point into the buffer */
+  lazy->entries = g_hash_table_new (g_str_hash, g_str_equal);
+
+  return lazy;
+}
+
+static void
+lazy_module_free (LazyModule *lazy)
+{
+  g_hash_table_destroy (lazy->entries);
+  g_free (lazy->file_path);
+  _g_ir_tokenizer_free (lazy->tokenizer);
+  g_free (lazy->buffer);
+
+  g_slice_free (LazyModule, lazy);
+}
+
+static GIrNode *
+materialize_entry (GIrModule   *module,
+		   const gchar *name)
+{
+  LazyModule *lazy = module->lazy_data;
+  ParseContext ctx = { 0 };
+  GError *error = NULL;
+  GList *last, *l;
+  guint start;
+
+  start = GPOINTER_TO_UINT (g_hash_table_lookup (lazy->entries, name));
+  if (start == 0)
+    return NULL;
+  start -= 1;
+
+  /* Whatever happens below, the entry is only ever built once */
+  g_hash_table_remove (lazy->entries, name);
+
+  g_debug ("Materializing %s.%s from %s", module->name, name, lazy->file_path);
+
+  ctx.parser = lazy->parser;
+  ctx.state = STATE_NAMESPACE;
+  ctx.file_path = lazy->file_path;
+  ctx.namespace = module->name;
+  ctx.current_module = module;
+  ctx.tokenizer = lazy->tokenizer;
+
+  last = g_list_last (module->entries);
+
+  if (!replay_tokens (&ctx, &markup_parser, start,
+		      find_end_token (lazy->tokenizer, start), &error))
+    {
+      /* start_element_handler() already printed the location */
+      g_clear_error (&error);
+      g_slist_free (ctx.node_stack);
+      return NULL;
+    }
+
+  for (l = last ? last->next : module->entries; l; l = l->next)
+    {
+      GIrNode *node = l->data;
+
+      if (strcmp (node->name, name) == 0)
+	return node;
+    }
+
+  /* Not introspectable, or shadowed by another entry */
+  return NULL;
+}
+
+static GIrModule *
+parse_markup (GIrParser    *parser,
+	      const gchar  *namespace,
+	      const gchar  *filename,
+	      const gchar  *buffer,
+	      gssize        length,
+	      GError      **error)
+{
+  ParseContext ctx = { 0 };
+  GMarkupParseContext *context;
+
+  parse_context_init (&ctx, parser, namespace, filename);
+
+  context = g_markup_parse_context_new (&firstpass_parser, 0, &ctx, NULL);
+
+  if (!g_markup_parse_context_parse (context, buffer, length, error))
+    goto out;
+
+  if (!g_markup_parse_context_end_parse (context, error))
+    goto out;
+
+  g_markup_parse_context_free (context);
+
+  ctx.state = STATE_START;
+  context = g_markup_parse_context_new (&markup_parser, 0, &ctx, NULL);
+  if (!g_markup_parse_context_parse (context, buffer, length, error))
+    goto out;
+
+  if (!g_markup_parse_context_end_parse (context, error))
+    goto out;
+
+  parser->parsed_modules = g_list_concat (g_list_copy (ctx.modules),
+					  parser->parsed_modules);
+
+ out:
+  g_markup_parse_context_free (context);
+
+  return parse_context_finish (&ctx, error);
+}
+
+/**
+ * _g_ir_parser_set_validate_markup:
+ * @parser: a #GIrParser
+ * @validate: whether to parse through GMarkup
+ *
+ * By default GIR files are read with a tokenizer that only understands
+ * the subset of XML used by GIR files and does not validate character
+ * data.  Setting @validate makes the parser go through GMarkup instead,
+ * which is slower but checks the whole document, including UTF-8
+ * validity of text the compiler otherwise skips.
+ */
+void
+_g_ir_parser_set_validate_markup (GIrParser *parser,
+				  gboolean   validate)
+{
+  parser->validate_markup = validate;
+}
+
 /**
  * _g_ir_parser_parse_string:
  * @parser: a #GIrParser
@@ -3546,66 +3897,85 @@ _g_ir_parser_parse_string (GIrParser           *parser,
 			   gssize               length,
 			   GError             **error)
 {
-  ParseContext ctx = { 0 };
-  GMarkupParseContext *context;
+  GIrTokenizer *tokenizer;
+  GIrModule *module;
+  gchar *copy;
 
-  ctx.parser = parser;
-  ctx.state = STATE_START;
-  ctx.file_path = filename;
-  ctx.namespace = namespace;
-  ctx.include_modules = NULL;
-  ctx.aliases = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
-  ctx.disguised_structures = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-  ctx.type_depth = 0;
-  ctx.dependencies = NULL;
-  ctx.current_module = NULL;
+  if (parser->validate_markup)
+    return parse_markup (parser, namespace, filename, buffer, length, error);
 
-  context = g_markup_parse_context_new (&firstpass_parser, 0, &ctx, NULL);
+  if (length < 0)
+    length = strlen (buffer);
 
-  if (!g_markup_parse_context_parse (context, buffer, length, error))
-    goto out;
+  /* The tokenizer works in place */
+  copy = g_malloc (length + 1);
+  memcpy (copy, buffer, length);
+  copy[length] = '\0';
 
-  if (!g_markup_parse_context_end_parse (context, error))
-    goto out;
+  tokenizer = _g_ir_tokenizer_new (copy, length);
+  module = parse_tokenized (parser, namespace, filename, tokenizer, NULL, error);
+  _g_ir_tokenizer_free (tokenizer);
+  g_free (copy);
 
-  g_markup_parse_context_free (context);
+  return module;
+}
 
-  ctx.state = STATE_START;
-  context = g_markup_parse_context_new (&markup_parser, 0, &ctx, NULL);
-  if (!g_markup_parse_context_parse (context, buffer, length, error))
-    goto out;
+static GIrModule *
+parse_gir_file (GIrParser    *parser,
+		const gchar  *namespace,
+		const gchar  *filename,
+		gboolean      include_only,
+		GError      **error)
+{
+  GIrModule *module;
+  gchar *buffer;
+  gsize length;
 
-  if (!g_markup_parse_context_end_parse (context, error))
-    goto out;
+  /* The tokenizer works in place. The file is read into a buffer of our
+   * own rather than mapped writable, which would require write access
+   * to it (e.g. for the GIRs installed in the system).
+   */
+  if (!g_file_get_contents (filename, &buffer, &length, error))
+    return NULL;
 
-  parser->parsed_modules = g_list_concat (g_list_copy (ctx.modules),
-					  parser->parsed_modules);
+  if (parser->validate_markup)
+    {
+      module = parse_markup (parser, namespace, filename, buffer, length, error);
+      g_free (buffer);
 
- out:
+      return module;
+    }
 
-  if (ctx.modules == NULL)
+  if (include_only)
     {
-      /* An error occurred before we created a module, so we haven't
-       * transferred ownership of these hash tables to the module.
-       */
-      if (ctx.aliases != NULL)
-	g_hash_table_destroy (ctx.aliases);
-      if (ctx.disguised_structures != NULL)
-	g_hash_table_destroy (ctx.disguised_structures);
-      g_list_free (ctx.include_modules);
-    }
+      /* The tokens are kept for the entries built later on, so the
+       * buffer they point into is owned by the LazyModule */
+      LazyModule *lazy = lazy_module_new (parser, filename, buffer, length);
 
-  g_markup_parse_context_free (context);
+      module = parse_tokenized (parser, namespace, filename,
+				lazy->tokenizer, lazy->entries, error);
+      if (module == NULL)
+	{
+	  lazy_module_free (lazy);
+	  return NULL;
+	}
 
-  if (ctx.modules)
-    return ctx.modules->data;
+      module->materialize_entry = materialize_entry;
+      module->lazy_data = lazy;
+      parser->lazy_modules = g_list_prepend (parser->lazy_modules, lazy);
+    }
+  else
+    {
+      GIrTokenizer *tokenizer;
 
-  if (error && *error == NULL)
-    g_set_error (error,
-                 G_MARKUP_ERROR,
-                 G_MARKUP_ERROR_INVALID_CONTENT,
-                 "Expected namespace element in the gir file");
-  return NULL;
+      tokenizer = _g_ir_tokenizer_new (buffer, length);
+      module = parse_tokenized (parser, namespace, filename,
+				tokenizer, NULL, error);
+      _g_ir_tokenizer_free (tokenizer);
+      g_free (buffer);
+    }
+
+  return module;
 }
 
 /**
@@ -3625,8 +3995,6 @@ _g_ir_parser_parse_file (GIrParser   *parser,
 			 const gchar *filename,
 			 GError     **error)
 {
-  gchar *buffer;
-  gsize length;
   GIrModule *module;
   const char *slash;
   char *dash;
@@ -3655,16 +4023,9 @@ _g_ir_parser_parse_file (GIrParser   *parser,
   if (dash != NULL)
     *dash = '\0';
 
-  if (!g_file_get_contents (filename, &buffer, &length, error))
-    return NULL;
-
-  module = _g_ir_parser_parse_string (parser, namespace, filename, buffer, length, error);
+  module = parse_gir_file (parser, namespace, filename, FALSE, error);
 
   g_free (namespace);
 
-  g_free (buffer);
-
   return module;
 }
-
-
@@ -34,6 +34,8 @@ GIrParser *_g_ir_parser_new          (void);
 void       _g_ir_parser_free         (GIrParser          *parser);
 void       _g_ir_parser_set_includes (GIrParser          *parser,
 				      const gchar *const *includes);
+void       _g_ir_parser_set_validate_markup (GIrParser *parser,
+					     gboolean   validate);
 
 GIrModule *_g_ir_parser_parse_string (GIrParser    *parser,
 				      const gchar  *namespace,
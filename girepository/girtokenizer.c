@@ -0,0 +1,512 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ * GObject introspection: A zero-copy tokenizer for the XML GIR format
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include "girtokenizer.h"
+
+/* The GIR format only uses a small subset of XML: elements, attributes,
+ * comments, the XML declaration and character data which the compiler
+ * ignores.  This tokenizer handles exactly that subset; anything more
+ * exotic should go through GMarkup (see _g_ir_parser_set_validate_markup).
+ */
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+static inline gboolean
+is_name_char (gchar c)
+{
+  return !(IS_SPACE (c) || c == '>' || c == '/' || c == '=' ||
+           c == '<' || c == '"' || c == '\'' || c == '\0');
+}
+
+GIrTokenizer *
+_g_ir_tokenizer_new (gchar *buffer,
+                     gsize  length)
+{
+  GIrTokenizer *tokenizer;
+  guint guess;
+
+  tokenizer = g_slice_new0 (GIrTokenizer);
+  tokenizer->buffer = buffer;
+  tokenizer->length = length;
+
+  /* GIR files have well over 32 bytes per tag on average, so this
+   * avoids most reallocations without overcommitting too much.
+   */
+  guess = MIN (length / 32, G_MAXUINT / 2) + 1;
+  tokenizer->tokens = g_array_sized_new (FALSE, FALSE, sizeof (GIrToken), guess);
+  tokenizer->attribute_names = g_ptr_array_sized_new (guess);
+  tokenizer->attribute_values = g_ptr_array_sized_new (guess);
+
+  return tokenizer;
+}
+
+void
+_g_ir_tokenizer_free (GIrTokenizer *tokenizer)
+{
+  g_array_free (tokenizer->tokens, TRUE);
+  g_ptr_array_free (tokenizer->attribute_names, TRUE);
+  g_ptr_array_free (tokenizer->attribute_values, TRUE);
+
+  g_slice_free (GIrTokenizer, tokenizer);
+}
+
+/**
+ * _g_ir_tokenizer_get_position:
+ * @tokenizer: a #GIrTokenizer
+ * @token: (allow-none): a token of @tokenizer, or %NULL for the end
+ *   of the buffer
+ * @line_number: (out): return location for the line number
+ * @char_number: (out): return location for the character number
+ *
+ * Computes the position of @token the same way
+ * g_markup_parse_context_get_position() does.  Positions are only ever
+ * needed for diagnostics, so they are recomputed from the start of the
+ * buffer instead of being tracked while tokenizing.
+ */
+void
+_g_ir_tokenizer_get_position (GIrTokenizer   *tokenizer,
+                              const GIrToken *token,
+                              gint           *line_number,
+                              gint           *char_number)
+{
+  const gchar *p, *end;
+  gint line = 1;
+  gint ch = 1;
+
+  end = tokenizer->buffer + (token ? token->offset : tokenizer->length);
+  for (p = tokenizer->buffer; p < end; p++)
+    {
+      if (*p == '\n')
+        {
+          line++;
+          ch = 1;
+        }
+      else if ((((guchar) *p) & 0xc0) != 0x80)
+        ch++;
+    }
+
+  if (line_number)
+    *line_number = line;
+  if (char_number)
+    *char_number = ch;
+}
+
+static void set_error (GIrTokenizer *tokenizer,
+                       const gchar  *position,
+                       GError      **error,
+                       GMarkupError  code,
+                       const gchar  *format,
+                       ...) G_GNUC_PRINTF (5, 6);
+
+static void
+set_error (GIrTokenizer *tokenizer,
+           const gchar  *position,
+           GError      **error,
+           GMarkupError  code,
+           const gchar  *format,
+           ...)
+{
+  GIrToken token = { 0, };
+  gint line_number, char_number;
+  gchar *message;
+  va_list args;
+
+  token.offset = position - tokenizer->buffer;
+  _g_ir_tokenizer_get_position (tokenizer, &token, &line_number, &char_number);
+
+  va_start (args, format);
+  message = g_strdup_vprintf (format, args);
+  va_end (args);
+
+  g_set_error (error, G_MARKUP_ERROR, code,
+               "Error on line %d char %d: %s",
+               line_number, char_number, message);
+  g_free (message);
+}
+
+static void
+add_token (GIrTokenizer *tokenizer,
+           GIrTokenType  type,
+           const gchar  *tag,
+           const gchar  *tag_end,
+           const gchar  *name,
+           guint         attributes)
+{
+  GIrToken token;
+
+  token.type = type;
+  token.offset = tag - tokenizer->buffer;
+  token.end_offset = tag_end - tokenizer->buffer;
+  token.name = name;
+  token.attributes = attributes;
+
+  g_array_append_val (tokenizer->tokens, token);
+}
+
+/* Decoding never makes the text longer, so this can be done in place.
+ * Like GMarkup, and as XML requires, literal tabs and line breaks in
+ * attribute values are read as spaces; a \r\n pair as a single one.
+ */
+static gboolean
+unescape_in_place (GIrTokenizer *tokenizer,
+                   gchar        *text,
+                   GError      **error)
+{
+  gchar *r = text;
+  gchar *w = text;
+
+  while (*r)
+    {
+      const gchar *entity;
+      gchar *semicolon;
+      gsize len;
+
+      if (*r == '\r' || *r == '\n' || *r == '\t')
+        {
+          if (r[0] == '\r' && r[1] == '\n')
+            r++;
+          *w++ = ' ';
+          r++;
+          continue;
+        }
+
+      if (*r != '&')
+        {
+          *w++ = *r++;
+          continue;
+        }
+
+      entity = r + 1;
+      semicolon = strchr (entity, ';');
+      if (semicolon == NULL)
+        {
+          set_error (tokenizer, r, error, G_MARKUP_ERROR_PARSE,
+                     "Entity did not end with a semicolon");
+          return FALSE;
+        }
+      len = semicolon - entity;
+
+      if (len == 3 && strncmp (entity, "amp", 3) == 0)
+        *w++ = '&';
+      else if (len == 2 && strncmp (entity, "lt", 2) == 0)
+        *w++ = '<';
+      else if (len == 2 && strncmp (entity, "gt", 2) == 0)
+        *w++ = '>';
+      else if (len == 4 && strncmp (entity, "quot", 4) == 0)
+        *w++ = '"';
+      else if (len == 4 && strncmp (entity, "apos", 4) == 0)
+        *w++ = '\'';
+      else if (len > 1 && entity[0] == '#')
+        {
+          gchar *digits_end = NULL;
+          gulong c = 0;
+
+          if (entity[1] == 'x' && g_ascii_isxdigit (entity[2]))
+            c = strtoul (entity + 2, &digits_end, 16);
+          else if (g_ascii_isdigit (entity[1]))
+            c = strtoul (entity + 1, &digits_end, 10);
+
+          if (digits_end != semicolon || c == 0 || !g_unichar_validate (c))
+            {
+              set_error (tokenizer, r, error, G_MARKUP_ERROR_PARSE,
+                         "Character reference '%.*s' does not encode a permitted character",
+                         (int) len, entity);
+              return FALSE;
+            }
+          w += g_unichar_to_utf8 (c, w);
+        }
+      else
+        {
+          set_error (tokenizer, r, error, G_MARKUP_ERROR_PARSE,
+                     "Entity name '%.*s' is not known", (int) len, entity);
+          return FALSE;
+        }
+
+      r = semicolon + 1;
+    }
+
+  *w = '\0';
+  return TRUE;
+}
+
+static gchar *
+skip_past (gchar       *p,
+           const gchar *end,
+           const gchar *terminator)
+{
+  gsize len = strlen (terminator);
+
+  while (p + len <= end)
+    {
+      p = memchr (p, terminator[0], end - p);
+      if (p == NULL || p + len > end)
+        return NULL;
+      if (memcmp (p, terminator, len) == 0)
+        return p + len;
+      p++;
+    }
+
+  return NULL;
+}
+
+static gboolean
+has_prefix (const gchar *p,
+            const gchar *end,
+            const gchar *prefix)
+{
+  gsize len = strlen (prefix);
+
+  return p + len <= end && memcmp (p, prefix, len) == 0;
+}
+
+/**
+ * _g_ir_tokenizer_tokenize:
+ * @tokenizer: a #GIrTokenizer
+ * @error: return location for a #GError, or %NULL
+ *
+ * Splits the buffer into a flat array of start and end element tokens,
+ * checking that the document is well-formed as far as the GIR parser
+ * cares.  The resulting token array can be replayed any number of
+ * times, which lets the parser run both of its passes over a single
+ * tokenization.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+_g_ir_tokenizer_tokenize (GIrTokenizer *tokenizer,
+                          GError      **error)
+{
+  gchar *p = tokenizer->buffer;
+  const gchar *end = tokenizer->buffer + tokenizer->length;
+  GPtrArray *stack;
+  gboolean seen_root = FALSE;
+  gboolean ret = FALSE;
+
+  if (p == NULL || tokenizer->length == 0)
+    {
+      g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_EMPTY,
+                   "Document was empty or contained only whitespace");
+      return FALSE;
+    }
+
+  stack = g_ptr_array_new ();
+
+  while ((p = memchr (p, '<', end - p)) != NULL)
+    {
+      gchar *tag = p++;
+      gchar *name, *name_end, *after;
+      guint attributes;
+
+      if (p == end)
+        {
+          set_error (tokenizer, tag, error, G_MARKUP_ERROR_PARSE,
+                     "Document ended unexpectedly just after an open angle bracket '<'");
+          goto out;
+        }
+
+      if (*p == '?' || *p == '!')
+        {
+          if (*p == '?')
+            p = skip_past (p, end, "?>");
+          else if (has_prefix (p, end, "!--"))
+            p = skip_past (p + 3, end, "-->");
+          else if (has_prefix (p, end, "![CDATA["))
+            p = skip_past (p, end, "]]>");
+          else
+            p = skip_past (p, end, ">");
+
+          if (p == NULL)
+            {
+              set_error (tokenizer, tag, error, G_MARKUP_ERROR_PARSE,
+                         "Document ended unexpectedly inside a comment or processing instruction");
+              goto out;
+            }
+          continue;
+        }
+
+      if (*p == '/')
+        {
+          name = ++p;
+          while (p < end && is_name_char (*p))
+            p++;
+          name_end = p;
+          while (p < end && IS_SPACE (*p))
+            p++;
+
+          if (name == name_end || p == end || *p != '>')
+            {
+              set_error (tokenizer, tag, error, G_MARKUP_ERROR_PARSE,
+                         "Malformed close tag");
+              goto out;
+            }
+          *name_end = '\0';
+
+          if (stack->len == 0 ||
+              strcmp (name, g_ptr_array_index (stack, stack->len - 1)) != 0)
+            {
+              set_error (tokenizer, tag, error, G_MARKUP_ERROR_PARSE,
+                         "Element '%s' was closed, but the currently open element is '%s'",
+                         name,
+                         stack->len ? (const gchar *) g_ptr_array_index (stack, stack->len - 1) : "(none)");
+              goto out;
+            }
+
+          g_ptr_array_set_size (stack, stack->len - 1);
+          p++;
+          add_token (tokenizer, G_IR_TOKEN_END_ELEMENT, tag, p, name, 0);
+          continue;
+        }
+
+      name = p;
+      while (p < end && is_name_char (*p))
+        p++;
+      name_end = p;
+
+      if (name == name_end)
+        {
+          set_error (tokenizer, tag, error, G_MARKUP_ERROR_PARSE,
+                     "'%c' is not a valid character following a '<' character",
+                     *name);
+          goto out;
+        }
+      if (stack->len == 0 && seen_root)
+        {
+          set_error (tokenizer, tag, error, G_MARKUP_ERROR_PARSE,
+                     "Document must contain a single root element");
+          goto out;
+        }
+      seen_root = TRUE;
+
+      attributes = tokenizer->attribute_names->len;
+      after = name_end;
+
+      while (p < end && IS_SPACE (*p))
+        p++;
+
+      while (p < end && *p != '>' && *p != '/')
+        {
+          gchar *attribute, *attribute_end, *value, *quote;
+          gchar q;
+
+          attribute = p;
+          while (p < end && is_name_char (*p))
+            p++;
+          attribute_end = p;
+          while (p < end && IS_SPACE (*p))
+            p++;
+
+          if (attribute == after || attribute == attribute_end ||
+              p == end || *p != '=')
+            {
+              set_error (tokenizer, attribute, error, G_MARKUP_ERROR_PARSE,
+                         "Malformed attribute in element '%.*s'",
+                         (int) (name_end - name), name);
+              goto out;
+            }
+
+          p++;
+          while (p < end && IS_SPACE (*p))
+            p++;
+          if (p == end || (*p != '"' && *p != '\''))
+            {
+              set_error (tokenizer, attribute, error, G_MARKUP_ERROR_PARSE,
+                         "Value of attribute '%.*s' must be quoted",
+                         (int) (attribute_end - attribute), attribute);
+              goto out;
+            }
+
+          q = *p++;
+          value = p;
+          quote = memchr (value, q, end - value);
+          if (quote == NULL)
+            {
+              set_error (tokenizer, attribute, error, G_MARKUP_ERROR_PARSE,
+                         "Document ended unexpectedly inside an attribute value");
+              goto out;
+            }
+
+          *attribute_end = '\0';
+          *quote = '\0';
+          if (strpbrk (value, "&\r\n\t") != NULL &&
+              !unescape_in_place (tokenizer, value, error))
+            goto out;
+
+          g_ptr_array_add (tokenizer->attribute_names, attribute);
+          g_ptr_array_add (tokenizer->attribute_values, value);
+
+          p = after = quote + 1;
+          while (p < end && IS_SPACE (*p))
+            p++;
+        }
+
+      if (p == end || (*p == '/' && (p + 1 == end || p[1] != '>')))
+        {
+          set_error (tokenizer, tag, error, G_MARKUP_ERROR_PARSE,
+                     "Document ended unexpectedly inside element '%.*s'",
+                     (int) (name_end - name), name);
+          goto out;
+        }
+
+      g_ptr_array_add (tokenizer->attribute_names, NULL);
+      g_ptr_array_add (tokenizer->attribute_values, NULL);
+
+      if (*p == '/')
+        {
+          *name_end = '\0';
+          p += 2;
+          add_token (tokenizer, G_IR_TOKEN_START_ELEMENT, tag, p, name, attributes);
+          add_token (tokenizer, G_IR_TOKEN_END_ELEMENT, tag, p, name, 0);
+        }
+      else
+        {
+          *name_end = '\0';
+          g_ptr_array_add (stack, name);
+          p++;
+          add_token (tokenizer, G_IR_TOKEN_START_ELEMENT, tag, p, name, attributes);
+        }
+    }
+
+  if (stack->len > 0)
+    {
+      set_error (tokenizer, end, error, G_MARKUP_ERROR_PARSE,
+                 "Document ended unexpectedly with element '%s' left open",
+                 (const gchar *) g_ptr_array_index (stack, stack->len - 1));
+      goto out;
+    }
+
+  if (!seen_root)
+    {
+      g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_EMPTY,
+                   "Document was empty or contained only whitespace");
+      goto out;
+    }
+
+  ret = TRUE;
+
+ out:
+  g_ptr_array_free (stack, TRUE);
+
+  return ret;
+}
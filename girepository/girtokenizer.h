@@ -0,0 +1,82 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ * GObject introspection: A zero-copy tokenizer for the XML GIR format
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __G_IR_TOKENIZER_H__
+#define __G_IR_TOKENIZER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GIrToken GIrToken;
+typedef struct _GIrTokenizer GIrTokenizer;
+
+typedef enum
+{
+  G_IR_TOKEN_START_ELEMENT,
+  G_IR_TOKEN_END_ELEMENT
+} GIrTokenType;
+
+struct _GIrToken
+{
+  GIrTokenType type;
+  gsize offset;            /* Offset of the '<' in the buffer */
+  gsize end_offset;        /* Offset just past the '>' */
+  const gchar *name;       /* Points into the buffer */
+  guint attributes;        /* Index into attribute_names/attribute_values */
+};
+
+/* The tokenizer works in place: element names, attribute names and
+ * attribute values are NUL-terminated (and entity-decoded) inside the
+ * buffer it is given, so the buffer must be writable and must outlive
+ * the tokenizer.  Character data is skipped without being copied; it
+ * is left untouched between the end_offset of a token and the offset
+ * of the next one, for the callers which need it.
+ */
+struct _GIrTokenizer
+{
+  gchar *buffer;
+  gsize length;
+
+  GArray *tokens;
+  /* NULL-terminated runs, one per start element */
+  GPtrArray *attribute_names;
+  GPtrArray *attribute_values;
+};
+
+GIrTokenizer  *_g_ir_tokenizer_new      (gchar               *buffer,
+                                         gsize                length);
+void           _g_ir_tokenizer_free     (GIrTokenizer        *tokenizer);
+
+gboolean       _g_ir_tokenizer_tokenize (GIrTokenizer        *tokenizer,
+                                         GError             **error);
+
+void           _g_ir_tokenizer_get_position (GIrTokenizer   *tokenizer,
+                                             const GIrToken *token,
+                                             gint           *line_number,
+                                             gint           *char_number);
+
+#define _g_ir_tokenizer_get_attribute_names(tokenizer, token) \
+  ((const gchar **) &g_ptr_array_index ((tokenizer)->attribute_names, (token)->attributes))
+#define _g_ir_tokenizer_get_attribute_values(tokenizer, token) \
+  ((const gchar **) &g_ptr_array_index ((tokenizer)->attribute_values, (token)->attributes))
+
+G_END_DECLS
+
+#endif  /* __G_IR_TOKENIZER_H__ */
@@ -287,14 +287,22 @@ typedef struct {
 
 /**
  * SectionType:
- * @GI_SECTION_END: TODO
- * @GI_SECTION_DIRECTORY_INDEX: TODO
+ * @GI_SECTION_END: Terminates the section table
+ * @GI_SECTION_DIRECTORY_INDEX: Perfect hash of the names of the local
+ *   directory entries, see gthash.c
+ * @GI_SECTION_N_TYPES: Number of section types known to this version
+ *   of the library; not a valid section id
  *
- * TODO
+ * Identifies the contents of a #Section.  The id also acts as the
+ * version of the section's layout: a section is never changed
+ * incompatibly, a new id is allocated instead.  New ids must be added
+ * before @GI_SECTION_N_TYPES, which also sizes the section table
+ * written by the compiler and the section cache of #GITypelib.
  */
 typedef enum {
   GI_SECTION_END = 0,
-  GI_SECTION_DIRECTORY_INDEX = 1
+  GI_SECTION_DIRECTORY_INDEX = 1,
+  GI_SECTION_N_TYPES
 } SectionType;
 
 /**
@@ -306,6 +314,12 @@ typedef enum {
  * and may or may not be present in the typelib.  Presently, just used
  * for the directory index.  This allows a form of dynamic extensibility
  * with different tradeoffs from the format minor version.
+ *
+ * The section table is an array of sections terminated by one with
+ * id %GI_SECTION_END.  Readers ignore sections with ids they do not
+ * know, so new sections can be added without breaking older readers.
+ * The table is resolved once when the typelib is loaded, see
+ * g_typelib_get_section().
  */
 typedef struct {
   guint32 id;
@@ -1200,6 +1214,8 @@ struct _GITypelib {
   GMappedFile *mfile;
   GList *modules;
   gboolean open_attempted;
+  /* Indexed by SectionType, NULL if the section is absent */
+  Section *sections[GI_SECTION_N_TYPES];
 };
 
 DirEntry *g_typelib_get_dir_entry (GITypelib *typelib,
@@ -1232,6 +1248,17 @@ void      g_typelib_check_sanity (void);
  */
 #define   g_typelib_get_string(typelib,offset) ((const gchar*)&(typelib->data)[(offset)])
 
+/**
+ * g_typelib_get_section:
+ * @typelib: a #GITypelib
+ * @section_type: a #SectionType other than %GI_SECTION_END
+ *
+ * Looks up a section in the table resolved when @typelib was loaded.
+ *
+ * Returns: the #Section, or %NULL if @typelib does not have one
+ */
+#define   g_typelib_get_section(typelib,section_type) ((typelib)->sections[(section_type)])
+
 
 /**
  * GITypelibError:
@@ -1278,10 +1305,37 @@ AttributeBlob *_attribute_blob_find_first (GIBaseInfo *info,
  */
 typedef struct _GITypelibHashBuilder GITypelibHashBuilder;
 
+/**
+ * GITypelibHashAlgorithm:
+ * @GI_TYPELIB_HASH_AUTO: Try several algorithms and parameters, and
+ * use the one with the cheapest lookups among those producing an
+ * index close to the smallest one
+ * @GI_TYPELIB_HASH_BDZ: CMPH's BDZ algorithm
+ * @GI_TYPELIB_HASH_CHD: CMPH's CHD algorithm
+ * @GI_TYPELIB_HASH_BMZ: CMPH's BMZ algorithm
+ * @GI_TYPELIB_HASH_CHM: CMPH's CHM algorithm
+ *
+ * The perfect hash algorithm used for the directory index.  The
+ * choice is recorded in the index itself, so lookups work the same
+ * whatever algorithm the typelib was built with.
+ */
+typedef enum
+{
+  GI_TYPELIB_HASH_AUTO,
+  GI_TYPELIB_HASH_BDZ,
+  GI_TYPELIB_HASH_CHD,
+  GI_TYPELIB_HASH_BMZ,
+  GI_TYPELIB_HASH_CHM
+} GITypelibHashAlgorithm;
+
 GITypelibHashBuilder * _gi_typelib_hash_builder_new (void);
 
 void _gi_typelib_hash_builder_add_string (GITypelibHashBuilder *builder, const char *str, guint16 value);
 
+void _gi_typelib_hash_builder_set_algorithm (GITypelibHashBuilder *builder, GITypelibHashAlgorithm algorithm);
+
+GITypelibHashAlgorithm _gi_typelib_hash_builder_get_algorithm (GITypelibHashBuilder *builder);
+
 gboolean _gi_typelib_hash_builder_prepare (GITypelibHashBuilder *builder);
 
 guint32 _gi_typelib_hash_builder_get_buffer_size (GITypelibHashBuilder *builder);
@@ -149,26 +149,6 @@ g_typelib_get_dir_entry (GITypelib *typelib,
   return (DirEntry *)&typelib->data[header->directory + (index - 1) * header->entry_blob_size];
 }
 
-static Section *
-get_section_by_id (GITypelib   *typelib,
-		   SectionType  section_type)
-{
-  Header *header = (Header *)typelib->data;
-  Section *section;
-
-  if (header->sections == 0)
-    return NULL;
-
-  for (section = (Section*)&typelib->data[header->sections];
-       section->id != GI_SECTION_END;
-       section++)
-    {
-      if (section->id == section_type)
-	return section;
-    }
-  return NULL;
-}
-
 /**
  * g_typelib_get_dir_entry_by_name:
  * @typelib: TODO
@@ -187,7 +167,7 @@ g_typelib_get_dir_entry_by_name (GITypelib *typelib,
   const char *entry_name;
   DirEntry *entry;
 
-  dirindex = get_section_by_id (typelib, GI_SECTION_DIRECTORY_INDEX);
+  dirindex = g_typelib_get_section (typelib, GI_SECTION_DIRECTORY_INDEX);
   n_entries = ((Header *)typelib->data)->n_local_entries;
 
   if (dirindex == NULL)
@@ -2335,6 +2315,80 @@ _g_typelib_ensure_open (GITypelib *typelib)
   _g_typelib_do_dlopen (typelib);
 }
 
+/* Fills in the section cache of @typelib, so that lookups don't need
+ * to scan the section table.  Sections with unknown ids are skipped;
+ * if an id appears more than once, the first section wins.
+ */
+static gboolean
+resolve_sections (GITypelib  *typelib,
+                  GError    **error)
+{
+  Header *header = (Header *)typelib->data;
+  guint32 offset;
+
+  if (header->sections == 0)
+    return TRUE;
+
+  for (offset = header->sections; ; offset += sizeof (Section))
+    {
+      Section *section;
+
+      if (offset > typelib->len || typelib->len - offset < sizeof (Section))
+        {
+          g_set_error (error,
+                       G_TYPELIB_ERROR,
+                       G_TYPELIB_ERROR_INVALID_HEADER,
+                       "Unterminated section table");
+          return FALSE;
+        }
+
+      section = (Section *)&typelib->data[offset];
+      if (section->id == GI_SECTION_END)
+        return TRUE;
+
+      if (section->offset >= typelib->len)
+        {
+          g_set_error (error,
+                       G_TYPELIB_ERROR,
+                       G_TYPELIB_ERROR_INVALID_HEADER,
+                       "Section %u extends beyond the typelib", section->id);
+          return FALSE;
+        }
+
+      if (section->id < GI_SECTION_N_TYPES &&
+          typelib->sections[section->id] == NULL)
+        typelib->sections[section->id] = section;
+    }
+}
+
+static GITypelib *
+typelib_new (guint8       *data,
+             gsize         len,
+             gboolean      owns_memory,
+             GMappedFile  *mfile,
+             GError      **error)
+{
+  GITypelib *meta;
+
+  if (!validate_header_basic (data, len, error))
+    return NULL;
+
+  meta = g_slice_new0 (GITypelib);
+  meta->data = data;
+  meta->len = len;
+  meta->owns_memory = owns_memory;
+  meta->mfile = mfile;
+  meta->modules = NULL;
+
+  if (!resolve_sections (meta, error))
+    {
+      g_slice_free (GITypelib, meta);
+      return NULL;
+    }
+
+  return meta;
+}
+
 /**
  * g_typelib_new_from_memory: (skip)
  * @memory: address of memory chunk containing the typelib
@@ -2352,18 +2406,7 @@ g_typelib_new_from_memory (guint8  *memory,
 			   gsize    len,
 			   GError **error)
 {
-  GITypelib *meta;
-
-  if (!validate_header_basic (memory, len, error))
-    return NULL;
-
-  meta = g_slice_new0 (GITypelib);
-  meta->data = memory;
-  meta->len = len;
-  meta->owns_memory = TRUE;
-  meta->modules = NULL;
-
-  return meta;
+  return typelib_new (memory, len, TRUE, NULL, error);
 }
 
 /**
@@ -2381,18 +2424,7 @@ g_typelib_new_from_const_memory (const guchar *memory,
 				 gsize         len,
 				 GError      **error)
 {
-  GITypelib *meta;
-
-  if (!validate_header_basic (memory, len, error))
-    return NULL;
-
-  meta = g_slice_new0 (GITypelib);
-  meta->data = (guchar *) memory;
-  meta->len = len;
-  meta->owns_memory = FALSE;
-  meta->modules = NULL;
-
-  return meta;
+  return typelib_new ((guchar *) memory, len, FALSE, NULL, error);
 }
 
 /**
@@ -2408,20 +2440,10 @@ GITypelib *
 g_typelib_new_from_mapped_file (GMappedFile  *mfile,
 				GError      **error)
 {
-  GITypelib *meta;
   guint8 *data = (guint8 *) g_mapped_file_get_contents (mfile);
   gsize len = g_mapped_file_get_length (mfile);
 
-  if (!validate_header_basic (data, len, error))
-    return NULL;
-
-  meta = g_slice_new0 (GITypelib);
-  meta->mfile = mfile;
-  meta->owns_memory = FALSE;
-  meta->data = data; 
-  meta->len = len;
-
-  return meta;
+  return typelib_new (data, len, FALSE, mfile, error);
 }
 
 /**
@@ -22,14 +22,27 @@
 #include <glib-object.h>
 #include "gitypelib-internal.h"
 
+static const struct {
+  GITypelibHashAlgorithm algorithm;
+  const char *name;
+} algorithms[] = {
+  { GI_TYPELIB_HASH_AUTO, "auto" },
+  { GI_TYPELIB_HASH_BDZ, "bdz" },
+  { GI_TYPELIB_HASH_CHD, "chd" },
+  { GI_TYPELIB_HASH_BMZ, "bmz" },
+  { GI_TYPELIB_HASH_CHM, "chm" }
+};
+
 static void
-test_build_retrieve (void)
+test_build_retrieve (gconstpointer data)
 {
+  GITypelibHashAlgorithm algorithm = GPOINTER_TO_UINT (data);
   GITypelibHashBuilder *builder;
   guint32 bufsize;
   guint8* buf;
 
   builder = _gi_typelib_hash_builder_new ();
+  _gi_typelib_hash_builder_set_algorithm (builder, algorithm);
 
   _gi_typelib_hash_builder_add_string (builder, "Action", 0);
   _gi_typelib_hash_builder_add_string (builder, "ZLibDecompressor", 42);
@@ -39,6 +52,11 @@ test_build_retrieve (void)
   if (!_gi_typelib_hash_builder_prepare (builder))
     g_assert_not_reached ();
 
+  if (algorithm == GI_TYPELIB_HASH_AUTO)
+    g_assert (_gi_typelib_hash_builder_get_algorithm (builder) != GI_TYPELIB_HASH_AUTO);
+  else
+    g_assert (_gi_typelib_hash_builder_get_algorithm (builder) == algorithm);
+
   bufsize = _gi_typelib_hash_builder_get_buffer_size (builder);
 
   buf = g_malloc (bufsize);
@@ -51,15 +69,93 @@ test_build_retrieve (void)
   g_assert (_gi_typelib_hash_search (buf, "ZLibDecompressor", 4) == 42);
   g_assert (_gi_typelib_hash_search (buf, "VolumeMonitor", 4) == 9);
   g_assert (_gi_typelib_hash_search (buf, "FileMonitorFlags", 4) == 31);
+
+  g_free (buf);
+}
+
+#define N_PERF_STRINGS 5000
+#define N_PERF_LOOKUPS 200
+
+/* Compares index size and lookup latency of the algorithms, run with
+ * "gthash-test -m perf".
+ */
+static void
+test_performance (void)
+{
+  gchar *strings[N_PERF_STRINGS];
+  guint i, j, k;
+
+  /* Names shaped like those of a large namespace */
+  for (i = 0; i < N_PERF_STRINGS; i++)
+    strings[i] = g_strdup_printf ("%sMonitor%u%s",
+                                  i % 3 ? "Volume" : "FileAttribute", i,
+                                  i % 2 ? "Flags" : "");
+
+  for (k = 0; k < G_N_ELEMENTS (algorithms); k++)
+    {
+      GITypelibHashBuilder *builder;
+      guint32 bufsize;
+      guint8 *buf;
+      gdouble elapsed;
+
+      builder = _gi_typelib_hash_builder_new ();
+      _gi_typelib_hash_builder_set_algorithm (builder, algorithms[k].algorithm);
+      for (i = 0; i < N_PERF_STRINGS; i++)
+        _gi_typelib_hash_builder_add_string (builder, strings[i], i);
+
+      g_test_timer_start ();
+      if (!_gi_typelib_hash_builder_prepare (builder))
+        {
+          g_test_message ("%s: no perfect hash found", algorithms[k].name);
+          _gi_typelib_hash_builder_destroy (builder);
+          continue;
+        }
+      elapsed = g_test_timer_elapsed ();
+
+      bufsize = _gi_typelib_hash_builder_get_buffer_size (builder);
+      buf = g_malloc (bufsize);
+      _gi_typelib_hash_builder_pack (builder, buf, bufsize);
+      _gi_typelib_hash_builder_destroy (builder);
+
+      g_test_message ("%s: built in %.2f ms, %.2f bits per entry",
+                      algorithms[k].name, elapsed * 1000,
+                      bufsize * 8.0 / N_PERF_STRINGS);
+
+      g_test_timer_start ();
+      for (j = 0; j < N_PERF_LOOKUPS; j++)
+        for (i = 0; i < N_PERF_STRINGS; i++)
+          g_assert (_gi_typelib_hash_search (buf, strings[i], N_PERF_STRINGS) == i);
+      elapsed = g_test_timer_elapsed ();
+
+      g_test_minimized_result (elapsed * 1e9 / (N_PERF_LOOKUPS * N_PERF_STRINGS),
+                               "%s: %.1f ns per lookup", algorithms[k].name,
+                               elapsed * 1e9 / (N_PERF_LOOKUPS * N_PERF_STRINGS));
+
+      g_free (buf);
+    }
+
+  for (i = 0; i < N_PERF_STRINGS; i++)
+    g_free (strings[i]);
 }
 
 int
 main(int argc, char **argv)
 {
+  guint i;
+
   g_test_init (&argc, &argv, NULL);
 
-  g_test_add_func ("/gthash/build-retrieve", test_build_retrieve);
+  for (i = 0; i < G_N_ELEMENTS (algorithms); i++)
+    {
+      gchar *path = g_strdup_printf ("/gthash/build-retrieve/%s",
+                                     algorithms[i].name);
+      g_test_add_data_func (path, GUINT_TO_POINTER (algorithms[i].algorithm),
+                            test_build_retrieve);
+      g_free (path);
+    }
+
+  if (g_test_perf ())
+    g_test_add_func ("/gthash/performance", test_performance);
 
   return g_test_run ();
 }
-
@@ -37,24 +37,56 @@
  * I chose CMPH (http://cmph.sourceforge.net/) as it seemed high
  * quality, well documented, and easy to embed.
  *
- * CMPH provides a number of algorithms; I chose BDZ, because while CHD
- * appears to be the "best", the simplicitly of BDZ appealed, and really,
- * we're only talking about thousands of strings here, not millions, so
- * a few microseconds is no big deal.
+ * CMPH provides a number of algorithms.  By default we build the
+ * candidates listed in auto_candidates below and keep the one with
+ * the cheapest lookups among those whose index (including the
+ * lookaside table) is within AUTO_SIZE_SLACK_PERCENT of the smallest
+ * one; in practice that is BDZ with a slightly larger rank table than
+ * CMPH's default.  Run
+ * "gthash-test -m perf" to compare lookup latency and index size of
+ * the algorithms.  The choice is deterministic so that the same GIR
+ * always compiles to the same typelib.
  *
  * In memory, the format is:
  * INT32 mph_size
- * MPH (mph_size bytes)
+ * MPH (mph_size bytes, starting with the CMPH algorithm identifier)
  * (padding for alignment to uint32 if necessary)
  * INDEX (array of guint16)
  *
- * Because BDZ is not order preserving, we need a lookaside table which
- * maps the hash value into the directory index.
+ * Because none of the algorithms is order preserving, we need a
+ * lookaside table which maps the hash value into the directory index.
+ * The algorithms used are all minimal, so the table has exactly one
+ * slot per string.
  */
 
+typedef struct {
+  GITypelibHashAlgorithm algorithm;
+  CMPH_ALGO cmph_algo;
+  guint b;                      /* 0 for CMPH's default */
+} HashParameters;
+
+/* Indexed by GITypelibHashAlgorithm */
+static const HashParameters explicit_parameters[] = {
+  { GI_TYPELIB_HASH_AUTO, CMPH_BDZ, 0 },
+  { GI_TYPELIB_HASH_BDZ, CMPH_BDZ, 0 },
+  { GI_TYPELIB_HASH_CHD, CMPH_CHD, 0 },
+  { GI_TYPELIB_HASH_BMZ, CMPH_BMZ, 0 },
+  { GI_TYPELIB_HASH_CHM, CMPH_CHM, 0 }
+};
+
+/* From cheapest to most expensive lookups */
+static const HashParameters auto_candidates[] = {
+  { GI_TYPELIB_HASH_BDZ, CMPH_BDZ, 5 },
+  { GI_TYPELIB_HASH_BDZ, CMPH_BDZ, 7 },
+  { GI_TYPELIB_HASH_CHD, CMPH_CHD, 0 }
+};
+
+#define AUTO_SIZE_SLACK_PERCENT 10
+
 struct _GITypelibHashBuilder {
   gboolean prepared;
   gboolean buildable;
+  GITypelibHashAlgorithm algorithm;
   cmph_t *c;
   GHashTable *strings;
   guint32 dirmap_offset;
@@ -79,14 +111,75 @@ _gi_typelib_hash_builder_add_string (GITypelibHashBuilder *builder,
   g_hash_table_insert (builder->strings, g_strdup (str), GUINT_TO_POINTER ((guint) value));
 }
 
+/*
+ * _gi_typelib_hash_builder_set_algorithm:
+ * @builder: a #GITypelibHashBuilder
+ * @algorithm: the perfect hash algorithm to use
+ *
+ * Selects the algorithm used by _gi_typelib_hash_builder_prepare().
+ * The default is %GI_TYPELIB_HASH_AUTO.
+ */
+void
+_gi_typelib_hash_builder_set_algorithm (GITypelibHashBuilder   *builder,
+                                        GITypelibHashAlgorithm  algorithm)
+{
+  g_return_if_fail (!builder->prepared);
+  g_return_if_fail (algorithm < G_N_ELEMENTS (explicit_parameters));
+
+  builder->algorithm = algorithm;
+}
+
+/*
+ * _gi_typelib_hash_builder_get_algorithm:
+ * @builder: a #GITypelibHashBuilder
+ *
+ * Returns: the algorithm in use; once the builder has been prepared
+ * successfully this is never %GI_TYPELIB_HASH_AUTO.
+ */
+GITypelibHashAlgorithm
+_gi_typelib_hash_builder_get_algorithm (GITypelibHashBuilder *builder)
+{
+  return builder->algorithm;
+}
+
+static cmph_t *
+build_mph (char                 **strs,
+           guint32                num_elts,
+           const HashParameters  *params)
+{
+  cmph_io_adapter_t *io;
+  cmph_config_t *config;
+  cmph_t *c;
+
+  io = cmph_io_vector_adapter (strs, num_elts);
+  config = cmph_config_new (io);
+  cmph_config_set_algo (config, params->cmph_algo);
+  if (params->b != 0)
+    cmph_config_set_b (config, params->b);
+
+  c = cmph_new (config);
+
+  cmph_config_destroy (config);
+  cmph_io_vector_adapter_destroy (io);
+
+  return c;
+}
+
+static guint32
+index_size (cmph_t  *c,
+            guint32  num_elts)
+{
+  guint32 offset = sizeof(guint32) + cmph_packed_size (c);
+
+  return ALIGN_VALUE (offset, 4) + (num_elts * sizeof(guint16));
+}
+
 gboolean
 _gi_typelib_hash_builder_prepare (GITypelibHashBuilder *builder)
 {
   char **strs;
   GHashTableIter hashiter;
   gpointer key, value;
-  cmph_io_adapter_t *io;
-  cmph_config_t *config;
   guint32 num_elts;
   guint32 offset;
   guint i;
@@ -98,23 +191,51 @@ _gi_typelib_hash_builder_prepare (GITypelibHashBuilder *builder)
   num_elts = g_hash_table_size (builder->strings);
   g_assert (num_elts <= 65536);
 
+  /* The CMPH adapter copies the keys as it reads them */
   strs = (char**) g_new (char *, num_elts + 1);
 
   i = 0;
   g_hash_table_iter_init (&hashiter, builder->strings);
   while (g_hash_table_iter_next (&hashiter, &key, &value))
-    {
-      const char *str = key;
+    strs[i++] = key;
+  strs[i++] = NULL;
 
-      strs[i++] = g_strdup (str);
+  if (builder->algorithm != GI_TYPELIB_HASH_AUTO)
+    {
+      builder->c = build_mph (strs, num_elts,
+                              &explicit_parameters[builder->algorithm]);
+    }
+  else
+    {
+      cmph_t *candidates[G_N_ELEMENTS (auto_candidates)];
+      guint32 smallest = G_MAXUINT32;
+
+      for (i = 0; i < G_N_ELEMENTS (auto_candidates); i++)
+        {
+          candidates[i] = build_mph (strs, num_elts, &auto_candidates[i]);
+          if (candidates[i] != NULL)
+            smallest = MIN (smallest, index_size (candidates[i], num_elts));
+        }
+
+      for (i = 0; i < G_N_ELEMENTS (auto_candidates); i++)
+        {
+          if (candidates[i] == NULL)
+            continue;
+
+          if (builder->c == NULL &&
+              index_size (candidates[i], num_elts) <=
+              smallest + smallest * AUTO_SIZE_SLACK_PERCENT / 100)
+            {
+              builder->c = candidates[i];
+              builder->algorithm = auto_candidates[i].algorithm;
+            }
+          else
+            cmph_destroy (candidates[i]);
+        }
     }
-  strs[i++] = NULL;
 
-  io = cmph_io_vector_adapter (strs, num_elts);
-  config = cmph_config_new (io);
-  cmph_config_set_algo (config, CMPH_BDZ);
+  g_free (strs);
 
-  builder->c = cmph_new (config);
   builder->prepared = TRUE;
   if (!builder->c)
     {
@@ -127,7 +248,7 @@ _gi_typelib_hash_builder_prepare (GITypelibHashBuilder *builder)
   /* Pack a size counter at front */
   offset = sizeof(guint32) + cmph_packed_size (builder->c);
   builder->dirmap_offset = ALIGN_VALUE (offset, 4);
-  builder->packed_size = builder->dirmap_offset + (num_elts * sizeof(guint16));
+  builder->packed_size = index_size (builder->c, num_elts);
  out:
   return builder->buildable;
 }
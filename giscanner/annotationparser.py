@@ -110,12 +110,26 @@ from __future__ import absolute_import
 
 import os
 import re
+import sys
 
 from collections import namedtuple
+from itertools import izip
 from operator import ne, gt, lt
 
 from .collections import Counter, OrderedDict
-from .message import Position, warn, error
+from .libtoolimporter import LibtoolImporter
+from .message import MessageLogger, Position, warn, error
+
+# The C implementation of tokenize_comment_line(), if available
+try:
+    with LibtoolImporter(None, None):
+        if 'UNINSTALLED_INTROSPECTION_SRCDIR' in os.environ:
+            import _giscanner
+        else:
+            from giscanner import _giscanner
+except ImportError:
+    _giscanner = None
+_tokenize_comment_line = getattr(_giscanner, 'tokenize_comment_line', None)
 
 
 # GTK-Doc comment block parts
@@ -124,6 +138,16 @@ PART_PARAMETERS = 1
 PART_DESCRIPTION = 2
 PART_TAGS = 3
 
+# GTK-Doc comment block line tokens, see tokenize_comment_line()
+TOKEN_TEXT = 0
+TOKEN_EMPTY = 1
+TOKEN_SECTION = 2
+TOKEN_PROPERTY = 3
+TOKEN_SIGNAL = 4
+TOKEN_SYMBOL = 5
+TOKEN_PARAMETER = 6
+TOKEN_TAG = 7
+
 # GTK-Doc comment block tags
 #   1) Basic GTK-Doc tags.
 #      Note: This list cannot be extended unless the GTK-Doc project defines new tags.
@@ -498,6 +522,85 @@ TAG_VALUE_STABILITY_RE = re.compile(
     re.UNICODE | re.VERBOSE | re.IGNORECASE)
 
 
+def tokenize_comment_line(line, identifier):
+    '''
+    Split a line of a GTK-Doc comment block into its parts. The ``tokenize_comment_line``
+    function of the :mod:`giscanner._giscanner` extension does the same in a single pass
+    over the line, it is used instead when available and the line is plain ASCII.
+
+    :param line: the line, without line ending
+    :param identifier: :const:`True` to look for an identifier, :const:`False` to look
+                       for a parameter, a tag or an empty line
+    :returns: an ``(indentation, comment, comment_start, column_offset, line_indent, token,
+              name, name_start, delimiter, delimiter_start, fields, fields_start)`` tuple
+              where ``indentation`` is the indentation before the ' * ' and ``comment``
+              the invalid comment text before it (if any), ``column_offset`` is the column
+              right after it and ``line_indent`` the indentation level after it. ``token``
+              is one of the ``TOKEN_*`` constants, :const:`TOKEN_TEXT` when the line is
+              none of the others. The remaining items are the identifier, parameter or tag
+              ``name`` and the groups matched after it, with their start columns relative
+              to ``column_offset``, :const:`None` where not applicable.
+    '''
+
+    indentation = INDENTATION_RE.match(line).group('indentation')
+    comment = None
+    comment_start = None
+    column_offset = 0
+
+    result = COMMENT_ASTERISK_RE.match(line)
+    if result:
+        comment = result.group('comment')
+        comment_start = result.start('comment')
+        column_offset = result.end(0)
+        line = line[column_offset:]
+
+    line_indent = len(INDENTATION_RE.match(line).group('indentation').replace('\t', '  '))
+    token = (TOKEN_TEXT, None, None, None, None, None, None)
+
+    if identifier:
+        result = SECTION_RE.match(line)
+        if result:
+            token = (TOKEN_SECTION, 'SECTION:%s' % (result.group('section_name'), ),
+                     None, None, None, None, None)
+        else:
+            result = PROPERTY_RE.match(line)
+            if result:
+                token = (TOKEN_PROPERTY,
+                         '%s:%s' % (result.group('class_name'), result.group('property_name')))
+            else:
+                result = SIGNAL_RE.match(line)
+                if result:
+                    token = (TOKEN_SIGNAL,
+                             '%s::%s' % (result.group('class_name'), result.group('signal_name')))
+                else:
+                    result = SYMBOL_RE.match(line)
+                    if result:
+                        token = (TOKEN_SYMBOL, result.group('symbol_name'))
+
+            if result:
+                token += (None,
+                          result.group('delimiter'), result.start('delimiter'),
+                          result.group('fields'), result.start('fields'))
+    else:
+        result = PARAMETER_RE.match(line)
+        if result:
+            token = (TOKEN_PARAMETER,
+                     result.group('parameter_name'), result.start('parameter_name'),
+                     None, None,
+                     result.group('fields'), result.start('fields'))
+        elif EMPTY_LINE_RE.match(line):
+            token = (TOKEN_EMPTY, None, None, None, None, None, None)
+        else:
+            result = TAG_RE.match(line)
+            if result:
+                token = (TOKEN_TAG,
+                         result.group('tag_name'), result.start('tag_name'),
+                         None, None,
+                         result.group('fields'), result.start('fields'))
+
+    return (indentation, comment, comment_start, column_offset, line_indent) + token
+
+
 class GtkDocAnnotations(OrderedDict):
     '''
     An ordered dictionary mapping annotation names to annotation options (if any). Annotation
@@ -1072,6 +1175,38 @@ _ParseAnnotationsResult = namedtuple('Result', ['success', 'annotations', 'start
 _ParseFieldsResult = namedtuple('Result', ['success', 'annotations', 'description'])
 
 
+#: Minimum number of comment blocks for each process when parsing in parallel, below which
+#: the cost of starting the processes and passing the results back is not worth it.
+PARALLEL_MIN_COMMENT_BLOCKS = 128
+
+
+def _parse_comment_blocks_job(comments):
+    '''
+    Parse GTK-Doc comment blocks in a worker process of
+    :meth:`GtkDocCommentBlockParser.parse_comment_blocks`.
+
+    :param comments: a list of ``(comment, filename, lineno)`` tuples
+    :returns: a list of ``(comment_block, failed, messages)`` tuples, one for each comment, where
+              ``messages`` are those logged while parsing it
+    '''
+
+    parser = GtkDocCommentBlockParser()
+    logger = MessageLogger.get()
+    results = []
+
+    for (comment, filename, lineno) in comments:
+        logger.start_recording()
+        try:
+            comment_block = parser.parse_comment_block(comment, filename, lineno)
+            failed = False
+        except Exception:
+            comment_block = None
+            failed = True
+        results.append((comment_block, failed, logger.stop_recording()))
+
+    return results
+
+
 class GtkDocCommentBlockParser(object):
     '''
     Parse GTK-Doc comment blocks into a parse tree built out of :class:`GtkDocCommentBlock`,
@@ -1102,20 +1237,21 @@ class GtkDocCommentBlockParser(object):
            https://git.gnome.org/browse/gtk-doc/commit/?id=47abcd53b8489ebceec9e394676512a181c1f1f6
     '''
 
-    def parse_comment_blocks(self, comments):
+    def parse_comment_blocks(self, comments, jobs=1):
         '''
         Parse multiple GTK-Doc comment blocks.
 
         :param comments: an iterable of ``(comment, filename, lineno)`` tuples
+        :param jobs: number of processes the comment blocks can be parsed in
         :returns: a dictionary mapping identifier names to :class:`GtkDocCommentBlock` objects
         '''
 
         comment_blocks = {}
+        comments = list(comments)
 
-        for (comment, filename, lineno) in comments:
-            try:
-                comment_block = self.parse_comment_block(comment, filename, lineno)
-            except Exception:
+        for ((comment, filename, lineno), (comment_block, failed)) in \
+                izip(comments, self._parse_comment_blocks(comments, jobs)):
+            if failed:
                 error('unrecoverable parse error, please file a GObject-Introspection bug'
                       'report including the complete comment block at the indicated location.',
                       Position(filename, lineno))
@@ -1138,6 +1274,57 @@ class GtkDocCommentBlockParser(object):
 
         return comment_blocks
 
+    def _parse_comment_blocks(self, comments, jobs):
+        '''
+        Parse GTK-Doc comment blocks, in parallel if possible.
+
+        Comment blocks are independent from each other, so they can be parsed in worker
+        processes. The results, and the messages logged while parsing each comment block,
+        are then returned in the order of ``comments``, so that the output is the same
+        as when parsing serially.
+
+        :param comments: a list of ``(comment, filename, lineno)`` tuples
+        :param jobs: number of processes the comment blocks can be parsed in
+        :returns: an iterator of ``(comment_block, failed)`` tuples, one for each comment
+        '''
+
+        jobs = min(jobs, len(comments) // PARALLEL_MIN_COMMENT_BLOCKS)
+
+        # Worker processes re-run the main script on Windows
+        if jobs < 2 or sys.platform == 'win32':
+            for (comment, filename, lineno) in comments:
+                try:
+                    yield (self.parse_comment_block(comment, filename, lineno), False)
+                except Exception:
+                    yield (None, True)
+            return
+
+        import gc
+        import multiprocessing
+
+        # A few chunks per process, so that they end up evenly loaded
+        nchunks = jobs * 4
+        chunk_size = (len(comments) + nchunks - 1) // nchunks
+        chunks = [comments[i:i + chunk_size] for i in range(0, len(comments), chunk_size)]
+
+        # Unpickling the results creates lots of small objects, none of which is garbage
+        gc_enabled = gc.isenabled()
+        gc.disable()
+        pool = multiprocessing.Pool(jobs)
+        try:
+            results = pool.map(_parse_comment_blocks_job, chunks)
+        finally:
+            pool.terminate()
+            pool.join()
+            if gc_enabled:
+                gc.enable()
+
+        logger = MessageLogger.get()
+        for chunk_results in results:
+            for (comment_block, failed, messages) in chunk_results:
+                logger.replay(messages)
+                yield (comment_block, failed)
+
     def parse_comment_block(self, comment, filename, lineno):
         '''
         Parse a single GTK-Doc comment block.
@@ -1228,106 +1415,70 @@ class GtkDocCommentBlockParser(object):
         current_part = None
         returns_seen = False
 
+        tokenize = _tokenize_comment_line
+
         for line in comment_lines:
             lineno += 1
             position = Position(filename, lineno)
 
-            # Store the original line (without \n) and column offset
-            # so we can generate meaningful warnings later on.
+            # Store the original line (without \n) so we can generate meaningful
+            # warnings later on.
             original_line = line
-            column_offset = 0
+
+            parts = tokenize(line, comment_block is None) if tokenize else None
+            if parts is None:
+                parts = tokenize_comment_line(line, comment_block is None)
+
+            (indentation, comment, comment_start, column_offset, line_indent,
+             token, name, name_start, delimiter, delimiter_start, fields, fields_start) = parts
 
             # Store indentation level of the comment (before the ' * ')
-            result = INDENTATION_RE.match(line)
-            block_indent.append(result.group('indentation'))
+            block_indent.append(indentation)
 
             # Get rid of the ' * ' at the start of the line.
-            result = COMMENT_ASTERISK_RE.match(line)
-            if result:
-                comment = result.group('comment')
-                if comment:
-                    marker = ' ' * result.start('comment') + '^'
-                    error('invalid comment text:\n%s\n%s' %
-                          (original_line, marker),
-                          position)
-
-                column_offset = result.end(0)
-                line = line[result.end(0):]
+            if comment:
+                marker = ' ' * comment_start + '^'
+                error('invalid comment text:\n%s\n%s' %
+                      (original_line, marker),
+                      position)
 
-            # Store indentation level of the line (after the ' * ').
-            result = INDENTATION_RE.match(line)
-            line_indent = len(result.group('indentation').replace('\t', '  '))
+            line = line[column_offset:]
 
             ####################################################################
             # Check for GTK-Doc comment block identifier.
             ####################################################################
             if comment_block is None:
-                result = SECTION_RE.match(line)
-
-                if result:
-                    identifier_name = 'SECTION:%s' % (result.group('section_name'), )
-                    identifier_delimiter = None
-                    identifier_fields = None
-                    identifier_fields_start = None
-                else:
-                    result = PROPERTY_RE.match(line)
-
-                    if result:
-                        identifier_name = '%s:%s' % (result.group('class_name'),
-                                                     result.group('property_name'))
-                        identifier_delimiter = result.group('delimiter')
-                        identifier_fields = result.group('fields')
-                        identifier_fields_start = result.start('fields')
-                    else:
-                        result = SIGNAL_RE.match(line)
-
-                        if result:
-                            identifier_name = '%s::%s' % (result.group('class_name'),
-                                                          result.group('signal_name'))
-                            identifier_delimiter = result.group('delimiter')
-                            identifier_fields = result.group('fields')
-                            identifier_fields_start = result.start('fields')
-                        else:
-                            result = SYMBOL_RE.match(line)
-
-                            if result:
-                                identifier_name = '%s' % (result.group('symbol_name'), )
-                                identifier_delimiter = result.group('delimiter')
-                                identifier_fields = result.group('fields')
-                                identifier_fields_start = result.start('fields')
-
-                if result:
+                if token != TOKEN_TEXT:
                     in_part = PART_IDENTIFIER
                     part_indent = line_indent
 
-                    comment_block = GtkDocCommentBlock(identifier_name, comment_block_pos)
+                    comment_block = GtkDocCommentBlock(name, comment_block_pos)
                     comment_block.code_before = code_before
                     comment_block.code_after = code_after
 
-                    if identifier_fields:
+                    if fields:
                         res = self._parse_annotations(position,
-                                                      column_offset + identifier_fields_start,
+                                                      column_offset + fields_start,
                                                       original_line,
-                                                      identifier_fields)
+                                                      fields)
 
                         if res.success:
-                            if identifier_fields[res.end_pos:].strip():
+                            if fields[res.end_pos:].strip():
                                 # Not an identifier due to invalid trailing description field
-                                result = None
                                 in_part = None
                                 part_indent = None
                                 comment_block = None
                             else:
                                 comment_block.annotations = res.annotations
 
-                                if not identifier_delimiter and res.annotations:
-                                    marker_position = column_offset + result.start('delimiter')
+                                if not delimiter and res.annotations:
+                                    marker_position = column_offset + delimiter_start
                                     marker = ' ' * marker_position + '^'
                                     warn('missing ":" at column %s:\n%s\n%s' %
                                          (marker_position + 1, original_line, marker),
                                          position)
 
-                if not result:
+                if comment_block is None:
                     # Emit a single warning when the identifier is not found on the first line
                     if not identifier_warned:
                         identifier_warned = True
@@ -1340,14 +1491,13 @@ class GtkDocCommentBlockParser(object):
             ####################################################################
             # Check for comment block parameters.
             ####################################################################
-            result = PARAMETER_RE.match(line)
-            if result:
+            if token == TOKEN_PARAMETER:
                 part_indent = line_indent
-                param_name = result.group('parameter_name')
+                param_name = name
                 param_name_lower = param_name.lower()
-                param_fields = result.group('fields')
-                param_fields_start = result.start('fields')
-                marker = ' ' * (result.start('parameter_name') + column_offset) + '^'
+                param_fields = fields
+                param_fields_start = fields_start
+                marker = ' ' * (name_start + column_offset) + '^'
 
                 if in_part not in [PART_IDENTIFIER, PART_PARAMETERS]:
                     warn('"@%s" parameter unexpected at this location:\n%s\n%s' %
@@ -1419,7 +1569,7 @@ class GtkDocCommentBlockParser(object):
             #       at this location as those might be handy describing
             #       parameters from time to time...
             ####################################################################
-            if (EMPTY_LINE_RE.match(line) and in_part in [PART_IDENTIFIER, PART_PARAMETERS]):
+            if (token == TOKEN_EMPTY and in_part in [PART_IDENTIFIER, PART_PARAMETERS]):
                 in_part = PART_DESCRIPTION
                 part_indent = line_indent
                 continue
@@ -1427,14 +1577,13 @@ class GtkDocCommentBlockParser(object):
             ####################################################################
             # Check for GTK-Doc comment block tags.
             ####################################################################
-            result = TAG_RE.match(line)
-            if result and line_indent <= part_indent:
+            if token == TOKEN_TAG and line_indent <= part_indent:
                 part_indent = line_indent
-                tag_name = result.group('tag_name')
+                tag_name = name
                 tag_name_lower = tag_name.lower()
-                tag_fields = result.group('fields')
-                tag_fields_start = result.start('fields')
-                marker = ' ' * (result.start('tag_name') + column_offset) + '^'
+                tag_fields = fields
+                tag_fields_start = fields_start
+                marker = ' ' * (name_start + column_offset) + '^'
 
                 if tag_name_lower in DEPRECATED_GI_ANN_TAGS:
                     # Deprecated GObject-Introspection specific tags.
@@ -1451,7 +1600,7 @@ class GtkDocCommentBlockParser(object):
                     if tag_name_lower == TAG_ATTRIBUTES:
                         transformed = ''
                         result = self._parse_fields(position,
-                                                    result.start('tag_name') + column_offset,
+                                                    name_start + column_offset,
                                                     line,
                                                     tag_fields.strip(),
                                                     False,
@@ -1581,7 +1730,7 @@ class GtkDocCommentBlockParser(object):
             # If we get here, we must be in the middle of a multiline
             # comment block, parameter or tag description.
             ####################################################################
-            if EMPTY_LINE_RE.match(line) is None:
+            if token != TOKEN_EMPTY:
                 line = line.rstrip()
 
             if in_part in [PART_IDENTIFIER, PART_DESCRIPTION]:
@@ -378,6 +378,9 @@ class Namespace(object):
         self.shared_libraries = []   # str
         self.c_includes = []         # str
         self.exported_packages = []  # str
+        # Bumped whenever a lookup table above changes, so that things
+        # derived from them (see Transformer.resolve_type) can be dropped
+        self.generation = 0
 
     def type_from_name(self, name, ctype=None):
         """Backwards compatibility method for older .gir files, which
@@ -403,6 +406,7 @@ but adds it to things like ctypes, symbols, and type_names.
             return
         assert node.namespace is None
         node.namespace = self
+        self.generation += 1
         if isinstance(node, Alias):
             self.aliases[node.name] = node
         elif isinstance(node, Registered) and node.gtype_name is not None:
@@ -444,6 +448,7 @@ but adds it to things like ctypes, symbols, and type_names.
         self.names[node.name] = node
 
     def remove(self, node):
+        self.generation += 1
         if isinstance(node, Alias):
             del self.aliases[node.name]
         elif isinstance(node, Registered) and node.gtype_name is not None:
@@ -480,6 +485,9 @@ functions via get_by_symbol()."""
     def get_by_ctype(self, ctype):
         return self.ctypes.get(ctype)
 
+    def get_by_gtype_name(self, gtype_name):
+        return self.type_names.get(gtype_name)
+
     def get_by_symbol(self, symbol):
         return self.symbols.get(symbol)
 
@@ -890,6 +898,7 @@ class Compound(Node, Registered):
         self.gtype_name = gtype_name
         self.get_type = get_type
         self.namespace.type_names[gtype_name] = self
+        self.namespace.generation += 1
 
     def _walk(self, callback, chain):
         for ctor in self.constructors:
@@ -20,26 +20,60 @@
 
 import errno
 import cPickle
-import glob
 import hashlib
+import imp
 import os
 import shutil
 import sys
 import tempfile
+import time
 
 import giscanner
 
-_CACHE_VERSION_FILENAME = '.cache-version'
+# Bump when the layout or the contents of the entries change
+_CACHE_FORMAT = '4'
+
+# The cache of each version of the scanner lives in its own directory,
+# removed once no scanner used it for that long
+_CACHE_MAX_UNUSED_TIME = 7 * 24 * 60 * 60
+
+# Temporary files left by interrupted writers are removed after that
+_CACHE_MAX_TMP_TIME = 60 * 60
+
+_TMP_PREFIX = '.tmp-'
+
+
+_versionhash = None
 
 
 def _get_versionhash():
+    # The modules of a process do not change once imported, which lets
+    # a scanner server check them once for all of the scanners it forks
+    global _versionhash
+    if _versionhash is None:
+        _versionhash = _compute_versionhash()
+    return _versionhash
+
+
+def _compute_versionhash():
     toplevel = os.path.dirname(giscanner.__file__)
-    # Use pyc instead of py to avoid extra IO
-    sources = glob.glob(os.path.join(toplevel, '*.pyc'))
-    sources.append(sys.argv[0])
-    # Using mtimes is a bit (5x) faster than hashing the file contents
+    # Installing or recompiling a module replaces its file, which
+    # changes the mtime of the directory: looking at the latter is
+    # cheaper than at every module.
+    sources = [toplevel, sys.argv[0]]
+    # The C source scanner, whose output is cached too, is not
+    # necessarily next to the modules
+    try:
+        fp, pathname, description = imp.find_module('_giscanner',
+                                                    [toplevel] + sys.path)
+    except ImportError:
+        pass
+    else:
+        if fp is not None:
+            fp.close()
+        sources.append(pathname)
     mtimes = (str(os.stat(source).st_mtime) for source in sources)
-    return hashlib.sha1(''.join(mtimes)).hexdigest()
+    return hashlib.sha1(_CACHE_FORMAT + ''.join(mtimes)).hexdigest()
 
 
 def _get_cachedir():
@@ -71,65 +105,67 @@ def _get_cachedir():
 
 
 class CacheStore(object):
+    """Cache of data derived from files.
+
+The entries are written once to a temporary file, which is then renamed
+into place, so that the scanners running in parallel only ever see
+complete entries. The inputs of an entry are all part of its key, so an
+entry never needs to be replaced: when several scanners compute the
+same one, whichever rename comes last wins with identical contents."""
+
+    # Entries of files kept in memory by preload(), by key
+    _preloaded = {}
+    # Files whose entries were loaded or stored by this process
+    _used_filenames = set()
 
     def __init__(self):
         try:
-            self._directory = _get_cachedir()
+            self._directory = self._get_version_directory(_get_cachedir())
         except OSError as e:
             if e.errno != errno.EPERM:
                 raise
             self._directory = None
 
-        self._check_cache_version()
-
-    def _check_cache_version(self):
-        if self._directory is None:
-            return
+    def _get_version_directory(self, cachedir):
+        if cachedir is None:
+            return None
 
-        current_hash = _get_versionhash()
-        version = os.path.join(self._directory, _CACHE_VERSION_FILENAME)
+        directory = os.path.join(cachedir, _get_versionhash())
         try:
-            cache_hash = open(version).read()
-        except IOError as e:
-            # File does not exist
-            if e.errno == errno.ENOENT:
-                cache_hash = 0
-            else:
-                raise
-
-        if current_hash == cache_hash:
-            return
-
-        versiontmp = version + '.tmp'
-
-        self._clean()
+            os.mkdir(directory, 0o755)
+        except OSError as e:
+            # Created by a scanner running in parallel
+            if e.errno != errno.EEXIST:
+                return None
+        else:
+            self._clean(cachedir, directory)
+        # Mark it as used, see _clean()
         try:
-            fp = open(versiontmp, 'w')
-        except IOError as e:
-            # Permission denied
-            if e.errno == errno.EACCES:
-                return
-            else:
-                raise
-
-        fp.write(current_hash)
-        fp.close()
-        # On Unix, this would just be os.rename() but Windows
-        # doesn't allow that.
-        shutil.move(versiontmp, version)
+            last_used = os.stat(directory).st_mtime
+            os.utime(directory, None)
+        except OSError:
+            return None
+        now = time.time()
+        if now - last_used > _CACHE_MAX_TMP_TIME:
+            self._clean_tmp_files(directory, now)
+        return directory
 
-    def _get_filename(self, filename):
+    def _get_filename(self, key):
         # If we couldn't create the directory we're probably
         # on a read only home directory where we just disable
         # the cache all together.
         if self._directory is None:
             return
-        hexdigest = hashlib.sha1(filename).hexdigest()
+        hexdigest = hashlib.sha1(key).hexdigest()
         return os.path.join(self._directory, hexdigest)
 
-    def _cache_is_valid(self, store_filename, filename):
-        return (os.stat(store_filename).st_mtime >=
-                os.stat(filename).st_mtime)
+    def _get_file_key(self, filename):
+        try:
+            st = os.stat(filename)
+        except OSError:
+            return None
+        return '\0'.join([os.path.abspath(filename), str(st.st_mtime),
+                          str(st.st_size)])
 
     def _remove_filename(self, filename):
         try:
@@ -142,28 +178,56 @@ class CacheStore(object):
                 raise
         except OSError as e:
             # File does not exist
-            if e.errno == errno.ENOENT:
+            if e.errno in (errno.ENOENT, errno.EACCES, errno.EPERM):
                 return
             else:
                 raise
 
-    def _clean(self):
-        for filename in os.listdir(self._directory):
-            if filename == _CACHE_VERSION_FILENAME:
+    def _clean(self, cachedir, current):
+        # Done when a new version starts to be used. The entries of the
+        # first cache format were stored directly in cachedir.
+        now = time.time()
+        for name in os.listdir(cachedir):
+            path = os.path.join(cachedir, name)
+            if path == current:
                 continue
-            self._remove_filename(os.path.join(self._directory, filename))
-
-    def store(self, filename, data):
-        store_filename = self._get_filename(filename)
-        if store_filename is None:
-            return
+            if not os.path.isdir(path):
+                self._remove_filename(path)
+                continue
+            try:
+                unused_time = now - os.stat(path).st_mtime
+            except OSError:
+                continue
+            if unused_time > _CACHE_MAX_UNUSED_TIME:
+                shutil.rmtree(path, ignore_errors=True)
 
-        if (os.path.exists(store_filename) and self._cache_is_valid(store_filename, filename)):
-            return None
+    def _clean_tmp_files(self, directory, now):
+        for name in os.listdir(directory):
+            if not name.startswith(_TMP_PREFIX):
+                continue
+            path = os.path.join(directory, name)
+            try:
+                if now - os.stat(path).st_mtime > _CACHE_MAX_TMP_TIME:
+                    self._remove_filename(path)
+            except OSError:
+                continue
 
-        tmp_fd, tmp_filename = tempfile.mkstemp(prefix='g-ir-scanner-cache-')
+    def _write(self, store_filename, data):
         try:
-            cPickle.dump(data, os.fdopen(tmp_fd, 'w'))
+            tmp_fd, tmp_filename = tempfile.mkstemp(prefix=_TMP_PREFIX,
+                                                    dir=self._directory)
+        except OSError as e:
+            # Permission denied
+            if e.errno == errno.EACCES:
+                return
+            else:
+                raise
+        try:
+            fp = os.fdopen(tmp_fd, 'wb')
+            try:
+                cPickle.dump(data, fp, cPickle.HIGHEST_PROTOCOL)
+            finally:
+                fp.close()
         except IOError as e:
             # No space left on device
             if e.errno == errno.ENOSPC:
@@ -173,31 +237,90 @@ class CacheStore(object):
                 raise
 
         try:
-            shutil.move(tmp_filename, store_filename)
-        except IOError as e:
-            # Permission denied
-            if e.errno == errno.EACCES:
+            os.rename(tmp_filename, store_filename)
+        except OSError as e:
+            # Windows does not replace existing files; the entry was
+            # stored by another scanner meanwhile.
+            if e.errno in (errno.EEXIST, errno.EACCES):
                 self._remove_filename(tmp_filename)
             else:
                 raise
 
-    def load(self, filename):
-        store_filename = self._get_filename(filename)
-        if store_filename is None:
-            return
+    def _read(self, store_filename):
         try:
-            fd = open(store_filename)
+            fp = open(store_filename, 'rb')
         except IOError as e:
             if e.errno == errno.ENOENT:
                 return None
             else:
                 raise
-        if not self._cache_is_valid(store_filename, filename):
-            return None
         try:
-            data = cPickle.load(fd)
-        except (AttributeError, EOFError, ValueError, cPickle.BadPickleGet):
+            # Unpickling from a string is much faster than from a file
+            contents = fp.read()
+        finally:
+            fp.close()
+        try:
+            return cPickle.loads(contents)
+        except (AttributeError, EOFError, ImportError, IndexError,
+                TypeError, ValueError, cPickle.UnpicklingError):
             # Broken cache entry, remove it
             self._remove_filename(store_filename)
-            data = None
-        return data
+            return None
+
+    def store(self, filename, data):
+        """Store data derived from filename, until it changes."""
+        key = self._get_file_key(filename)
+        if key is None:
+            return
+        self._used_filenames.add(os.path.abspath(filename))
+        self.store_entry(key, data)
+
+    def load(self, filename):
+        key = self._get_file_key(filename)
+        if key is None:
+            return None
+        self._used_filenames.add(os.path.abspath(filename))
+        if self._directory is not None:
+            data = self._preloaded.get(key)
+            if data is not None:
+                return data
+        return self.load_entry(key)
+
+    def preload(self, filename):
+        """Keep the entry of filename in memory, for load() to return
+it without reading it again. A scanner server preloads the entries of
+the GIR files its scanners used, for the scanners it forks afterwards to
+find them there; the entry is shared by all of the loads of a process."""
+        key = self._get_file_key(filename)
+        if key is None or key in self._preloaded:
+            return
+        data = self.load_entry(key)
+        if data is None:
+            return
+        # Forget the entries of earlier versions of the file
+        prefix = key.split('\0', 1)[0] + '\0'
+        for old_key in [k for k in self._preloaded if k.startswith(prefix)]:
+            del self._preloaded[old_key]
+        self._preloaded[key] = data
+
+    @classmethod
+    def get_used_filenames(cls):
+        """The files whose entries load() or store() were called for."""
+        return sorted(cls._used_filenames)
+
+    def store_entry(self, key, data):
+        """Store data computed from inputs which are all part of key."""
+        store_filename = self._get_filename(key)
+        if store_filename is None:
+            return
+
+        if os.path.exists(store_filename):
+            return
+
+        self._write(store_filename, data)
+
+    def load_entry(self, key):
+        store_filename = self._get_filename(key)
+        if store_filename is None:
+            return None
+        return self._read(store_filename)
@@ -20,6 +20,7 @@
 
 import os
 import optparse
+import time
 
 from .docwriter import DocWriter
 from .sectionparser import generate_sections_file, write_sections_file
@@ -42,6 +43,12 @@ def doc_main(args):
     parser.add_option("", "--write-sections-file",
                       action="store_true", dest="write_sections",
                       help="Generate and write out a sections file")
+    parser.add_option("-j", "--jobs",
+                      action="store", dest="jobs", type="int", default=1,
+                      help="number of processes used to render the pages")
+    parser.add_option("-v", "--verbose",
+                      action="store_true", dest="verbose",
+                      help="report how many pages were rendered and written, and how fast")
 
     options, args = parser.parse_args(args)
     if not options.output:
@@ -67,6 +74,11 @@ def doc_main(args):
         fp.close()
     else:
         writer = DocWriter(transformer, options.language)
-        writer.write(options.output)
+        start = time.time()
+        pages, rendered, written = writer.write(options.output, jobs=options.jobs)
+        if options.verbose:
+            elapsed = max(time.time() - start, 1e-6)
+            print ("g-ir-doc-tool: %d of %d pages rendered in %.2f s (%.0f pages/s), "
+                   "%d written" % (rendered, pages, elapsed, rendered / elapsed, written))
 
     return 0
@@ -21,17 +21,116 @@
 # 02110-1301, USA.
 #
 
+import hashlib
+import json
 import os
 import re
+import sys
 import tempfile
 
 from xml.sax import saxutils
 from mako.lookup import TemplateLookup
 
 from . import ast, xmlwriter
+from .collections import OrderedDict
+from .girwriter import GIRWriter
 from .utils import to_underscores
 
 
+#: Minimum number of pages for each process when rendering in parallel, below which
+#: the cost of starting the processes is not worth it.
+PARALLEL_MIN_PAGES = 32
+
+# The templates a template inherits from
+_INHERIT_RE = re.compile(r'<%inherit\s+file="([^"]+)"')
+
+# What the worker processes of DocWriter._write_pages() render: the writer,
+# its pages and the output directory. Set before the processes are forked,
+# so that they inherit it along with the compiled templates.
+_job_state = None
+
+
+def _write_pages_job(indexes):
+    writer, pages, output = _job_state
+    return [writer._write_page(pages[i], output) for i in indexes]
+
+
+# Bump on incompatible changes of the page hashes file, or of how the
+# hashes are computed
+_PAGE_HASHES_FORMAT = '1'
+
+
+class _NodeWriter(GIRWriter):
+    """
+    Writes a single node the way it is written in a GIR file, which is
+    what its page is rendered from.
+    """
+
+    def __init__(self, namespace, node, parent):
+        xmlwriter.XMLWriter.__init__(self)
+        self._namespace = namespace
+        if isinstance(node, ast.Function):
+            self._write_function(node)
+        elif isinstance(node, ast.Property):
+            self._write_property(node)
+        elif isinstance(node, ast.Signal):
+            self._write_signal(node)
+        elif isinstance(node, ast.VFunction):
+            self._write_vfunc(node)
+        elif isinstance(node, ast.Field):
+            self._write_field(node, parent)
+        else:
+            self._write_node(node)
+
+
+def _get_node_xml(namespace, node, chain):
+    """The GIR of node, or None when it cannot be written."""
+    if isinstance(node, ast.Namespace):
+        return 'namespace %s %s' % (node.name, node.version)
+    if not isinstance(node, (ast.Function, ast.Enum, ast.Bitfield, ast.Class,
+                             ast.Interface, ast.Callback, ast.Record, ast.Union,
+                             ast.Boxed, ast.Alias, ast.Constant, ast.Property,
+                             ast.Signal, ast.VFunction, ast.Field)):
+        return None
+    parent = chain[-1] if chain else None
+    return _NodeWriter(namespace, node, parent).get_xml()
+
+
+def _get_node_signature(node, chain):
+    """
+    What the pages linking to node, or listing it as a parent class, an
+    interface or a prerequisite, use of it.
+    """
+    def names(types):
+        return ','.join(str(getattr(t, 'target_giname', t)) for t in types)
+
+    parent_type = getattr(node, 'parent_type', None)
+    return ' '.join([node.__class__.__name__,
+                     '.'.join(str(getattr(n, 'name', None)) for n in chain + [node]),
+                     str(getattr(node, 'ctype', None)),
+                     str(getattr(node, 'symbol', None)),
+                     str(getattr(node, 'gtype_name', None)),
+                     names([parent_type] if parent_type is not None else []),
+                     names(getattr(node, 'interfaces', [])),
+                     names(getattr(node, 'prerequisites', []))])
+
+
+def _get_sources_digest(srcdir):
+    """
+    Hash what renders the pages: the modules and the templates in srcdir.
+    Their sizes and modification times are enough to notice a change.
+    """
+    sources = []
+    for dirpath, dirnames, filenames in os.walk(srcdir):
+        dirnames.sort()
+        for filename in sorted(filenames):
+            if not filename.endswith(('.py', '.tmpl')):
+                continue
+            st = os.stat(os.path.join(dirpath, filename))
+            sources.append('%s %d %s' % (filename, st.st_size, st.st_mtime))
+    return hashlib.sha1('\n'.join(sources)).hexdigest()
+
+
 def make_page_id(node, recursive=False):
     if isinstance(node, ast.Namespace):
         if recursive:
@@ -901,58 +1000,241 @@ class DocWriter(object):
         else:
             srcdir = os.path.dirname(__file__)
 
+        self._srcdir = srcdir
         template_dir = os.path.join(srcdir, 'doctemplates')
 
         return TemplateLookup(directories=[template_dir],
                               module_directory=tempfile.mkdtemp(),
                               output_encoding='utf-8')
 
-    def write(self, output):
+    def write(self, output, jobs=1):
+        """
+        Write a page for each node of the namespace to the output directory,
+        rendering them in up to jobs processes. Pages whose content did not
+        change are left alone, so that what depends on them is not rebuilt.
+
+        The hash of what each page was rendered from is kept in a file next
+        to the output directory, see _get_page_hashes(). Pages whose hash
+        did not change since the previous run are not rendered again.
+
+        Returns the number of pages, the number of pages rendered and the
+        number of pages written.
+        """
         try:
             os.makedirs(output)
         except OSError:
             # directory already made
             pass
 
-        self._walk_node(output, self._transformer.namespace, [])
-        self._transformer.namespace.walk(lambda node, chain: self._walk_node(output, node, chain))
-
-    def _walk_node(self, output, node, chain):
+        nodes = []
+        signatures = []
+        self._walk_node(nodes, signatures, self._transformer.namespace, [])
+        self._transformer.namespace.walk(
+            lambda node, chain: self._walk_node(nodes, signatures, node, chain))
+
+        # Nodes can share a page, which ends up with the content of the last
+        # one; only render that one, for the file not to change twice.
+        pages = OrderedDict()
+        for node in nodes:
+            page_id = make_page_id(node)
+            pages.pop(page_id, None)
+            pages[page_id] = node
+        pages = pages.items()
+
+        output = os.path.abspath(output)
+        hashes_file_name = output + '.hashes'
+        old_hashes = self._read_page_hashes(hashes_file_name)
+        hashes = self._get_page_hashes(pages, signatures)
+        dirty = [(page_id, node) for (page_id, node) in pages
+                 if (hashes[page_id] is None or
+                     hashes[page_id] != old_hashes.get(page_id) or
+                     not os.path.exists(os.path.join(output, page_id + '.page')))]
+
+        written = 0
+        for changed in self._write_pages(dirty, output, jobs):
+            if changed:
+                written += 1
+
+        self._write_page_hashes(hashes_file_name, hashes)
+        return len(pages), len(dirty), written
+
+    def _get_page_hashes(self, pages, signatures):
+        """
+        Hash what each page is rendered from: the node, the parents it is
+        rendered in, and the modules and templates rendering it. The pages
+        link to others, and list parent classes, interfaces and their
+        implementations; rather than tracking which, the pages depend on
+        the names and relations of all the nodes, so that adding, removing
+        or renaming one renders all the pages again.
+
+        Returns a dictionary mapping page ids to hashes, which are None for
+        the pages which must always be rendered.
+        """
+        namespace = self._transformer.namespace
+        common = hashlib.sha1()
+        for data in [_PAGE_HASHES_FORMAT,
+                     _get_sources_digest(self._srcdir),
+                     self._language,
+                     ' '.join(sorted(str(include) for include in namespace.includes))]:
+            common.update(data)
+            common.update('\0')
+        for signature in signatures:
+            common.update(signature)
+            common.update('\n')
+
+        hashes = {}
+        for (page_id, node) in pages:
+            xml = _get_node_xml(namespace, node, node._chain)
+            if xml is None:
+                hashes[page_id] = None
+                continue
+            page_hash = common.copy()
+            page_hash.update(page_id)
+            page_hash.update('\0')
+            for parent in node._chain:
+                page_hash.update(make_page_id(parent))
+                page_hash.update('\0')
+            page_hash.update(xml)
+            hashes[page_id] = page_hash.hexdigest()
+        return hashes
+
+    def _read_page_hashes(self, filename):
+        try:
+            fp = open(filename)
+        except IOError:
+            return {}
+        try:
+            try:
+                data = json.load(fp)
+            except ValueError:
+                return {}
+        finally:
+            fp.close()
+        if not isinstance(data, dict) or data.get('format') != _PAGE_HASHES_FORMAT:
+            return {}
+        return data.get('pages', {})
+
+    def _write_page_hashes(self, filename, hashes):
+        hashes = dict((page_id, page_hash) for (page_id, page_hash) in hashes.iteritems()
+                      if page_hash is not None)
+        # Written aside then renamed, not to leave a truncated file behind
+        tmp_file_name = filename + '.tmp'
+        fp = open(tmp_file_name, 'w')
+        try:
+            json.dump({'format': _PAGE_HASHES_FORMAT, 'pages': hashes}, fp,
+                      indent=0, separators=(',', ': '), sort_keys=True)
+            fp.write('\n')
+        finally:
+            fp.close()
+        if sys.platform == 'win32' and os.path.exists(filename):
+            # Windows does not replace existing files
+            os.unlink(filename)
+        os.rename(tmp_file_name, filename)
+
+    def _walk_node(self, nodes, signatures, node, chain):
+        signatures.append(_get_node_signature(node, chain))
         if isinstance(node, ast.Function) and node.moved_to is not None:
             return False
         if self._formatter.should_render_node(node):
-            self._render_node(node, chain, output)
+            # A bit of a hack...maybe this should be an official API.
+            # Set before rendering any page, so that links to a node do
+            # not depend on whether its own page was rendered already.
+            node._chain = list(chain)
+            nodes.append(node)
 
             # hack: fields are not Nodes in the ast, so we don't
             # see them in the visit. Handle them manually here
             if isinstance(node, (ast.Compound, ast.Class)):
                 chain.append(node)
                 for f in node.fields:
-                    self._walk_node(output, f, chain)
+                    self._walk_node(nodes, signatures, f, chain)
                 chain.pop()
             return True
         return False
 
-    def _render_node(self, node, chain, output):
-        namespace = self._transformer.namespace
+    def _write_pages(self, pages, output, jobs):
+        """
+        Write pages, a list of (page_id, node) tuples, in parallel if
+        possible. Yields whether each page was written, in their order.
+        """
+        jobs = min(jobs, len(pages) // PARALLEL_MIN_PAGES)
+
+        # Worker processes re-run the main script on Windows
+        if jobs < 2 or sys.platform == 'win32':
+            for page in pages:
+                yield self._write_page(page, output)
+            return
+
+        import multiprocessing
+        global _job_state
+
+        # Compile the templates once, for all the processes
+        compiled = set()
+        for template_name in set(self._get_template_name(node) for (page_id, node) in pages):
+            self._compile_template(template_name, compiled)
+
+        # A few chunks per process, so that they end up evenly loaded
+        nchunks = jobs * 4
+        chunk_size = (len(pages) + nchunks - 1) // nchunks
+        chunks = [range(i, min(i + chunk_size, len(pages)))
+                  for i in range(0, len(pages), chunk_size)]
+
+        _job_state = (self, pages, output)
+        pool = multiprocessing.Pool(jobs)
+        try:
+            results = pool.map(_write_pages_job, chunks)
+        finally:
+            pool.terminate()
+            pool.join()
+            _job_state = None
+
+        for chunk_results in results:
+            for changed in chunk_results:
+                yield changed
+
+    def _compile_template(self, template_name, compiled):
+        """
+        Compile a template along with those it inherits from, which the
+        lookup would otherwise only compile when rendering with it.
+        """
+        if template_name in compiled:
+            return
+        compiled.add(template_name)
+        template = self._lookup.get_template(template_name)
+        for parent_name in _INHERIT_RE.findall(template.source):
+            self._compile_template(self._lookup.adjust_uri(parent_name, template_name),
+                                   compiled)
 
-        # A bit of a hack...maybe this should be an official API
-        node._chain = list(chain)
+    def _get_template_name(self, node):
+        return '%s/%s.tmpl' % (self._language, get_node_kind(node))
 
-        page_kind = get_node_kind(node)
-        template_name = '%s/%s.tmpl' % (self._language, page_kind)
-        page_id = make_page_id(node)
+    def _write_page(self, page, output):
+        """Render a page, and write it unless it is unchanged."""
+        page_id, node = page
+        result = self._render_node(node, page_id)
 
-        template = self._lookup.get_template(template_name)
-        result = template.render(namespace=namespace,
-                                 node=node,
-                                 page_id=page_id,
-                                 page_kind=page_kind,
-                                 formatter=self._formatter,
-                                 ast=ast)
-
-        output_file_name = os.path.join(os.path.abspath(output),
-                                        page_id + '.page')
-        fp = open(output_file_name, 'w')
+        output_file_name = os.path.join(output, page_id + '.page')
+        try:
+            unchanged = os.path.getsize(output_file_name) == len(result)
+        except OSError:
+            unchanged = False
+        if unchanged:
+            fp = open(output_file_name, 'rb')
+            unchanged = fp.read() == result
+            fp.close()
+        if unchanged:
+            return False
+
+        fp = open(output_file_name, 'wb')
         fp.write(result)
         fp.close()
+        return True
+
+    def _render_node(self, node, page_id):
+        template = self._lookup.get_template(self._get_template_name(node))
+        return template.render(namespace=self._transformer.namespace,
+                               node=node,
+                               page_id=page_id,
+                               page_kind=get_node_kind(node),
+                               formatter=self._formatter,
+                               ast=ast)
@@ -19,15 +19,20 @@
 # Boston, MA 02111-1307, USA.
 #
 
+import errno
+import hashlib
 import os
+import re
 import sys
 import subprocess
 import shutil
 import tempfile
+import time
 
 from .gdumpparser import IntrospectionBinary
 from . import utils
 from .ccompiler import CCompiler
+from .profiler import Profiler
 
 # bugzilla.gnome.org/558436
 # Compile a binary program which is then linked to a library
@@ -68,6 +73,11 @@ main(int argc, char **argv)
 """
 
 
+# Bump when the layout of the cache entries changes
+_DUMPER_CACHE_VERSION = '1'
+_DUMPER_CACHE_MAX_ENTRIES = 32
+
+
 class CompilerError(Exception):
     pass
 
@@ -97,6 +107,7 @@ class DumpCompiler(object):
             'UNINSTALLED_INTROSPECTION_SRCDIR')
         self._packages = ['gio-2.0 gmodule-2.0']
         self._packages.extend(options.packages)
+        self._default_libpaths = None
 
     # Public API
 
@@ -106,51 +117,10 @@ class DumpCompiler(object):
         tmpdir = tempfile.mkdtemp('', 'tmp-introspect', dir=os.getcwd())
         os.mkdir(os.path.join(tmpdir, '.libs'))
 
-        tpl_args = {}
-        if self._uninst_srcdir is not None:
-            gdump_path = os.path.join(self._uninst_srcdir, 'girepository', 'gdump.c')
-        else:
-            gdump_path = os.path.join(os.path.join(DATADIR), 'gobject-introspection-1.0',
-                                      'gdump.c')
-        if not os.path.isfile(gdump_path):
-            raise SystemExit("Couldn't find %r" % (gdump_path, ))
-        gdump_file = open(gdump_path)
-        gdump_contents = gdump_file.read()
-        gdump_file.close()
-        tpl_args['gdump_include'] = gdump_contents
-        tpl_args['init_sections'] = "\n".join(self._options.init_sections)
-
         c_path = self._generate_tempfile(tmpdir, '.c')
         f = open(c_path, 'w')
-        f.write(_PROGRAM_TEMPLATE % tpl_args)
-
-        # We need to reference our get_type and error_quark functions
-        # to make sure they are pulled in at the linking stage if the
-        # library is a static library rather than a shared library.
-        if len(self._get_type_functions) > 0:
-            for func in self._get_type_functions:
-                f.write("extern GType " + func + "(void);\n")
-            f.write("GType (*GI_GET_TYPE_FUNCS_[])(void) = {\n")
-            first = True
-            for func in self._get_type_functions:
-                if first:
-                    first = False
-                else:
-                    f.write(",\n")
-                f.write("  " + func)
-            f.write("\n};\n")
-        if len(self._error_quark_functions) > 0:
-            for func in self._error_quark_functions:
-                f.write("extern GQuark " + func + "(void);\n")
-            f.write("GQuark (*GI_ERROR_QUARK_FUNCS_[])(void) = {\n")
-            first = True
-            for func in self._error_quark_functions:
-                if first:
-                    first = False
-                else:
-                    f.write(",\n")
-                f.write("  " + func)
-            f.write("\n};\n")
+        source = self._generate_source()
+        f.write(source)
         f.close()
 
         # Microsoft compilers generate intermediate .obj files
@@ -168,23 +138,143 @@ class DumpCompiler(object):
         bin_path = self._generate_tempfile(tmpdir, ext)
 
         try:
-            self._compile(o_path, c_path)
+            compile_args = self._get_compile_args(o_path, c_path)
+            link_args = self._get_link_args(bin_path, o_path)
         except CompilerError as e:
             if not utils.have_debug_flag('save-temps'):
                 shutil.rmtree(tmpdir)
             raise SystemExit('compilation of temporary binary failed:' + str(e))
 
+        # The binary only depends on the preprocessed source, the
+        # command lines and the files it is linked from, so an identical
+        # one built by a previous run can be reused; the temporary
+        # directory is still used for the dumper input and output.
+        cache = DumperCache()
+        key = None
+        if cache.is_enabled():
+            preprocessed = self._preprocess(c_path, tmpdir)
+            if preprocessed is not None:
+                key = cache.get_key(preprocessed, compile_args, link_args, tmpdir,
+                                    self._get_link_inputs(link_args, tmpdir))
+        if key is not None:
+            cached_path = cache.lookup(key, os.path.basename(bin_path))
+            if cached_path is not None:
+                if not self._options.quiet:
+                    print "g-ir-scanner: using cached dumper: %s" % (cached_path, )
+                    sys.stdout.flush()
+                return IntrospectionBinary([cached_path], tmpdir)
+
         try:
-            self._link(bin_path, o_path)
+            with Profiler.get().phase('dumper-compile'):
+                self._compile(compile_args)
+        except CompilerError as e:
+            if not utils.have_debug_flag('save-temps'):
+                shutil.rmtree(tmpdir)
+            raise SystemExit('compilation of temporary binary failed:' + str(e))
+
+        try:
+            with Profiler.get().phase('dumper-link'):
+                self._link(link_args, o_path)
         except LinkerError as e:
             if not utils.have_debug_flag('save-temps'):
                 shutil.rmtree(tmpdir)
             raise SystemExit('linking of temporary binary failed: ' + str(e))
 
+        if key is not None and not cache.store(key, tmpdir):
+            if not self._options.quiet:
+                print "g-ir-scanner: not caching the dumper, it refers to %s" % (tmpdir, )
+                sys.stdout.flush()
+
         return IntrospectionBinary([bin_path], tmpdir)
 
     # Private API
 
+    def _generate_source(self):
+        tpl_args = {}
+        if self._uninst_srcdir is not None:
+            gdump_path = os.path.join(self._uninst_srcdir, 'girepository', 'gdump.c')
+        else:
+            gdump_path = os.path.join(os.path.join(DATADIR), 'gobject-introspection-1.0',
+                                      'gdump.c')
+        if not os.path.isfile(gdump_path):
+            raise SystemExit("Couldn't find %r" % (gdump_path, ))
+        gdump_file = open(gdump_path)
+        gdump_contents = gdump_file.read()
+        gdump_file.close()
+        tpl_args['gdump_include'] = gdump_contents
+        tpl_args['init_sections'] = "\n".join(self._options.init_sections)
+
+        source = [_PROGRAM_TEMPLATE % tpl_args]
+
+        # We need to reference our get_type and error_quark functions
+        # to make sure they are pulled in at the linking stage if the
+        # library is a static library rather than a shared library.
+        if len(self._get_type_functions) > 0:
+            for func in self._get_type_functions:
+                source.append("extern GType " + func + "(void);\n")
+            source.append("GType (*GI_GET_TYPE_FUNCS_[])(void) = {\n")
+            source.append(",\n".join("  " + func for func in self._get_type_functions))
+            source.append("\n};\n")
+        if len(self._error_quark_functions) > 0:
+            for func in self._error_quark_functions:
+                source.append("extern GQuark " + func + "(void);\n")
+            source.append("GQuark (*GI_ERROR_QUARK_FUNCS_[])(void) = {\n")
+            source.append(",\n".join("  " + func for func in self._error_quark_functions))
+            source.append("\n};\n")
+        return ''.join(source)
+
+    def _preprocess(self, c_path, tmpdir):
+        # The output covers the headers the dumper is compiled with
+        args = self._get_compile_args(None, c_path)
+        proc = subprocess.Popen(args, stdout=subprocess.PIPE)
+        output = proc.communicate()[0]
+        if proc.returncode != 0:
+            # Compiling reports the error
+            return None
+        return output.replace(tmpdir, '@TMPDIR@')
+
+    def _get_link_inputs(self, link_args, tmpdir):
+        # The libraries and objects the dumper is linked from, resolved
+        # like libtool and the linker do, so that the cached dumper is
+        # rebuilt when one of them changes
+        libpaths = []
+        inputs = set()
+        pending = list(link_args)
+        pending.reverse()
+        while pending:
+            arg = pending.pop()
+            if arg.startswith('-L'):
+                libpaths.append(arg[2:])
+                continue
+            if arg.startswith('-l'):
+                path = _find_library(arg[2:], libpaths + self._get_default_libpaths())
+            elif _LINK_INPUT_RE.search(arg) and os.path.isfile(arg):
+                path = arg
+            else:
+                continue
+            if path is None:
+                continue
+            path = os.path.abspath(path)
+            if path in inputs or path.startswith(tmpdir + os.sep):
+                continue
+            inputs.add(path)
+            if path.endswith('.la'):
+                libs, dependencies = _read_libtool_archive(path)
+                inputs.update(libs)
+                pending.extend(reversed(dependencies))
+        return sorted(inputs)
+
+    def _get_default_libpaths(self):
+        if self._default_libpaths is None:
+            self._default_libpaths = []
+            if not self._pkgconfig_msvc_flags:
+                proc = subprocess.Popen(self._linker_cmd.split() + ['-print-search-dirs'],
+                                        stdout=subprocess.PIPE)
+                for line in proc.communicate()[0].splitlines():
+                    if line.startswith('libraries: ='):
+                        self._default_libpaths = line[len('libraries: ='):].split(os.pathsep)
+        return self._default_libpaths
+
     def _generate_tempfile(self, tmpdir, suffix=''):
         tmpl = '%s-%s%s' % (self._options.namespace_name,
                             self._options.namespace_version, suffix)
@@ -202,7 +292,7 @@ class DumpCompiler(object):
             stdout=subprocess.PIPE)
         return proc.communicate()[0].split()
 
-    def _compile(self, output, *sources):
+    def _get_compile_args(self, output, *sources):
         # Not strictly speaking correct, but easier than parsing shell
         args = self._compiler_cmd.split()
         # Do not add -Wall when using init code as we do not include any
@@ -227,7 +317,10 @@ class DumpCompiler(object):
             args.append('-I' + include)
         # The Microsoft compiler uses different option flags for
         # compilation result output
-        if self._pkgconfig_msvc_flags:
+        if output is None:
+            # Only preprocess, to the standard output
+            args.append('-E')
+        elif self._pkgconfig_msvc_flags:
             args.extend(['-c', '-Fe' + output, '-Fo' + output])
         else:
             args.extend(['-c', '-o', output])
@@ -236,6 +329,9 @@ class DumpCompiler(object):
                 raise CompilerError(
                     "Could not find c source file: %s" % (source, ))
         args.extend(list(sources))
+        return args
+
+    def _compile(self, args):
         if not self._options.quiet:
             print "g-ir-scanner: compile: %s" % (
                 subprocess.list2cmdline(args), )
@@ -245,7 +341,7 @@ class DumpCompiler(object):
         except subprocess.CalledProcessError as e:
             raise CompilerError(e)
 
-    def _link(self, output, *sources):
+    def _get_link_args(self, output, *sources):
         args = []
         libtool = utils.get_libtool_command(self._options)
         if libtool:
@@ -267,6 +363,10 @@ class DumpCompiler(object):
                 args.append('-Wl,--export-all-symbols')
             else:
                 args.append('-export-dynamic')
+            # The wrapper of a fast-install program relinks it on first
+            # use, from the temporary directory, which would keep it out
+            # of the DumperCache
+            args.append('-no-fast-install')
 
         cppflags = os.environ.get('CPPFLAGS', '')
         for cppflag in cppflags.split():
@@ -282,10 +382,6 @@ class DumpCompiler(object):
         # likely to be uninstalled yet and we want the uninstalled RPATHs have
         # priority (or we might run with installed library that is older)
 
-        for source in sources:
-            if not os.path.exists(source):
-                raise CompilerError(
-                    "Could not find object file: %s" % (source, ))
         args.extend(list(sources))
 
         cc = CCompiler()
@@ -305,6 +401,13 @@ class DumpCompiler(object):
             cc.get_external_link_flags(args,
                                        self._options.libraries,
                                        self._pkgconfig_msvc_flags)
+        return args
+
+    def _link(self, args, *sources):
+        for source in sources:
+            if not os.path.exists(source):
+                raise LinkerError(
+                    "Could not find object file: %s" % (source, ))
 
         if not self._options.quiet:
             print "g-ir-scanner: link: %s" % (
@@ -332,6 +435,200 @@ class DumpCompiler(object):
                 os.remove(tf_name)
 
 
+# Files which are linked when given on the command line
+_LINK_INPUT_RE = re.compile(r'\.(la|a|lib|o|obj|so|dylib|dll)(\.[0-9.]+)?$')
+_LIBTOOL_VARIABLE_RE = re.compile(r"^(\w+)='(.*)'$")
+_LIBTOOL_WRAPPER_MARKER = ' - temporary wrapper script for '
+_LIBTOOL_FAST_INSTALL_MARKER = "program=lt-'"
+
+
+def _find_library(name, libpaths):
+    for libpath in libpaths:
+        # libtool prefers the libtool archive
+        for filename in ['lib%s.la' % (name, ), 'lib%s.so' % (name, ),
+                         'lib%s.dylib' % (name, ), 'lib%s.a' % (name, ),
+                         'lib%s.dll.a' % (name, ), '%s.lib' % (name, )]:
+            path = os.path.join(libpath, filename)
+            if os.path.isfile(path):
+                return path
+    return None
+
+
+def _read_libtool_archive(path):
+    """Returns the libraries a libtool archive stands for, and the
+arguments it adds to the link of the programs using it."""
+    variables = {}
+    f = open(path)
+    for line in f:
+        match = _LIBTOOL_VARIABLE_RE.match(line.strip())
+        if match:
+            variables[match.group(1)] = match.group(2)
+    f.close()
+    directory = os.path.dirname(path)
+    # Uninstalled libraries are in .libs
+    libdirs = [os.path.join(directory, '.libs'), directory]
+    if variables.get('libdir'):
+        libdirs.append(variables['libdir'])
+    libs = []
+    for name in [variables.get('dlname'), variables.get('old_library')]:
+        if not name:
+            continue
+        for libdir in libdirs:
+            lib = os.path.join(libdir, name)
+            if os.path.isfile(lib):
+                libs.append(os.path.abspath(lib))
+                break
+    return libs, variables.get('dependency_libs', '').split()
+
+
+def _get_dumper_cachedir():
+    if 'GI_SCANNER_DISABLE_CACHE' in os.environ:
+        return None
+    homedir = os.path.expanduser('~')
+    if homedir is None or not os.path.exists(homedir):
+        return None
+    cachedir = os.path.join(homedir, '.cache', 'g-ir-scanner-dumpers')
+    try:
+        os.makedirs(cachedir, 0o755)
+    except OSError as e:
+        if e.errno != errno.EEXIST:
+            return None
+    if not os.path.isdir(cachedir):
+        return None
+    return cachedir
+
+
+class DumperCache(object):
+    """Content-addressed store of linked dumper binaries.
+
+    Each entry is a directory named after the hash of everything the
+    binary was built from, holding the binary and, when libtool was
+    used, its .libs directory.  Entries are staged in a private
+    directory and renamed into place, so concurrent scanners never see
+    a partial entry; the first one to finish wins and entries are
+    never modified afterwards.
+    """
+
+    def __init__(self):
+        self._directory = _get_dumper_cachedir()
+
+    def is_enabled(self):
+        return self._directory is not None
+
+    def get_key(self, source, compile_args, link_args, tmpdir, link_inputs):
+        key = hashlib.sha1()
+        key.update(_DUMPER_CACHE_VERSION + '\0')
+        key.update(source + '\0')
+        # The temporary directory differs on every run, and libtool
+        # wrappers find their .libs relative to themselves
+        for arg in compile_args + ['\0'] + link_args:
+            key.update(arg.replace(tmpdir, '@TMPDIR@') + '\0')
+        # Libtool wrappers refer to uninstalled libraries by absolute path
+        key.update(os.getcwd() + '\0')
+        for filename in link_inputs:
+            try:
+                stat = os.stat(filename)
+            except OSError:
+                continue
+            # The target of symbolic links such as libfoo.so -> libfoo.so.1
+            key.update('%s:%s:%r:%d\0' % (filename, os.path.realpath(filename),
+                                          stat.st_mtime, stat.st_size))
+        return key.hexdigest()
+
+    def lookup(self, key, binary_name):
+        if self._directory is None:
+            return None
+        entry = os.path.join(self._directory, key)
+        binary = os.path.join(entry, binary_name)
+        if not os.path.isfile(binary) or not os.access(binary, os.X_OK):
+            return None
+        try:
+            # Keep recently used entries around when pruning
+            os.utime(entry, None)
+        except OSError:
+            pass
+        return binary
+
+    def store(self, key, tmpdir):
+        """Returns False if the binary in tmpdir cannot be cached as it
+refers to tmpdir."""
+        if self._directory is None:
+            return True
+        entry = os.path.join(self._directory, key)
+        if os.path.exists(entry):
+            return True
+
+        names = [name for name in os.listdir(tmpdir)
+                 if os.path.splitext(name)[1] not in ('.c', '.o', '.obj')]
+        if self._refers_to(tmpdir, names):
+            return False
+
+        try:
+            staging = tempfile.mkdtemp(prefix='.tmp-', dir=self._directory)
+        except OSError:
+            return True
+        try:
+            for name in names:
+                path = os.path.join(tmpdir, name)
+                if os.path.isdir(path):
+                    shutil.copytree(path, os.path.join(staging, name),
+                                    symlinks=True)
+                else:
+                    shutil.copy2(path, staging)
+            os.rename(staging, entry)
+        except (IOError, OSError, shutil.Error):
+            # Out of space, or another scanner stored the same entry first
+            shutil.rmtree(staging, ignore_errors=True)
+            return True
+
+        self._prune()
+        return True
+
+    def _refers_to(self, tmpdir, names):
+        # Libtool wrappers of fast-install programs relink them on first
+        # use, from the object file in the directory they were created
+        # in; those cannot be moved. Other wrappers only mention that
+        # directory in comments and in the command relinking them for
+        # installation, which are not used.
+        token = os.path.basename(tmpdir)
+        for name in names:
+            path = os.path.join(tmpdir, name)
+            if os.path.isdir(path):
+                paths = [os.path.join(path, child) for child in os.listdir(path)]
+            else:
+                paths = [path]
+            for path in paths:
+                if not os.path.isfile(path):
+                    continue
+                f = open(path, 'rb')
+                contents = f.read()
+                f.close()
+                if _LIBTOOL_WRAPPER_MARKER in contents:
+                    if _LIBTOOL_FAST_INSTALL_MARKER in contents:
+                        return True
+                elif token in contents:
+                    return True
+        return False
+
+    def _prune(self):
+        entries = []
+        for name in os.listdir(self._directory):
+            path = os.path.join(self._directory, name)
+            try:
+                mtime = os.stat(path).st_mtime
+            except OSError:
+                continue
+            if name.startswith('.tmp-'):
+                # Left behind by an interrupted scanner
+                if mtime < time.time() - 3600:
+                    shutil.rmtree(path, ignore_errors=True)
+                continue
+            entries.append((mtime, path))
+        entries.sort()
+        for mtime, path in entries[:-_DUMPER_CACHE_MAX_ENTRIES]:
+            shutil.rmtree(path, ignore_errors=True)
+
+
 def compile_introspection_binary(options, get_type_functions,
                                  error_quark_functions):
     dc = DumpCompiler(options, get_type_functions, error_quark_functions)
@@ -19,15 +19,17 @@
 #
 
 import os
+import struct
 import sys
 import tempfile
 import shutil
 import subprocess
-from xml.etree.cElementTree import parse
+from xml.etree.cElementTree import iterparse
 
 from . import ast
 from . import message
 from . import utils
+from .profiler import Profiler
 from .transformer import TransformerException
 from .utils import to_underscores
 
@@ -41,6 +43,10 @@ G_PARAM_STATIC_NAME = 1 << 5
 G_PARAM_STATIC_NICK = 1 << 6
 G_PARAM_STATIC_BLURB = 1 << 7
 
+# See the description of the format in gdump.c
+_BINARY_DUMP_MAGIC = 'GI-DUMP\1'
+_UINT32 = struct.Struct('<I')
+
 
 class IntrospectionBinary(object):
 
@@ -52,6 +58,90 @@ class IntrospectionBinary(object):
             self.tmpdir = tmpdir
 
 
+class DumpElement(object):
+    """An element of the binary dump, with the parts of the
+ElementTree element API the introspection code uses."""
+
+    __slots__ = ('tag', 'attrib', 'children')
+
+    def __init__(self, tag, attrib):
+        self.tag = tag
+        self.attrib = attrib
+        self.children = []
+
+    def __iter__(self):
+        return iter(self.children)
+
+    def findall(self, tag):
+        return [child for child in self.children if child.tag == tag]
+
+
+def _decode_dump_string(value):
+    # Match ElementTree, which returns str for ASCII and unicode otherwise
+    try:
+        value.decode('ascii')
+        return value
+    except UnicodeDecodeError:
+        return value.decode('utf-8')
+
+
+def _read_dump_string(payload, offset):
+    length, = _UINT32.unpack_from(payload, offset)
+    offset += _UINT32.size
+    return _decode_dump_string(payload[offset:offset + length]), offset + length
+
+
+def iter_binary_dump(f):
+    """Yields the toplevel elements of a binary dump one by one, each
+with its children, without keeping the previous ones around."""
+    if f.read(len(_BINARY_DUMP_MAGIC)) != _BINARY_DUMP_MAGIC:
+        raise ValueError("Not a binary introspection dump")
+    stack = []
+    while True:
+        header = f.read(_UINT32.size)
+        if not header:
+            break
+        length, = _UINT32.unpack(header)
+        payload = f.read(length)
+        if len(payload) != length:
+            raise ValueError("Truncated introspection dump")
+        if payload[0] == 'S':
+            tag, offset = _read_dump_string(payload, 1)
+            attrib = {}
+            while offset < length:
+                name, offset = _read_dump_string(payload, offset)
+                value, offset = _read_dump_string(payload, offset)
+                attrib[name] = value
+            element = DumpElement(tag, attrib)
+            # The root element is not kept, so that the elements can
+            # be freed once they have been handled
+            if len(stack) > 1:
+                stack[-1].children.append(element)
+            stack.append(element)
+        elif payload[0] == 'E':
+            element = stack.pop()
+            if len(stack) == 1:
+                yield element
+        else:
+            raise ValueError("Invalid introspection dump record %r" % (payload[0], ))
+
+
+def iter_xml_dump(f):
+    """Like iter_binary_dump(), for the XML format."""
+    depth = 0
+    root = None
+    for event, element in iterparse(f, events=('start', 'end')):
+        if event == 'start':
+            if root is None:
+                root = element
+            depth += 1
+        else:
+            depth -= 1
+            if depth == 1:
+                yield element
+                root.remove(element)
+
+
 class Unresolved(object):
 
     def __init__(self, target):
@@ -106,14 +196,37 @@ class GDumpParser(object):
         """Do remaining parsing steps requiring introspection binary"""
 
         # Get all the GObject data by passing our list of get_type
-        # functions to the compiled binary, returning an XML blob.
-        tree = self._execute_binary_get_tree()
-        root = tree.getroot()
-        for child in root:
-            if child.tag == 'error-quark':
-                self._introspect_error_quark(child)
-            else:
-                self._introspect_type(child)
+        # functions to the compiled binary, and read the dump as it
+        # is parsed.
+        profiler = Profiler.get()
+        with profiler.phase('dumper-run'):
+            out_path = self._execute_binary()
+        with profiler.phase('gdump-parse'):
+            self._parse_dump(out_path)
+
+    # Helper functions
+
+    def _parse_dump(self, out_path):
+        try:
+            f = open(out_path, 'rb')
+            try:
+                if f.read(len(_BINARY_DUMP_MAGIC)) == _BINARY_DUMP_MAGIC:
+                    f.seek(0)
+                    children = iter_binary_dump(f)
+                else:
+                    f.seek(0)
+                    children = iter_xml_dump(f)
+                children = Profiler.get().counted('dump_types', children)
+                for child in children:
+                    if child.tag == 'error-quark':
+                        self._introspect_error_quark(child)
+                    else:
+                        self._introspect_type(child)
+            finally:
+                f.close()
+        finally:
+            if not utils.have_debug_flag('save-temps'):
+                shutil.rmtree(self._binary.tmpdir)
 
         # Pair up boxed types and class records
         for name, boxed in self._boxed_types.iteritems():
@@ -139,13 +252,17 @@ class GDumpParser(object):
         for node in to_remove:
             self._namespace.remove(node)
 
-    # Helper functions
+    def _execute_binary(self):
+        """Load the library (or executable), returning the path of a
+dump of the data gleaned from GObject's primitive introspection."""
+        # The binary format is cheaper to produce and read; keep the
+        # XML one when the temporary files are kept for debugging.
+        binary_format = not utils.have_debug_flag('save-temps')
 
-    def _execute_binary_get_tree(self):
-        """Load the library (or executable), returning an XML
-blob containing data gleaned from GObject's primitive introspection."""
         in_path = os.path.join(self._binary.tmpdir, 'functions.txt')
         f = open(in_path, 'w')
+        if binary_format:
+            f.write('dump-format:binary\n')
         for func in self._get_type_functions:
             f.write('get-type:')
             f.write(func)
@@ -155,7 +272,10 @@ blob containing data gleaned from GObject's primitive introspection."""
             f.write(func)
             f.write('\n')
         f.close()
-        out_path = os.path.join(self._binary.tmpdir, 'dump.xml')
+        if binary_format:
+            out_path = os.path.join(self._binary.tmpdir, 'dump.bin')
+        else:
+            out_path = os.path.join(self._binary.tmpdir, 'dump.xml')
 
         args = []
         args.extend(self._binary.args)
@@ -163,15 +283,13 @@ blob containing data gleaned from GObject's primitive introspection."""
 
         # Invoke the binary, having written our get_type functions to types.txt
         try:
-            try:
-                subprocess.check_call(args, stdout=sys.stdout, stderr=sys.stderr)
-            except subprocess.CalledProcessError as e:
-                # Clean up temporaries
-                raise SystemExit(e)
-            return parse(out_path)
-        finally:
+            subprocess.check_call(args, stdout=sys.stdout, stderr=sys.stderr)
+        except subprocess.CalledProcessError as e:
+            # Clean up temporaries
             if not utils.have_debug_flag('save-temps'):
                 shutil.rmtree(self._binary.tmpdir)
+            raise SystemExit(e)
+        return out_path
 
     # Parser
 
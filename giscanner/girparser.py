@@ -20,10 +20,23 @@
 
 import os
 
-from xml.etree.cElementTree import parse
+from xml.etree.cElementTree import Element, fromstring, parse, tostring
 
 from . import ast
 from .girwriter import COMPATIBLE_GIR_VERSION
+from .libtoolimporter import LibtoolImporter
+
+# The C reader of GIR files, if available
+try:
+    with LibtoolImporter(None, None):
+        if 'UNINSTALLED_INTROSPECTION_SRCDIR' in os.environ:
+            import _giscanner
+        else:
+            from giscanner import _giscanner
+except ImportError:
+    _giscanner = None
+_read_gir = getattr(_giscanner, 'read_gir', None)
+_GirElement = getattr(_giscanner, 'GirElement', ())
 
 CORE_NS = "http://www.gtk.org/introspection/core/1.0"
 C_NS = "http://www.gtk.org/introspection/c/1.0"
@@ -42,10 +55,157 @@ def _cns(tag):
     return '{%s}%s' % (C_NS, tag)
 
 
+# Elements of which only the attributes are read when parsing types only
+_TYPES_ONLY_ATTRIBUTES = frozenset([_corens('bitfield'), _corens('class'),
+                                    _corens('enumeration'), _corens('interface'),
+                                    _corens('record'), _corens('union'),
+                                    _glibns('boxed')])
+
+# Documentation elements, which are not read when parsing types only
+_DOC_ELEMENTS = frozenset([_corens('doc'), _corens('doc-version'),
+                           _corens('doc-deprecated'), _corens('doc-stability')])
+
+# Elements the C reader leaves out when parsing types only
+_TYPES_ONLY_SKIPPED = _DOC_ELEMENTS | frozenset([_corens('constant'), _corens('function')])
+
+
+def _read_element(data, types_only=False):
+    """The root element of the GIR document data, read by the C reader;
+None when it is not available or cannot read the document, for
+ElementTree to be used instead. When types_only is set, what parsing
+types only does not read is left out."""
+    if _read_gir is None:
+        return None
+    try:
+        if types_only:
+            return _read_gir(data, _TYPES_ONLY_SKIPPED, _TYPES_ONLY_ATTRIBUTES)
+        return _read_gir(data)
+    except ValueError:
+        return None
+
+
+def _read_file_element(filename, types_only=False):
+    if _read_gir is None:
+        return None
+    f = open(filename, 'rb')
+    try:
+        data = f.read()
+    finally:
+        f.close()
+    return _read_element(data, types_only)
+
+
+class LazyNamespace(ast.Namespace):
+    """A namespace read from a GIR file, which only builds the node of
+a toplevel element when it is first looked up. Until then the element is
+kept as XML, and indexes map the names, C types, GType names and symbols
+it defines to it. This is what makes loading the includes of a scanner
+run cheap: most of what they define is never referenced.
+
+Nodes are found through get(), get_by_ctype(), get_by_gtype_name() and
+get_by_symbol() only, the tables they are tracked in are incomplete."""
+
+    def __init__(self, name, version, identifier_prefixes=None, symbol_prefixes=None,
+                 types_only=False):
+        ast.Namespace.__init__(self, name, version,
+                               identifier_prefixes=identifier_prefixes,
+                               symbol_prefixes=symbol_prefixes)
+        self._types_only = types_only
+        self._sources = []           # XML of each element, None once parsed
+        self._name_index = {}        # Maps from GIName -> element
+        self._ctype_index = {}       # Maps from CType -> element
+        self._gtype_name_index = {}  # Maps from GTName -> element
+        self._symbol_index = {}      # Maps from function symbols -> element
+
+    def add_source(self, source, parsed):
+        """Add the XML of an element, parsed stands for a namespace the
+element was parsed into on its own. Like in a namespace parsed at once,
+an element defining the same C type, GType name or symbol as an earlier
+one takes it over."""
+        index = len(self._sources)
+        self._sources.append(source)
+        for table, index_table in ((parsed.names, self._name_index),
+                                   (parsed.ctypes, self._ctype_index),
+                                   (parsed.type_names, self._gtype_name_index),
+                                   (parsed.symbols, self._symbol_index)):
+            for key in table:
+                index_table[key] = index
+
+    def _parse_source(self, index):
+        source = self._sources[index]
+        if source is None:
+            return
+        self._sources[index] = None
+
+        # Only keep the entries the indexes assign to this element, so
+        # that the order the elements are parsed in does not matter
+        tables = (self.ctypes, self.type_names, self.symbols)
+        self.ctypes, self.type_names, self.symbols = {}, {}, {}
+        try:
+            node = _read_element(source, self._types_only)
+            if node is None:
+                node = fromstring(source)
+            parser = GIRParser(types_only=self._types_only)
+            parser.parse_node(self, node)
+            for table, parsed, index_table in zip(tables,
+                                                  (self.ctypes, self.type_names, self.symbols),
+                                                  (self._ctype_index, self._gtype_name_index,
+                                                   self._symbol_index)):
+                for key, node in parsed.iteritems():
+                    if index_table.get(key) == index:
+                        table[key] = node
+        finally:
+            self.ctypes, self.type_names, self.symbols = tables
+
+    def _lookup(self, index_table, key):
+        index = index_table.get(key)
+        if index is not None:
+            self._parse_source(index)
+
+    def parse_all(self):
+        """Build the nodes of all of the elements not looked up yet; the
+namespace is then like one parsed at once."""
+        for index in xrange(len(self._sources)):
+            self._parse_source(index)
+        names = sorted(self.names.iteritems(),
+                       key=lambda item: self._name_index.get(item[0]))
+        self.names.clear()
+        self.names.update(names)
+
+    def __iter__(self):
+        self.parse_all()
+        return ast.Namespace.__iter__(self)
+
+    def iteritems(self):
+        self.parse_all()
+        return ast.Namespace.iteritems(self)
+
+    def itervalues(self):
+        self.parse_all()
+        return ast.Namespace.itervalues(self)
+
+    def get(self, name):
+        self._lookup(self._name_index, name)
+        return ast.Namespace.get(self, name)
+
+    def get_by_ctype(self, ctype):
+        self._lookup(self._ctype_index, ctype)
+        return ast.Namespace.get_by_ctype(self, ctype)
+
+    def get_by_gtype_name(self, gtype_name):
+        self._lookup(self._gtype_name_index, gtype_name)
+        return ast.Namespace.get_by_gtype_name(self, gtype_name)
+
+    def get_by_symbol(self, symbol):
+        self._lookup(self._symbol_index, symbol)
+        return ast.Namespace.get_by_symbol(self, symbol)
+
+
 class GIRParser(object):
 
-    def __init__(self, types_only=False):
+    def __init__(self, types_only=False, lazy=False):
         self._types_only = types_only
+        self._lazy = lazy
         self._namespace = None
         self._filename_stack = []
 
@@ -54,23 +214,35 @@ class GIRParser(object):
     def parse(self, filename):
         filename = os.path.abspath(filename)
         self._filename_stack.append(filename)
-        tree = parse(filename)
-        self.parse_tree(tree)
+        root = _read_file_element(filename, self._types_only and self._lazy)
+        if root is None:
+            root = parse(filename).getroot()
+        self._parse_root(root)
         self._filename_stack.pop()
 
     def parse_tree(self, tree):
-        self._namespace = None
-        self._pkgconfig_packages = set()
-        self._includes = set()
-        self._c_includes = set()
-        self._c_prefix = None
-        self._parse_api(tree.getroot())
+        self._parse_root(tree.getroot())
 
     def get_namespace(self):
         return self._namespace
 
+    def parse_node(self, namespace, node):
+        """Parse a toplevel element of a GIR namespace into namespace."""
+        self._namespace = namespace
+        method = self._get_parser_methods().get(node.tag)
+        if method is not None:
+            method(node)
+
     # Private
 
+    def _parse_root(self, root):
+        self._namespace = None
+        self._pkgconfig_packages = set()
+        self._includes = set()
+        self._c_includes = set()
+        self._c_prefix = None
+        self._parse_api(root)
+
     def _find_first_child(self, node, name_or_names):
         if isinstance(name_or_names, str):
             for child in node.getchildren():
@@ -117,16 +289,34 @@ class GIRParser(object):
         symbol_prefixes = ns.attrib.get(_cns('symbol-prefixes'))
         if symbol_prefixes:
             symbol_prefixes = symbol_prefixes.split(',')
-        self._namespace = ast.Namespace(ns.attrib['name'],
-                                        ns.attrib['version'],
-                                        identifier_prefixes=identifier_prefixes,
-                                        symbol_prefixes=symbol_prefixes)
+        if self._lazy:
+            self._namespace = LazyNamespace(ns.attrib['name'],
+                                            ns.attrib['version'],
+                                            identifier_prefixes=identifier_prefixes,
+                                            symbol_prefixes=symbol_prefixes,
+                                            types_only=self._types_only)
+        else:
+            self._namespace = ast.Namespace(ns.attrib['name'],
+                                            ns.attrib['version'],
+                                            identifier_prefixes=identifier_prefixes,
+                                            symbol_prefixes=symbol_prefixes)
         if 'shared-library' in ns.attrib:
             self._namespace.shared_libraries = ns.attrib['shared-library'].split(',')
         self._namespace.includes = self._includes
         self._namespace.c_includes = self._c_includes
         self._namespace.exported_packages = self._pkgconfig_packages
 
+        parser_methods = self._get_parser_methods()
+        for node in ns.getchildren():
+            method = parser_methods.get(node.tag)
+            if method is None:
+                continue
+            if self._lazy:
+                self._index_node(node, method)
+            else:
+                method(node)
+
+    def _get_parser_methods(self):
         parser_methods = {
             _corens('alias'): self._parse_alias,
             _corens('bitfield'): self._parse_enumeration_bitfield,
@@ -141,11 +331,39 @@ class GIRParser(object):
         if not self._types_only:
             parser_methods[_corens('constant')] = self._parse_constant
             parser_methods[_corens('function')] = self._parse_function
-
-        for node in ns.getchildren():
-            method = parser_methods.get(node.tag)
-            if method is not None:
-                method(node)
+        return parser_methods
+
+    def _index_node(self, node, method):
+        # Parse the element into a namespace of its own, to find out
+        # what it defines, and keep it as XML for LazyNamespace
+        namespace = self._namespace
+        self._namespace = ast.Namespace(namespace.name, namespace.version,
+                                        identifier_prefixes=namespace.identifier_prefixes,
+                                        symbol_prefixes=namespace.symbol_prefixes)
+        try:
+            method(node)
+            if isinstance(node, _GirElement):
+                # The C reader already left out what parsing types
+                # only does not read
+                source = node.tostring()
+            else:
+                if self._types_only:
+                    node = self._strip_types_only_node(node)
+                source = tostring(node)
+            namespace.add_source(source, self._namespace)
+        finally:
+            self._namespace = namespace
+
+    def _strip_types_only_node(self, node):
+        # Drop what parsing types only does not read, to keep the XML
+        # LazyNamespace stores small
+        if node.tag in _TYPES_ONLY_ATTRIBUTES:
+            return Element(node.tag, node.attrib)
+        for parent in node.getiterator():
+            for child in parent.getchildren():
+                if child.tag in _DOC_ELEMENTS:
+                    parent.remove(child)
+        return node
 
     def _parse_include(self, node):
         include = ast.Include(node.attrib['name'], node.attrib['version'])
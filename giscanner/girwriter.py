@@ -31,8 +31,8 @@ COMPATIBLE_GIR_VERSION = '1.2'
 
 class GIRWriter(XMLWriter):
 
-    def __init__(self, namespace):
-        super(GIRWriter, self).__init__()
+    def __init__(self, namespace, output=None):
+        super(GIRWriter, self).__init__(output)
         self.write_comment(
             'This file was automatically generated from C sources - DO NOT EDIT!\n'
             'To affect the contents of this file, edit the original C definitions,\n'
@@ -23,7 +23,9 @@
 #  include "config.h"
 #endif
 #include <Python.h>
+#include <structmember.h>
 #include "sourcescanner.h"
+#include "girtokenizer.h"
 
 #ifdef G_OS_WIN32
 #define USE_WINDOWS
@@ -87,7 +89,7 @@ typedef struct {
 
 NEW_CLASS (PyGISourceSymbol, "SourceSymbol", GISourceSymbol, 10);
 NEW_CLASS (PyGISourceType, "SourceType", GISourceType, 9);
-NEW_CLASS (PyGISourceScanner, "SourceScanner", GISourceScanner, 8);
+NEW_CLASS (PyGISourceScanner, "SourceScanner", GISourceScanner, 9);
 
 
 /* Symbol */
@@ -350,6 +352,266 @@ static const PyGetSetDef _PyGISourceType_getsets[] = {
 
 
 
+/* Symbol export
+ *
+ * Converts symbols and their types into instances of the SourceSymbol
+ * and SourceType classes of sourcescanner.py in one go, rather than
+ * through a wrapper per object and a getter call per attribute.  The
+ * classes are tuple subclasses, the items of which are filled in here
+ * directly.  What is exported only references strings, numbers and
+ * other exported tuples and cannot be part of a reference cycle: it is
+ * left out of the garbage collection, which would otherwise spend most
+ * of the time of an export going over the tuples exported so far.
+ */
+
+/* Must be kept in sync with the fields of SourceSymbol in sourcescanner.py */
+enum {
+  EXPORT_SYMBOL_TYPE,
+  EXPORT_SYMBOL_IDENT,
+  EXPORT_SYMBOL_BASE_TYPE,
+  EXPORT_SYMBOL_CONST_INT,
+  EXPORT_SYMBOL_CONST_DOUBLE,
+  EXPORT_SYMBOL_CONST_STRING,
+  EXPORT_SYMBOL_CONST_BOOLEAN,
+  EXPORT_SYMBOL_SOURCE_FILENAME,
+  EXPORT_SYMBOL_LINE,
+  EXPORT_SYMBOL_PRIVATE,
+  N_EXPORT_SYMBOL_FIELDS
+};
+
+/* Must be kept in sync with the fields of SourceType in sourcescanner.py */
+enum {
+  EXPORT_TYPE_TYPE,
+  EXPORT_TYPE_STORAGE_CLASS_SPECIFIER,
+  EXPORT_TYPE_TYPE_QUALIFIER,
+  EXPORT_TYPE_FUNCTION_SPECIFIER,
+  EXPORT_TYPE_NAME,
+  EXPORT_TYPE_BASE_TYPE,
+  EXPORT_TYPE_CHILD_LIST,
+  EXPORT_TYPE_IS_BITFIELD,
+  N_EXPORT_TYPE_FIELDS
+};
+
+typedef struct {
+  PyTypeObject *symbol_class;
+  PyTypeObject *type_class;
+  /* Symbols referenced more than once, like the members of enumerations
+   * which are constants of their own, are exported once */
+  GHashTable *symbols;
+  /* Type names and file names repeat a lot, they are shared */
+  GHashTable *strings;
+} SymbolExporter;
+
+static PyObject * export_symbol (SymbolExporter *exporter,
+				 GISourceSymbol *symbol);
+
+static PyObject *
+export_string (SymbolExporter *exporter,
+	       const char     *s)
+{
+  PyObject *result;
+
+  if (s == NULL)
+    Py_RETURN_NONE;
+
+  result = g_hash_table_lookup (exporter->strings, s);
+  if (result == NULL)
+    {
+      result = PyString_FromString (s);
+      if (result == NULL)
+	return NULL;
+      g_hash_table_insert (exporter->strings, (gpointer) s, result);
+    }
+
+  Py_INCREF (result);
+  return result;
+}
+
+static PyObject *
+export_type (SymbolExporter *exporter,
+	     GISourceType   *type)
+{
+  PyObject *result, *children;
+  Py_ssize_t n_children = 0;
+  GList *l;
+
+  if (type == NULL)
+    Py_RETURN_NONE;
+
+  result = exporter->type_class->tp_alloc (exporter->type_class, N_EXPORT_TYPE_FIELDS);
+  if (result == NULL)
+    return NULL;
+
+  PyTuple_SET_ITEM (result, EXPORT_TYPE_TYPE, PyInt_FromLong (type->type));
+  PyTuple_SET_ITEM (result, EXPORT_TYPE_STORAGE_CLASS_SPECIFIER,
+		    PyInt_FromLong (type->storage_class_specifier));
+  PyTuple_SET_ITEM (result, EXPORT_TYPE_TYPE_QUALIFIER,
+		    PyInt_FromLong (type->type_qualifier));
+  PyTuple_SET_ITEM (result, EXPORT_TYPE_FUNCTION_SPECIFIER,
+		    PyInt_FromLong (type->function_specifier));
+  PyTuple_SET_ITEM (result, EXPORT_TYPE_NAME, export_string (exporter, type->name));
+  PyTuple_SET_ITEM (result, EXPORT_TYPE_BASE_TYPE, export_type (exporter, type->base_type));
+  PyTuple_SET_ITEM (result, EXPORT_TYPE_IS_BITFIELD, PyInt_FromLong (type->is_bitfield));
+
+  /* Like the child_list getter of SourceType used to, leave out the
+   * NULL symbols */
+  for (l = type->child_list; l; l = l->next)
+    if (l->data != NULL)
+      n_children++;
+
+  children = PyTuple_New (n_children);
+  PyTuple_SET_ITEM (result, EXPORT_TYPE_CHILD_LIST, children);
+  if (PyErr_Occurred ())
+    goto error;
+
+  n_children = 0;
+  for (l = type->child_list; l; l = l->next)
+    {
+      PyObject *child;
+
+      if (l->data == NULL)
+	continue;
+      child = export_symbol (exporter, l->data);
+      if (child == NULL)
+	goto error;
+      PyTuple_SET_ITEM (children, n_children++, child);
+    }
+
+  PyObject_GC_UnTrack (children);
+  PyObject_GC_UnTrack (result);
+  return result;
+
+ error:
+  Py_DECREF (result);
+  return NULL;
+}
+
+static PyObject *
+export_symbol (SymbolExporter *exporter,
+	       GISourceSymbol *symbol)
+{
+  PyObject *result, *const_int, *const_double, *const_boolean;
+
+  result = g_hash_table_lookup (exporter->symbols, symbol);
+  if (result != NULL)
+    {
+      Py_INCREF (result);
+      return result;
+    }
+
+  result = exporter->symbol_class->tp_alloc (exporter->symbol_class,
+					     N_EXPORT_SYMBOL_FIELDS);
+  if (result == NULL)
+    return NULL;
+
+  if (!symbol->const_int_set)
+    {
+      const_int = Py_None;
+      Py_INCREF (const_int);
+    }
+  else if (symbol->const_int_is_unsigned)
+    const_int = PyLong_FromUnsignedLongLong ((unsigned long long)symbol->const_int);
+  else
+    const_int = PyLong_FromLongLong ((long long)symbol->const_int);
+
+  if (symbol->const_double_set)
+    const_double = PyFloat_FromDouble (symbol->const_double);
+  else
+    {
+      const_double = Py_None;
+      Py_INCREF (const_double);
+    }
+
+  if (symbol->const_boolean_set)
+    const_boolean = PyBool_FromLong (symbol->const_boolean);
+  else
+    {
+      const_boolean = Py_None;
+      Py_INCREF (const_boolean);
+    }
+
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_TYPE, PyInt_FromLong (symbol->type));
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_IDENT, export_string (exporter, symbol->ident));
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_CONST_INT, const_int);
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_CONST_DOUBLE, const_double);
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_CONST_STRING,
+		    export_string (exporter, symbol->const_string));
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_CONST_BOOLEAN, const_boolean);
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_SOURCE_FILENAME,
+		    export_string (exporter, symbol->source_filename));
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_LINE, PyInt_FromLong (symbol->line));
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_PRIVATE, PyBool_FromLong (symbol->private));
+  PyTuple_SET_ITEM (result, EXPORT_SYMBOL_BASE_TYPE,
+		    export_type (exporter, symbol->base_type));
+
+  if (PyErr_Occurred ())
+    {
+      Py_DECREF (result);
+      return NULL;
+    }
+
+  PyObject_GC_UnTrack (result);
+  if (symbol->ref_count > 1)
+    {
+      Py_INCREF (result);
+      g_hash_table_insert (exporter->symbols, symbol, result);
+    }
+  return result;
+}
+
+static PyObject *
+pygi_source_scanner_export_symbols (PyGISourceScanner *self,
+				    PyObject          *args)
+{
+  SymbolExporter exporter;
+  GSList *l, *symbols;
+  PyObject *list;
+  int i = 0;
+
+  if (!PyArg_ParseTuple (args, "O!O!:SourceScanner.export_symbols",
+			 &PyType_Type, &exporter.symbol_class,
+			 &PyType_Type, &exporter.type_class))
+    return NULL;
+
+  if (!PyType_IsSubtype (exporter.symbol_class, &PyTuple_Type) ||
+      !PyType_IsSubtype (exporter.type_class, &PyTuple_Type))
+    {
+      PyErr_SetString (PyExc_TypeError, "the classes must be tuple subclasses");
+      return NULL;
+    }
+
+  symbols = gi_source_scanner_get_symbols (self->scanner);
+  list = PyList_New (g_slist_length (symbols));
+  if (list == NULL)
+    {
+      g_slist_free (symbols);
+      return NULL;
+    }
+
+  exporter.symbols = g_hash_table_new_full (NULL, NULL, NULL,
+					    (GDestroyNotify) Py_DecRef);
+  exporter.strings = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+					    (GDestroyNotify) Py_DecRef);
+
+  for (l = symbols; l; l = l->next)
+    {
+      PyObject *item = export_symbol (&exporter, l->data);
+      if (item == NULL)
+	{
+	  Py_CLEAR (list);
+	  break;
+	}
+      PyList_SET_ITEM (list, i++, item);
+    }
+
+  g_hash_table_destroy (exporter.symbols);
+  g_hash_table_destroy (exporter.strings);
+  g_slist_free (symbols);
+  return list;
+}
+
+
+
 /* Scanner */
 
 static int
@@ -531,14 +793,15 @@ pygi_source_scanner_lex_filename (PyGISourceScanner *self,
   if (!PyArg_ParseTuple (args, "s:SourceScanner.lex_filename", &filename))
     return NULL;
 
-  self->scanner->current_file = g_file_new_for_path (filename);
+  file = g_file_new_for_path (filename);
+  g_hash_table_add (self->scanner->files, file);
+  gi_source_scanner_take_current_file (self->scanner,
+                                       g_file_new_for_path (filename));
   if (!gi_source_scanner_lex_filename (self->scanner, filename))
     {
       g_print ("Something went wrong during lexing.\n");
       return NULL;
     }
-  file = g_file_new_for_path (filename);
-  g_hash_table_add (self->scanner->files, file);
 
   Py_INCREF (Py_None);
   return Py_None;
@@ -607,6 +870,7 @@ pygi_source_scanner_get_comments (PyGISourceScanner *self)
 static const PyMethodDef _PyGISourceScanner_methods[] = {
   { "get_comments", (PyCFunction) pygi_source_scanner_get_comments, METH_NOARGS },
   { "get_symbols", (PyCFunction) pygi_source_scanner_get_symbols, METH_NOARGS },
+  { "export_symbols", (PyCFunction) pygi_source_scanner_export_symbols, METH_VARARGS },
   { "append_filename", (PyCFunction) pygi_source_scanner_append_filename, METH_VARARGS },
   { "parse_file", (PyCFunction) pygi_source_scanner_parse_file, METH_VARARGS },
   { "parse_macros", (PyCFunction) pygi_source_scanner_parse_macros, METH_VARARGS },
@@ -616,52 +880,6 @@ static const PyMethodDef _PyGISourceScanner_methods[] = {
 };
 
 
-static int calc_attrs_length(PyObject *attributes, int indent,
-			     int self_indent)
-{
-  int attr_length = 0;
-  int i;
-
-  if (indent == -1)
-    return -1;
-
-  for (i = 0; i < PyList_Size (attributes); ++i)
-    {
-      PyObject *tuple, *pyvalue;
-      PyObject *s = NULL;
-      char *attr, *value;
-      char *escaped;
-
-      tuple = PyList_GetItem (attributes, i);
-      if (PyTuple_GetItem(tuple, 1) == Py_None)
-	continue;
-
-      if (!PyArg_ParseTuple(tuple, "sO", &attr, &pyvalue))
-        return -1;
-
-      if (PyUnicode_Check(pyvalue)) {
-        s = PyUnicode_AsUTF8String(pyvalue);
-        if (!s) {
-          return -1;
-        }
-        value = PyString_AsString(s);
-      } else if (PyString_Check(pyvalue)) {
-        value = PyString_AsString(pyvalue);
-      } else {
-        PyErr_SetString(PyExc_TypeError,
-                        "value must be string or unicode");
-        return -1;
-      }
-
-      escaped = g_markup_escape_text (value, -1);
-      attr_length += 2 + strlen(attr) + strlen(escaped) + 2;
-      g_free(escaped);
-      Py_XDECREF(s);
-    }
-
-  return attr_length + indent + self_indent;
-}
-
 /* Hall of shame, wasted time debugging the code below
  * 20min - Johan 2009-02-19
  */
@@ -675,7 +893,9 @@ pygi_collect_attributes (PyObject *self,
   char *indent_char;
   gboolean first;
   GString *attr_value = NULL;
-  int len;
+  int n_attributes, len;
+  char **names = NULL;
+  char **escaped = NULL;
   PyObject *result = NULL;
 
   if (!PyArg_ParseTuple(args, "sO!isi",
@@ -684,27 +904,24 @@ pygi_collect_attributes (PyObject *self,
 			&indent))
     return NULL;
 
-  if (attributes == Py_None || !PyList_Size(attributes))
-    return PyUnicode_DecodeUTF8("", 0, "strict");
-
-  len = calc_attrs_length(attributes, indent, self_indent);
-  if (len < 0)
-    return NULL;
-  if (len > 79)
-    indent_len = self_indent + strlen(tag_name) + 1;
-  else
-    indent_len = 0;
+  n_attributes = PyList_GET_SIZE (attributes);
+  if (!n_attributes)
+    return PyString_FromStringAndSize ("", 0);
 
-  first = TRUE;
-  attr_value = g_string_new ("");
+  /* Escape each value once, measuring the line as we go; the values
+   * are needed again to decide where to break it.
+   */
+  names = g_new0 (char *, n_attributes);
+  escaped = g_new0 (char *, n_attributes);
+  len = indent + self_indent;
 
-  for (i = 0; i < PyList_Size (attributes); ++i)
+  for (i = 0; i < n_attributes; ++i)
     {
       PyObject *tuple, *pyvalue;
       PyObject *s = NULL;
-      char *attr, *value, *escaped;
+      char *value;
 
-      tuple = PyList_GetItem (attributes, i);
+      tuple = PyList_GET_ITEM (attributes, i);
 
       if (!PyTuple_Check (tuple))
         {
@@ -713,33 +930,51 @@ pygi_collect_attributes (PyObject *self,
 	  goto out;
         }
 
-      if (PyTuple_Size (tuple) != 2)
+      if (PyTuple_GET_SIZE (tuple) != 2)
         {
           PyErr_SetString(PyExc_IndexError,
                           "attribute item must be a tuple of length 2");
 	  goto out;
         }
 
-      if (PyTuple_GetItem(tuple, 1) == Py_None)
+      if (PyTuple_GET_ITEM (tuple, 1) == Py_None)
 	continue;
 
-      /* this leaks, but we exit after, so */
-      if (!PyArg_ParseTuple(tuple, "sO", &attr, &pyvalue))
+      /* The name points into the tuple, which the list keeps alive */
+      if (!PyArg_ParseTuple(tuple, "sO", &names[i], &pyvalue))
 	goto out;
 
       if (PyUnicode_Check(pyvalue)) {
         s = PyUnicode_AsUTF8String(pyvalue);
         if (!s)
 	  goto out;
-        value = PyString_AsString(s);
+        value = PyString_AS_STRING(s);
       } else if (PyString_Check(pyvalue)) {
-        value = PyString_AsString(pyvalue);
+        value = PyString_AS_STRING(pyvalue);
       } else {
         PyErr_SetString(PyExc_TypeError,
                         "value must be string or unicode");
 	goto out;
       }
 
+      escaped[i] = g_markup_escape_text (value, -1);
+      len += 2 + strlen(names[i]) + strlen(escaped[i]) + 2;
+      Py_XDECREF(s);
+    }
+
+  if (len > 79)
+    indent_len = self_indent + strlen(tag_name) + 1;
+  else
+    indent_len = 0;
+
+  first = TRUE;
+  attr_value = g_string_sized_new (len);
+
+  for (i = 0; i < n_attributes; ++i)
+    {
+      if (escaped[i] == NULL)
+	continue;
+
       if (indent_len && !first)
 	{
 	  g_string_append_c (attr_value, '\n');
@@ -747,54 +982,1510 @@ pygi_collect_attributes (PyObject *self,
 	    g_string_append_c (attr_value, ' ');
 	}
       g_string_append_c (attr_value, ' ');
-      g_string_append (attr_value, attr);
+      g_string_append (attr_value, names[i]);
       g_string_append_c (attr_value, '=');
       g_string_append_c (attr_value, '\"');
-      escaped = g_markup_escape_text (value, -1);
-      g_string_append (attr_value, escaped);
+      g_string_append (attr_value, escaped[i]);
       g_string_append_c (attr_value, '\"');
       if (first)
 	first = FALSE;
-      Py_XDECREF(s);
   }
 
-  result = PyUnicode_DecodeUTF8 (attr_value->str, attr_value->len, "strict");
+  /* UTF-8, ready to be written out */
+  result = PyString_FromStringAndSize (attr_value->str, attr_value->len);
  out:
   if (attr_value != NULL)
     g_string_free (attr_value, TRUE);
+  for (i = 0; i < n_attributes; ++i)
+    g_free (escaped[i]);
+  g_free (escaped);
+  g_free (names);
   return result;
 }
 
-/* Module */
+/* Escapes character data the way xml.sax.saxutils.escape() does, but
+ * on UTF-8 and without going through unicode.  Returns the escaped
+ * UTF-8 string together with its length in characters, which is what
+ * the line breaking in collect_attributes() is based on.
+ */
+static PyObject *
+pygi_escape_xml_text (PyObject *self,
+		      PyObject *args)
+{
+  PyObject *text;
+  PyObject *s;
+  PyObject *result = NULL;
+  const char *src;
+  char *dest;
+  Py_ssize_t i, len, extra, n_chars;
 
-static const PyMethodDef pyscanner_functions[] = {
-  { "collect_attributes",
-    (PyCFunction) pygi_collect_attributes, METH_VARARGS },
-  { NULL, NULL, 0, NULL }
+  if (!PyArg_ParseTuple(args, "O", &text))
+    return NULL;
+
+  if (PyUnicode_Check(text))
+    {
+      s = PyUnicode_AsUTF8String(text);
+      if (!s)
+	return NULL;
+    }
+  else if (PyString_Check(text))
+    {
+      s = text;
+      Py_INCREF(s);
+      if (!g_utf8_validate (PyString_AS_STRING(s), PyString_GET_SIZE(s), NULL))
+	{
+	  /* Let Python raise the error, or accept embedded nuls */
+	  PyObject *u = PyUnicode_DecodeUTF8 (PyString_AS_STRING(s),
+					      PyString_GET_SIZE(s),
+					      "strict");
+	  if (!u)
+	    goto out;
+	  Py_DECREF(u);
+	}
+    }
+  else
+    {
+      PyErr_SetString(PyExc_TypeError,
+		      "text must be string or unicode");
+      return NULL;
+    }
+
+  src = PyString_AS_STRING(s);
+  len = PyString_GET_SIZE(s);
+  extra = 0;
+  n_chars = 0;
+
+  for (i = 0; i < len; i++)
+    {
+      switch (src[i])
+	{
+	case '&':
+	  extra += 4;
+	  break;
+	case '<':
+	case '>':
+	  extra += 3;
+	  break;
+	}
+      if ((src[i] & 0xc0) != 0x80)
+	n_chars++;
+    }
+
+  if (extra == 0)
+    {
+      result = Py_BuildValue("(On)", s, n_chars);
+      goto out;
+    }
+
+  result = PyString_FromStringAndSize(NULL, len + extra);
+  if (!result)
+    goto out;
+
+  dest = PyString_AS_STRING(result);
+  for (i = 0; i < len; i++)
+    {
+      switch (src[i])
+	{
+	case '&':
+	  memcpy (dest, "&amp;", 5);
+	  dest += 5;
+	  break;
+	case '<':
+	  memcpy (dest, "&lt;", 4);
+	  dest += 4;
+	  break;
+	case '>':
+	  memcpy (dest, "&gt;", 4);
+	  dest += 4;
+	  break;
+	default:
+	  *dest++ = src[i];
+	}
+    }
+
+  result = Py_BuildValue("(Nn)", result, n_chars + extra);
+ out:
+  Py_DECREF(s);
+  return result;
+}
+
+/* GTK-Doc comment lines
+ *
+ * A single pass equivalent of the regular expressions applied to each
+ * line of a comment block by annotationparser.py, see
+ * tokenize_comment_line() there for the meaning of the returned tuple.
+ */
+
+/* Must be kept in sync with the TOKEN_* constants in annotationparser.py */
+enum {
+  COMMENT_TOKEN_TEXT,
+  COMMENT_TOKEN_EMPTY,
+  COMMENT_TOKEN_SECTION,
+  COMMENT_TOKEN_PROPERTY,
+  COMMENT_TOKEN_SIGNAL,
+  COMMENT_TOKEN_SYMBOL,
+  COMMENT_TOKEN_PARAMETER,
+  COMMENT_TOKEN_TAG
 };
 
-DL_EXPORT(void)
-init_giscanner(void)
+/* Must be kept in sync with ALL_TAGS in annotationparser.py, as the
+ * first tag followed by a colon wins. A space matches any whitespace.
+ */
+static const char *comment_tags[] = {
+  "deprecated", "returns", "since", "stability",
+  "description", "return value",
+  "return", "returns value",
+  "attributes", "get value func", "ref func", "rename to",
+  "set value func", "transfer", "type", "unref func", "value", "virtual",
+  NULL
+};
+
+/* What \s and \w match in the regular expressions, for ASCII characters */
+#define COMMENT_IS_SPACE(c) (((c) >= '\t' && (c) <= '\r') || ((c) >= '\x1c' && (c) <= ' '))
+#define COMMENT_IS_WORD(c) (g_ascii_isalnum (c) || (c) == '_')
+
+static Py_ssize_t
+comment_skip_space (const char *s,
+		    Py_ssize_t  i,
+		    Py_ssize_t  len)
 {
-    PyObject *m, *d;
-    gboolean is_uninstalled;
+  while (i < len && COMMENT_IS_SPACE (s[i]))
+    i++;
+  return i;
+}
 
-    /* Hack to avoid having to create a fake directory structure; when
-     * running uninstalled, the module will be in the top builddir,
-     * with no _giscanner prefix.
-     */
-    is_uninstalled = g_getenv ("UNINSTALLED_INTROSPECTION_SRCDIR") != NULL;
-    m = Py_InitModule (is_uninstalled ? "_giscanner" : "giscanner._giscanner",
-		       (PyMethodDef*)pyscanner_functions);
-    d = PyModule_GetDict (m);
+static Py_ssize_t
+comment_rstrip_space (const char *s,
+		      Py_ssize_t  start,
+		      Py_ssize_t  end)
+{
+  while (end > start && COMMENT_IS_SPACE (s[end - 1]))
+    end--;
+  return end;
+}
 
-    PyGISourceScanner_Type.tp_init = (initproc)pygi_source_scanner_init;
-    PyGISourceScanner_Type.tp_methods = (PyMethodDef*)_PyGISourceScanner_methods;
-    REGISTER_TYPE (d, "SourceScanner", PyGISourceScanner_Type);
+/* End of a [\w-]*\w name starting at @i, or -1 */
+static Py_ssize_t
+comment_name_end (const char *s,
+		  Py_ssize_t  i,
+		  Py_ssize_t  len)
+{
+  Py_ssize_t end = -1;
 
-    PyGISourceSymbol_Type.tp_getset = (PyGetSetDef*)_PyGISourceSymbol_getsets;
-    REGISTER_TYPE (d, "SourceSymbol", PyGISourceSymbol_Type);
+  for (; i < len && (COMMENT_IS_WORD (s[i]) || s[i] == '-'); i++)
+    if (COMMENT_IS_WORD (s[i]))
+      end = i + 1;
+  return end;
+}
 
-    PyGISourceType_Type.tp_getset = (PyGetSetDef*)_PyGISourceType_getsets;
-    REGISTER_TYPE (d, "SourceType", PyGISourceType_Type);
+/* End of the (?P<fields>.*?)\s*:?\s*$ group of the identifiers */
+static Py_ssize_t
+comment_fields_end (const char *s,
+		    Py_ssize_t  start,
+		    Py_ssize_t  len)
+{
+  Py_ssize_t end = comment_rstrip_space (s, start, len);
+
+  if (end > start && s[end - 1] == ':')
+    end = comment_rstrip_space (s, start, end - 1);
+  return end;
+}
+
+/* Whether s[start:end] matches \w\S+ */
+static gboolean
+comment_is_section_name (const char *s,
+			 Py_ssize_t  start,
+			 Py_ssize_t  end)
+{
+  Py_ssize_t i;
+
+  if (end - start < 2 || !COMMENT_IS_WORD (s[start]))
+    return FALSE;
+  for (i = start; i < end; i++)
+    if (COMMENT_IS_SPACE (s[i]))
+      return FALSE;
+  return TRUE;
+}
+
+static PyObject *
+comment_substring (const char *s,
+		   Py_ssize_t  start,
+		   Py_ssize_t  end)
+{
+  if (start < 0)
+    Py_RETURN_NONE;
+  return PyString_FromStringAndSize (s + start, end - start);
+}
+
+static PyObject *
+comment_offset (Py_ssize_t offset)
+{
+  if (offset < 0)
+    Py_RETURN_NONE;
+  return PyInt_FromSsize_t (offset);
+}
+
+static PyObject *
+pygi_tokenize_comment_line (PyObject *self,
+			    PyObject *args)
+{
+  PyObject *py_line, *name = NULL;
+  int identifier;
+  const char *s, *l;
+  Py_ssize_t len, n, i, j, k, lead;
+  Py_ssize_t indent_end, column_offset = 0;
+  Py_ssize_t comment_start = -1, comment_end = -1;
+  Py_ssize_t name_start = -1, name_end = -1;
+  Py_ssize_t delimiter_start = -1, delimiter_end = -1;
+  Py_ssize_t fields_start = -1, fields_end = -1;
+  long line_indent = 0;
+  int token = COMMENT_TOKEN_TEXT;
+
+  if (!PyArg_ParseTuple (args, "Oi:tokenize_comment_line", &py_line, &identifier))
+    return NULL;
+
+  /* Leave the rest to the regular expressions, which classify non-ASCII
+   * characters using the Unicode database.
+   */
+  if (!PyString_Check (py_line))
+    Py_RETURN_NONE;
+
+  s = PyString_AS_STRING (py_line);
+  len = PyString_GET_SIZE (py_line);
+  for (i = 0; i < len; i++)
+    if ((guchar) s[i] >= 0x80 || s[i] == '\n')
+      Py_RETURN_NONE;
+
+  /* INDENTATION_RE and COMMENT_ASTERISK_RE */
+  indent_end = comment_skip_space (s, 0, len);
+  for (i = indent_end; i < len && s[i] != '*'; i++)
+    ;
+  if (i < len)
+    {
+      comment_start = indent_end;
+      comment_end = comment_rstrip_space (s, indent_end, i);
+      column_offset = i + 1;
+      if (column_offset < len && COMMENT_IS_SPACE (s[column_offset]))
+        column_offset++;
+    }
+
+  l = s + column_offset;
+  n = len - column_offset;
+  lead = comment_skip_space (l, 0, n);
+  for (i = 0; i < lead; i++)
+    line_indent += l[i] == '\t' ? 2 : 1;
+
+  if (identifier)
+    {
+      /* SECTION_RE */
+      if (n - lead >= 7 && memcmp (l + lead, "SECTION", 7) == 0)
+        {
+          i = comment_skip_space (l, lead + 7, n);
+          if (i < n && l[i] == ':')
+            i = comment_skip_space (l, i + 1, n);
+          j = comment_rstrip_space (l, i, n);
+          k = j > i && l[j - 1] == ':' ? comment_rstrip_space (l, i, j - 1) : j;
+          if (!comment_is_section_name (l, i, k))
+            k = j;
+          if (comment_is_section_name (l, i, k))
+            {
+              token = COMMENT_TOKEN_SECTION;
+              name = PyString_FromString ("SECTION:");
+              PyString_ConcatAndDel (&name, PyString_FromStringAndSize (l + i, k - i));
+            }
+        }
+
+      /* PROPERTY_RE and SIGNAL_RE */
+      if (token == COMMENT_TOKEN_TEXT)
+        {
+          for (i = lead; i < n && COMMENT_IS_WORD (l[i]); i++)
+            ;
+          j = comment_skip_space (l, i, n);
+          if (i > lead && j < n && l[j] == ':')
+            {
+              k = comment_skip_space (l, j + 1, n);
+              name_end = comment_name_end (l, k, n);
+              if (name_end >= 0)
+                token = COMMENT_TOKEN_PROPERTY;
+              else if (j + 1 < n && l[j + 1] == ':')
+                {
+                  k = comment_skip_space (l, j + 2, n);
+                  name_end = comment_name_end (l, k, n);
+                  if (name_end >= 0)
+                    token = COMMENT_TOKEN_SIGNAL;
+                }
+              if (token != COMMENT_TOKEN_TEXT)
+                {
+                  name = PyString_FromStringAndSize (l + lead, i - lead);
+                  PyString_ConcatAndDel (&name, PyString_FromString (token == COMMENT_TOKEN_SIGNAL ? "::" : ":"));
+                  PyString_ConcatAndDel (&name, PyString_FromStringAndSize (l + k, name_end - k));
+                }
+            }
+        }
+
+      /* SYMBOL_RE */
+      if (token == COMMENT_TOKEN_TEXT)
+        {
+          name_end = comment_name_end (l, lead, n);
+          if (name_end >= 0)
+            {
+              token = COMMENT_TOKEN_SYMBOL;
+              name = PyString_FromStringAndSize (l + lead, name_end - lead);
+            }
+        }
+
+      if (token != COMMENT_TOKEN_TEXT && token != COMMENT_TOKEN_SECTION)
+        {
+          delimiter_start = comment_skip_space (l, name_end, n);
+          delimiter_end = delimiter_start;
+          if (delimiter_end < n && l[delimiter_end] == ':')
+            delimiter_end++;
+          fields_start = comment_skip_space (l, delimiter_end, n);
+          fields_end = comment_fields_end (l, fields_start, n);
+        }
+    }
+  else if (lead < n && l[lead] == '@')
+    {
+      /* PARAMETER_RE, either a name or anything ending with "..." */
+      name_start = lead + 1;
+      for (i = name_start; i < n && (COMMENT_IS_WORD (l[i]) || l[i] == '-'); i++)
+        ;
+      j = comment_skip_space (l, i, n);
+      if (!(i > name_start && COMMENT_IS_WORD (l[i - 1]) && j < n && l[j] == ':'))
+        {
+          for (i = name_start + 3; i <= n; i++)
+            {
+              if (memcmp (l + i - 3, "...", 3) != 0)
+                continue;
+              j = comment_skip_space (l, i, n);
+              if (j < n && l[j] == ':')
+                break;
+            }
+        }
+      if (i <= n && j < n && l[j] == ':')
+        {
+          token = COMMENT_TOKEN_PARAMETER;
+          name = PyString_FromStringAndSize (l + name_start, i - name_start);
+          fields_start = comment_skip_space (l, j + 1, n);
+          fields_end = comment_rstrip_space (l, fields_start, n);
+        }
+      else
+        name_start = -1;
+    }
+  else if (lead == n)
+    {
+      /* EMPTY_LINE_RE */
+      token = COMMENT_TOKEN_EMPTY;
+    }
+  else
+    {
+      /* TAG_RE */
+      const char **tag;
+
+      for (tag = comment_tags; *tag != NULL; tag++)
+        {
+          const char *c = *tag;
+
+          for (i = lead; *c != '\0' && i < n; c++, i++)
+            if (*c == ' ' ? !COMMENT_IS_SPACE (l[i]) : g_ascii_tolower (l[i]) != *c)
+              break;
+          if (*c != '\0')
+            continue;
+          j = comment_skip_space (l, i, n);
+          if (j < n && l[j] == ':')
+            {
+              token = COMMENT_TOKEN_TAG;
+              name_start = lead;
+              name = PyString_FromStringAndSize (l + lead, i - lead);
+              fields_start = comment_skip_space (l, j + 1, n);
+              fields_end = comment_rstrip_space (l, fields_start, n);
+              break;
+            }
+        }
+    }
+
+  if (name == NULL)
+    {
+      if (token != COMMENT_TOKEN_TEXT && token != COMMENT_TOKEN_EMPTY)
+        return NULL;
+      Py_INCREF (Py_None);
+      name = Py_None;
+    }
+
+  return Py_BuildValue ("(s#NNnliNNNNNN)",
+                        s, indent_end,
+                        comment_substring (s, comment_start, comment_end),
+                        comment_offset (comment_start),
+                        column_offset,
+                        line_indent,
+                        token,
+                        name,
+                        comment_offset (name_start),
+                        comment_substring (l, delimiter_start, delimiter_end),
+                        comment_offset (delimiter_start),
+                        comment_substring (l, fields_start, fields_end),
+                        comment_offset (fields_start));
+}
+
+/* GIR reader
+ *
+ * An XML reader for GIR files, built on the tokenizer of girparser.c,
+ * which is several times faster than ElementTree at what girparser.py
+ * needs: the elements of a GIR file with their attributes, and the text
+ * of the elements without children.  It only knows the namespaces of
+ * GIR files and raises ValueError for anything it does not handle, for
+ * the caller to use ElementTree instead.
+ */
+
+typedef struct {
+  PyObject_HEAD
+  PyObject *tag;
+  PyObject *attrib;
+  PyObject *text;
+  PyObject *children;           /* A list, or NULL without children */
+} PyGIGirElement;
+
+NEW_CLASS (PyGIGirElement, "GirElement", GIGirElement, 10);
+
+#define GIR_NO_NAMESPACE -1
+
+/* The namespaces the reader knows, with the prefixes tostring() gives
+ * them; the core one is the default namespace there.
+ */
+static const struct {
+  const char *prefix;
+  const char *uri;
+} gir_namespaces[] = {
+  { NULL, "http://www.gtk.org/introspection/core/1.0" },
+  { "c", "http://www.gtk.org/introspection/c/1.0" },
+  { "glib", "http://www.gtk.org/introspection/glib/1.0" },
+  { "xml", "http://www.w3.org/XML/1998/namespace" }
+};
+
+#define GIR_XML_NAMESPACE 3
+
+static void
+pygi_gir_element_dealloc (PyGIGirElement *self)
+{
+  Py_XDECREF (self->tag);
+  Py_XDECREF (self->attrib);
+  Py_XDECREF (self->text);
+  Py_XDECREF (self->children);
+  Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static Py_ssize_t
+gir_element_length (PyGIGirElement *self)
+{
+  return self->children ? PyList_GET_SIZE (self->children) : 0;
+}
+
+static PyObject *
+gir_element_item (PyGIGirElement *self,
+		  Py_ssize_t      i)
+{
+  PyObject *child;
+
+  if (i < 0 || i >= gir_element_length (self))
+    {
+      PyErr_SetString (PyExc_IndexError, "child index out of range");
+      return NULL;
+    }
+
+  child = PyList_GET_ITEM (self->children, i);
+  Py_INCREF (child);
+  return child;
+}
+
+static gboolean
+gir_element_has_tag (PyGIGirElement *element,
+		     PyObject       *tag)
+{
+  if (element->tag == tag)
+    return TRUE;
+  if (element->tag == NULL)
+    return FALSE;
+  return PyObject_RichCompareBool (element->tag, tag, Py_EQ) == 1;
+}
+
+static PyObject *
+pygi_gir_element_getchildren (PyGIGirElement *self)
+{
+  if (self->children == NULL)
+    return PyList_New (0);
+  return PyList_GetSlice (self->children, 0, PyList_GET_SIZE (self->children));
+}
+
+static PyObject *
+pygi_gir_element_find (PyGIGirElement *self,
+		       PyObject       *args)
+{
+  PyObject *tag;
+  Py_ssize_t i;
+
+  if (!PyArg_ParseTuple (args, "O:GirElement.find", &tag))
+    return NULL;
+
+  for (i = 0; i < gir_element_length (self); i++)
+    {
+      PyGIGirElement *child = (PyGIGirElement *) PyList_GET_ITEM (self->children, i);
+
+      if (gir_element_has_tag (child, tag))
+	{
+	  Py_INCREF (child);
+	  return (PyObject *) child;
+	}
+    }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+pygi_gir_element_get (PyGIGirElement *self,
+		      PyObject       *args)
+{
+  PyObject *key, *value = Py_None;
+
+  if (!PyArg_ParseTuple (args, "O|O:GirElement.get", &key, &value))
+    return NULL;
+
+  if (self->attrib != NULL)
+    {
+      PyObject *found = PyDict_GetItem (self->attrib, key);
+      if (found != NULL)
+	value = found;
+    }
+
+  Py_INCREF (value);
+  return value;
+}
+
+static PyObject *
+pygi_gir_element_items (PyGIGirElement *self)
+{
+  if (self->attrib == NULL)
+    return PyList_New (0);
+  return PyDict_Items (self->attrib);
+}
+
+static PyObject *
+pygi_gir_element_keys (PyGIGirElement *self)
+{
+  if (self->attrib == NULL)
+    return PyList_New (0);
+  return PyDict_Keys (self->attrib);
+}
+
+static gboolean
+gir_element_collect (PyGIGirElement *element,
+		     PyObject       *tag,
+		     PyObject       *list)
+{
+  Py_ssize_t i;
+
+  if ((tag == Py_None || gir_element_has_tag (element, tag)) &&
+      PyList_Append (list, (PyObject *) element) < 0)
+    return FALSE;
+
+  for (i = 0; i < gir_element_length (element); i++)
+    if (!gir_element_collect ((PyGIGirElement *) PyList_GET_ITEM (element->children, i),
+			      tag, list))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* Unlike ElementTree, returns a list rather than an iterator */
+static PyObject *
+pygi_gir_element_iter (PyGIGirElement *self,
+		       PyObject       *args)
+{
+  PyObject *tag = Py_None, *list;
+
+  if (!PyArg_ParseTuple (args, "|O:GirElement.iter", &tag))
+    return NULL;
+
+  list = PyList_New (0);
+  if (list != NULL && !gir_element_collect (self, tag, list))
+    {
+      Py_DECREF (list);
+      return NULL;
+    }
+  return list;
+}
+
+static PyObject *
+pygi_gir_element_remove (PyGIGirElement *self,
+			 PyObject       *args)
+{
+  PyObject *child;
+  Py_ssize_t i;
+
+  if (!PyArg_ParseTuple (args, "O!:GirElement.remove", &PyGIGirElement_Type, &child))
+    return NULL;
+
+  for (i = 0; i < gir_element_length (self); i++)
+    if (PyList_GET_ITEM (self->children, i) == child)
+      {
+	if (PySequence_DelItem (self->children, i) < 0)
+	  return NULL;
+	Py_RETURN_NONE;
+      }
+
+  PyErr_SetString (PyExc_ValueError, "GirElement.remove(x): x not in children");
+  return NULL;
+}
+
+/* Serialization */
+
+/* Appends @s as UTF-8, escaped for an attribute value or for text */
+static gboolean
+gir_write_escaped (GString  *out,
+		   PyObject *s,
+		   gboolean  attribute)
+{
+  PyObject *utf8;
+  const char *p, *end;
+
+  if (PyUnicode_Check (s))
+    {
+      utf8 = PyUnicode_AsUTF8String (s);
+      if (utf8 == NULL)
+	return FALSE;
+    }
+  else if (PyString_Check (s))
+    {
+      utf8 = s;
+      Py_INCREF (utf8);
+    }
+  else
+    {
+      PyErr_SetString (PyExc_TypeError, "attributes and text must be string or unicode");
+      return FALSE;
+    }
+
+  p = PyString_AS_STRING (utf8);
+  end = p + PyString_GET_SIZE (utf8);
+  for (; p < end; p++)
+    {
+      switch (*p)
+	{
+	case '&':
+	  g_string_append (out, "&amp;");
+	  break;
+	case '<':
+	  g_string_append (out, "&lt;");
+	  break;
+	case '>':
+	  g_string_append (out, "&gt;");
+	  break;
+	case '"':
+	  g_string_append (out, attribute ? "&quot;" : "\"");
+	  break;
+	case '\n':
+	  g_string_append (out, attribute ? "&#10;" : "\n");
+	  break;
+	case '\r':
+	  g_string_append (out, "&#13;");
+	  break;
+	case '\t':
+	  g_string_append (out, attribute ? "&#9;" : "\t");
+	  break;
+	default:
+	  g_string_append_c (out, *p);
+	}
+    }
+
+  Py_DECREF (utf8);
+  return TRUE;
+}
+
+/* Appends the {uri}local name @name with the prefix of its namespace */
+static gboolean
+gir_write_name (GString  *out,
+		PyObject *name,
+		gboolean  attribute)
+{
+  const char *s, *local;
+  guint i;
+
+  if (!PyString_Check (name))
+    {
+      PyErr_SetString (PyExc_TypeError, "names must be strings");
+      return FALSE;
+    }
+
+  s = PyString_AS_STRING (name);
+  if (*s != '{')
+    {
+      /* The default namespace of the output is not the empty one */
+      if (!attribute)
+	goto unknown;
+      g_string_append (out, s);
+      return TRUE;
+    }
+
+  local = strchr (s, '}');
+  if (local == NULL)
+    goto unknown;
+
+  for (i = 0; i < G_N_ELEMENTS (gir_namespaces); i++)
+    {
+      if (strlen (gir_namespaces[i].uri) != (gsize) (local - s - 1) ||
+	  strncmp (gir_namespaces[i].uri, s + 1, local - s - 1) != 0)
+	continue;
+
+      if (gir_namespaces[i].prefix == NULL)
+	{
+	  /* Attributes do not take the default namespace */
+	  if (attribute)
+	    goto unknown;
+	}
+      else
+	{
+	  g_string_append (out, gir_namespaces[i].prefix);
+	  g_string_append_c (out, ':');
+	}
+      g_string_append (out, local + 1);
+      return TRUE;
+    }
+
+ unknown:
+  PyErr_Format (PyExc_ValueError, "cannot serialize the name %s", s);
+  return FALSE;
+}
+
+static gboolean
+gir_element_write (PyGIGirElement *element,
+		   GString        *out,
+		   gboolean        root)
+{
+  PyObject *key, *value;
+  Py_ssize_t pos = 0, i;
+  guint j;
+
+  if (element->tag == NULL)
+    {
+      PyErr_SetString (PyExc_ValueError, "cannot serialize an element without a tag");
+      return FALSE;
+    }
+
+  g_string_append_c (out, '<');
+  if (!gir_write_name (out, element->tag, FALSE))
+    return FALSE;
+
+  if (root)
+    for (j = 0; j < GIR_XML_NAMESPACE; j++)
+      {
+	g_string_append (out, " xmlns");
+	if (gir_namespaces[j].prefix != NULL)
+	  {
+	    g_string_append_c (out, ':');
+	    g_string_append (out, gir_namespaces[j].prefix);
+	  }
+	g_string_append (out, "=\"");
+	g_string_append (out, gir_namespaces[j].uri);
+	g_string_append_c (out, '"');
+      }
+
+  while (element->attrib != NULL &&
+	 PyDict_Next (element->attrib, &pos, &key, &value))
+    {
+      g_string_append_c (out, ' ');
+      if (!gir_write_name (out, key, TRUE))
+	return FALSE;
+      g_string_append (out, "=\"");
+      if (!gir_write_escaped (out, value, TRUE))
+	return FALSE;
+      g_string_append_c (out, '"');
+    }
+
+  if (gir_element_length (element) == 0 &&
+      (element->text == NULL || element->text == Py_None))
+    {
+      g_string_append (out, " />");
+      return TRUE;
+    }
+
+  g_string_append_c (out, '>');
+  if (element->text != NULL && element->text != Py_None &&
+      !gir_write_escaped (out, element->text, FALSE))
+    return FALSE;
+
+  for (i = 0; i < gir_element_length (element); i++)
+    {
+      PyObject *child = PyList_GET_ITEM (element->children, i);
+
+      if (!PyObject_TypeCheck (child, &PyGIGirElement_Type))
+	{
+	  PyErr_SetString (PyExc_TypeError, "children must be GirElement instances");
+	  return FALSE;
+	}
+      if (!gir_element_write ((PyGIGirElement *) child, out, FALSE))
+	return FALSE;
+    }
+
+  g_string_append (out, "</");
+  gir_write_name (out, element->tag, FALSE);
+  g_string_append_c (out, '>');
+  return TRUE;
+}
+
+/* The element as a standalone UTF-8 XML document, which declares the
+ * GIR namespaces on its root; what read_gir() reads back as is.
+ */
+static PyObject *
+pygi_gir_element_tostring (PyGIGirElement *self)
+{
+  GString *out;
+  PyObject *result = NULL;
+
+  out = g_string_sized_new (256);
+  if (gir_element_write (self, out, TRUE))
+    result = PyString_FromStringAndSize (out->str, out->len);
+  g_string_free (out, TRUE);
+  return result;
+}
+
+static const PyMethodDef _PyGIGirElement_methods[] = {
+  { "find", (PyCFunction) pygi_gir_element_find, METH_VARARGS },
+  { "get", (PyCFunction) pygi_gir_element_get, METH_VARARGS },
+  { "getchildren", (PyCFunction) pygi_gir_element_getchildren, METH_NOARGS },
+  { "getiterator", (PyCFunction) pygi_gir_element_iter, METH_VARARGS },
+  { "items", (PyCFunction) pygi_gir_element_items, METH_NOARGS },
+  { "iter", (PyCFunction) pygi_gir_element_iter, METH_VARARGS },
+  { "keys", (PyCFunction) pygi_gir_element_keys, METH_NOARGS },
+  { "remove", (PyCFunction) pygi_gir_element_remove, METH_VARARGS },
+  { "tostring", (PyCFunction) pygi_gir_element_tostring, METH_NOARGS },
+  { NULL, NULL, 0 }
+};
+
+static const PyMemberDef _PyGIGirElement_members[] = {
+  { "tag", T_OBJECT, offsetof (PyGIGirElement, tag), READONLY },
+  { "attrib", T_OBJECT, offsetof (PyGIGirElement, attrib), READONLY },
+  { "text", T_OBJECT, offsetof (PyGIGirElement, text), READONLY },
+  { NULL }
+};
+
+static PySequenceMethods _PyGIGirElement_as_sequence = {
+  (lenfunc) gir_element_length,
+  0, 0,
+  (ssizeargfunc) gir_element_item,
+};
+
+/* Reading */
+
+typedef struct {
+  const gchar *prefix;          /* "" for the default namespace */
+  gint ns;                      /* Index in gir_namespaces */
+} GirBinding;
+
+typedef struct {
+  PyGIGirElement *element;
+  guint n_bindings;             /* Bindings in scope at the start tag */
+} GirOpenElement;
+
+enum {
+  GIR_TAG_KEEP,
+  GIR_TAG_SKIP,
+  GIR_TAG_SHALLOW
+};
+
+typedef struct {
+  PyObject *name;
+  gint what;                    /* One of GIR_TAG_* */
+} GirTag;
+
+typedef struct {
+  GArray *bindings;
+  /* Caches of the qualified names of the raw names in the buffer,
+   * which are only valid for the bindings they were made with */
+  GHashTable *tags;
+  GHashTable *attribute_names;
+  /* Attribute values repeat a lot, they are shared */
+  GHashTable *values;
+  PyObject *skip_tags;
+  PyObject *shallow_tags;
+} GirReader;
+
+static void
+gir_tag_free (GirTag *tag)
+{
+  Py_DECREF (tag->name);
+  g_slice_free (GirTag, tag);
+}
+
+/* A str when @s is ASCII, like ElementTree does, unicode otherwise;
+ * invalid UTF-8 raises UnicodeDecodeError, a ValueError.
+ */
+static PyObject *
+gir_string_new (const gchar *s,
+		gsize        len)
+{
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    if ((guchar) s[i] >= 0x80)
+      return PyUnicode_DecodeUTF8 (s, len, "strict");
+  return PyString_FromStringAndSize (s, len);
+}
+
+static gboolean
+gir_reader_push_bindings (GirReader    *reader,
+			  const gchar **names,
+			  const gchar **values)
+{
+  guint i, j;
+
+  for (i = 0; names[i] != NULL; i++)
+    {
+      GirBinding binding;
+
+      if (strncmp (names[i], "xmlns", 5) != 0)
+	continue;
+      if (names[i][5] == '\0')
+	binding.prefix = "";
+      else if (names[i][5] == ':')
+	binding.prefix = names[i] + 6;
+      else
+	continue;
+
+      binding.ns = GIR_NO_NAMESPACE;
+      for (j = 0; j < GIR_XML_NAMESPACE; j++)
+	if (strcmp (values[i], gir_namespaces[j].uri) == 0)
+	  binding.ns = j;
+
+      if (binding.ns == GIR_NO_NAMESPACE && values[i][0] != '\0')
+	{
+	  PyErr_Format (PyExc_ValueError, "unknown namespace %s", values[i]);
+	  return FALSE;
+	}
+
+      g_array_append_val (reader->bindings, binding);
+      g_hash_table_remove_all (reader->tags);
+      g_hash_table_remove_all (reader->attribute_names);
+    }
+
+  return TRUE;
+}
+
+static void
+gir_reader_pop_bindings (GirReader *reader,
+			 guint      n_bindings)
+{
+  if (reader->bindings->len == n_bindings)
+    return;
+
+  g_array_set_size (reader->bindings, n_bindings);
+  g_hash_table_remove_all (reader->tags);
+  g_hash_table_remove_all (reader->attribute_names);
+}
+
+/* The {uri}local name of the raw name @name, unprefixed names being in
+ * the default namespace for elements and in no namespace for attributes
+ */
+static PyObject *
+gir_reader_qualify (GirReader   *reader,
+		    const gchar *name,
+		    gboolean     attribute)
+{
+  const gchar *colon, *local;
+  gint ns = GIR_NO_NAMESPACE;
+  gchar *qualified;
+  PyObject *result;
+  guint i;
+
+  colon = strchr (name, ':');
+  if (colon == NULL)
+    {
+      local = name;
+      for (i = reader->bindings->len; !attribute && i > 0; i--)
+	{
+	  GirBinding *binding = &g_array_index (reader->bindings, GirBinding, i - 1);
+	  if (binding->prefix[0] == '\0')
+	    {
+	      ns = binding->ns;
+	      break;
+	    }
+	}
+    }
+  else
+    {
+      gsize prefix_len = colon - name;
+
+      local = colon + 1;
+      if (prefix_len == 3 && strncmp (name, "xml", 3) == 0)
+	ns = GIR_XML_NAMESPACE;
+      else
+	{
+	  for (i = reader->bindings->len; i > 0; i--)
+	    {
+	      GirBinding *binding = &g_array_index (reader->bindings, GirBinding, i - 1);
+	      if (strlen (binding->prefix) == prefix_len &&
+		  strncmp (binding->prefix, name, prefix_len) == 0)
+		{
+		  ns = binding->ns;
+		  break;
+		}
+	    }
+	  if (i == 0 || ns == GIR_NO_NAMESPACE)
+	    {
+	      PyErr_Format (PyExc_ValueError, "unbound prefix in %s", name);
+	      return NULL;
+	    }
+	}
+    }
+
+  if (ns == GIR_NO_NAMESPACE)
+    return PyString_InternFromString (local);
+
+  qualified = g_strconcat ("{", gir_namespaces[ns].uri, "}", local, NULL);
+  result = PyString_InternFromString (qualified);
+  g_free (qualified);
+  return result;
+}
+
+static GirTag *
+gir_reader_get_tag (GirReader   *reader,
+		    const gchar *name)
+{
+  GirTag *tag;
+  PyObject *qualified;
+  int contained;
+
+  tag = g_hash_table_lookup (reader->tags, name);
+  if (tag != NULL)
+    return tag;
+
+  qualified = gir_reader_qualify (reader, name, FALSE);
+  if (qualified == NULL)
+    return NULL;
+
+  tag = g_slice_new (GirTag);
+  tag->name = qualified;
+  tag->what = GIR_TAG_KEEP;
+  g_hash_table_insert (reader->tags, (gpointer) name, tag);
+
+  if (reader->skip_tags != Py_None)
+    {
+      contained = PySequence_Contains (reader->skip_tags, qualified);
+      if (contained < 0)
+	return NULL;
+      if (contained)
+	tag->what = GIR_TAG_SKIP;
+    }
+  if (tag->what == GIR_TAG_KEEP && reader->shallow_tags != Py_None)
+    {
+      contained = PySequence_Contains (reader->shallow_tags, qualified);
+      if (contained < 0)
+	return NULL;
+      if (contained)
+	tag->what = GIR_TAG_SHALLOW;
+    }
+
+  return tag;
+}
+
+static PyObject *
+gir_reader_get_attribute_name (GirReader   *reader,
+			       const gchar *name)
+{
+  PyObject *qualified;
+
+  qualified = g_hash_table_lookup (reader->attribute_names, name);
+  if (qualified != NULL)
+    return qualified;
+
+  qualified = gir_reader_qualify (reader, name, TRUE);
+  if (qualified != NULL)
+    g_hash_table_insert (reader->attribute_names, (gpointer) name, qualified);
+  return qualified;
+}
+
+static PyObject *
+gir_reader_get_value (GirReader   *reader,
+		      const gchar *value)
+{
+  PyObject *result;
+
+  result = g_hash_table_lookup (reader->values, value);
+  if (result != NULL)
+    return result;
+
+  result = gir_string_new (value, strlen (value));
+  if (result != NULL)
+    g_hash_table_insert (reader->values, (gpointer) value, result);
+  return result;
+}
+
+/* Decodes the character data @text..@end in place like an XML parser
+ * does, and returns its new end, or NULL for what only ElementTree can
+ * read: comments, CDATA sections and unknown entities.
+ */
+static gchar *
+gir_decode_text (gchar *text,
+		 gchar *end)
+{
+  gchar *r = text;
+  gchar *w = text;
+
+  while (r < end)
+    {
+      if (*r == '<')
+	return NULL;
+
+      if (*r == '\r')
+	{
+	  *w++ = '\n';
+	  r++;
+	  if (r < end && *r == '\n')
+	    r++;
+	}
+      else if (*r == '&')
+	{
+	  gchar *semicolon = memchr (r, ';', end - r);
+	  gsize len;
+
+	  if (semicolon == NULL)
+	    return NULL;
+	  len = semicolon - r - 1;
+
+	  if (len == 3 && strncmp (r + 1, "amp", 3) == 0)
+	    *w++ = '&';
+	  else if (len == 2 && strncmp (r + 1, "lt", 2) == 0)
+	    *w++ = '<';
+	  else if (len == 2 && strncmp (r + 1, "gt", 2) == 0)
+	    *w++ = '>';
+	  else if (len == 4 && strncmp (r + 1, "quot", 4) == 0)
+	    *w++ = '"';
+	  else if (len == 4 && strncmp (r + 1, "apos", 4) == 0)
+	    *w++ = '\'';
+	  else if (len >= 2 && r[1] == '#')
+	    {
+	      gboolean hex = r[2] == 'x';
+	      gchar *digits = r + (hex ? 3 : 2);
+	      gchar *digits_end;
+	      gulong c;
+
+	      if (!g_ascii_isxdigit (*digits))
+		return NULL;
+	      c = strtoul (digits, &digits_end, hex ? 16 : 10);
+	      if (digits_end != semicolon ||
+		  c == 0 || c > 0x10ffff || !g_unichar_validate (c))
+		return NULL;
+	      /* A character reference is never shorter than its UTF-8 */
+	      w += g_unichar_to_utf8 (c, w);
+	    }
+	  else
+	    return NULL;
+
+	  r = semicolon + 1;
+	}
+      else
+	*w++ = *r++;
+    }
+
+  return w;
+}
+
+static PyObject *
+gir_reader_get_text (gchar *buffer,
+		     gsize  start,
+		     gsize  end)
+{
+  gchar *text_end;
+
+  /* The end tag of an empty element tag is that same tag */
+  if (end <= start)
+    Py_RETURN_NONE;
+
+  text_end = gir_decode_text (buffer + start, buffer + end);
+  if (text_end == NULL)
+    {
+      PyErr_SetString (PyExc_ValueError, "unsupported character data");
+      return NULL;
+    }
+  return gir_string_new (buffer + start, text_end - (buffer + start));
+}
+
+/* Only UTF-8 documents are read */
+static gboolean
+gir_check_encoding (const gchar *buffer,
+		    gsize        length)
+{
+  const gchar *decl_end, *p;
+
+  if (length < 5 || strncmp (buffer, "<?xml", 5) != 0)
+    return TRUE;
+
+  decl_end = memchr (buffer, '>', length);
+  if (decl_end == NULL)
+    return TRUE;
+
+  p = g_strstr_len (buffer, decl_end - buffer, "encoding");
+  if (p == NULL)
+    return TRUE;
+
+  p += strlen ("encoding");
+  while (p < decl_end && g_ascii_isspace (*p))
+    p++;
+  if (p < decl_end && *p == '=')
+    p++;
+  while (p < decl_end && g_ascii_isspace (*p))
+    p++;
+  if (p < decl_end && (*p == '"' || *p == '\''))
+    p++;
+
+  if (decl_end - p > 5 &&
+      g_ascii_strncasecmp (p, "utf-8", 5) == 0 &&
+      (p[5] == '"' || p[5] == '\''))
+    return TRUE;
+
+  PyErr_SetString (PyExc_ValueError, "only UTF-8 documents are supported");
+  return FALSE;
+}
+
+static PyObject *
+gir_reader_read (GirReader    *reader,
+		 GIrTokenizer *tokenizer)
+{
+  GArray *stack;
+  PyGIGirElement *root = NULL;
+  guint skip_depth = 0;
+  gboolean skip_ends_element = FALSE;
+  guint i, j;
+
+  stack = g_array_new (FALSE, FALSE, sizeof (GirOpenElement));
+
+  for (i = 0; i < tokenizer->tokens->len; i++)
+    {
+      GIrToken *token = &g_array_index (tokenizer->tokens, GIrToken, i);
+      GirOpenElement open;
+      const gchar **names, **values;
+      GirTag *tag;
+      PyGIGirElement *element;
+
+      if (token->type == G_IR_TOKEN_END_ELEMENT)
+	{
+	  if (skip_depth > 0)
+	    {
+	      if (--skip_depth > 0 || !skip_ends_element)
+		continue;
+	      skip_ends_element = FALSE;
+	    }
+	  open = g_array_index (stack, GirOpenElement, stack->len - 1);
+	  g_array_set_size (stack, stack->len - 1);
+	  gir_reader_pop_bindings (reader, open.n_bindings);
+	  continue;
+	}
+
+      if (skip_depth > 0)
+	{
+	  skip_depth++;
+	  continue;
+	}
+
+      names = _g_ir_tokenizer_get_attribute_names (tokenizer, token);
+      values = _g_ir_tokenizer_get_attribute_values (tokenizer, token);
+
+      open.n_bindings = reader->bindings->len;
+      if (!gir_reader_push_bindings (reader, names, values))
+	goto error;
+
+      tag = gir_reader_get_tag (reader, token->name);
+      if (tag == NULL)
+	goto error;
+
+      if (tag->what == GIR_TAG_SKIP)
+	{
+	  gir_reader_pop_bindings (reader, open.n_bindings);
+	  skip_depth = 1;
+	  continue;
+	}
+
+      element = PyObject_New (PyGIGirElement, &PyGIGirElement_Type);
+      if (element == NULL)
+	goto error;
+      Py_INCREF (tag->name);
+      element->tag = tag->name;
+      element->attrib = PyDict_New ();
+      element->text = NULL;
+      element->children = NULL;
+
+      if (stack->len == 0)
+	root = element;
+      else
+	{
+	  PyGIGirElement *parent = g_array_index (stack, GirOpenElement, stack->len - 1).element;
+
+	  if (parent->children == NULL)
+	    parent->children = PyList_New (0);
+	  if (parent->children == NULL ||
+	      PyList_Append (parent->children, (PyObject *) element) < 0)
+	    {
+	      Py_DECREF (element);
+	      goto error;
+	    }
+	  Py_DECREF (element);
+	}
+      open.element = element;
+      g_array_append_val (stack, open);
+
+      if (element->attrib == NULL)
+	goto error;
+
+      for (j = 0; names[j] != NULL; j++)
+	{
+	  PyObject *name, *value;
+
+	  if (strncmp (names[j], "xmlns", 5) == 0 &&
+	      (names[j][5] == '\0' || names[j][5] == ':'))
+	    continue;
+
+	  name = gir_reader_get_attribute_name (reader, names[j]);
+	  if (name == NULL)
+	    goto error;
+	  value = gir_reader_get_value (reader, values[j]);
+	  if (value == NULL || PyDict_SetItem (element->attrib, name, value) < 0)
+	    goto error;
+	}
+
+      if (tag->what == GIR_TAG_SHALLOW)
+	{
+	  skip_depth = 1;
+	  skip_ends_element = TRUE;
+	}
+      else
+	{
+	  GIrToken *next = &g_array_index (tokenizer->tokens, GIrToken, i + 1);
+
+	  /* Only the text of elements without children is kept */
+	  if (next->type == G_IR_TOKEN_END_ELEMENT)
+	    {
+	      element->text = gir_reader_get_text (tokenizer->buffer,
+						   token->end_offset, next->offset);
+	      if (element->text == NULL)
+		goto error;
+	    }
+	}
+    }
+
+  g_array_free (stack, TRUE);
+  return (PyObject *) root;
+
+ error:
+  g_array_free (stack, TRUE);
+  Py_XDECREF (root);
+  return NULL;
+}
+
+/* read_gir(data, skip_tags=None, shallow_tags=None)
+ *
+ * Reads the GIR document @data into GirElement instances, which have
+ * the part of the ElementTree element API girparser.py uses, and
+ * returns the root element.  The elements with a tag in @skip_tags are
+ * left out with their children, and the children of the ones with a tag
+ * in @shallow_tags are.
+ */
+static PyObject *
+pygi_read_gir (PyObject *self,
+	       PyObject *args)
+{
+  const char *data;
+  int length;
+  GirReader reader;
+  gchar *buffer;
+  GIrTokenizer *tokenizer;
+  GError *error = NULL;
+  PyObject *root = NULL;
+
+  reader.skip_tags = Py_None;
+  reader.shallow_tags = Py_None;
+  if (!PyArg_ParseTuple (args, "s#|OO:read_gir", &data, &length,
+			 &reader.skip_tags, &reader.shallow_tags))
+    return NULL;
+
+  if (!gir_check_encoding (data, length))
+    return NULL;
+
+  /* The tokenizer works in place */
+  buffer = g_malloc (length + 1);
+  memcpy (buffer, data, length);
+  buffer[length] = '\0';
+
+  tokenizer = _g_ir_tokenizer_new (buffer, length);
+  if (!_g_ir_tokenizer_tokenize (tokenizer, &error))
+    {
+      PyErr_SetString (PyExc_ValueError, error->message);
+      g_error_free (error);
+      goto out;
+    }
+
+  reader.bindings = g_array_new (FALSE, FALSE, sizeof (GirBinding));
+  reader.tags = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+				       (GDestroyNotify) gir_tag_free);
+  reader.attribute_names = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+						  (GDestroyNotify) Py_DecRef);
+  reader.values = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+					 (GDestroyNotify) Py_DecRef);
+
+  root = gir_reader_read (&reader, tokenizer);
+  if (root == NULL && !PyErr_Occurred ())
+    PyErr_SetString (PyExc_ValueError, "no root element");
+
+  g_array_free (reader.bindings, TRUE);
+  g_hash_table_destroy (reader.tags);
+  g_hash_table_destroy (reader.attribute_names);
+  g_hash_table_destroy (reader.values);
+
+ out:
+  _g_ir_tokenizer_free (tokenizer);
+  g_free (buffer);
+  return root;
+}
+
+/* Module */
+
+static const PyMethodDef pyscanner_functions[] = {
+  { "collect_attributes",
+    (PyCFunction) pygi_collect_attributes, METH_VARARGS },
+  { "escape_xml_text",
+    (PyCFunction) pygi_escape_xml_text, METH_VARARGS },
+  { "read_gir",
+    (PyCFunction) pygi_read_gir, METH_VARARGS },
+  { "tokenize_comment_line",
+    (PyCFunction) pygi_tokenize_comment_line, METH_VARARGS },
+  { NULL, NULL, 0, NULL }
+};
+
+DL_EXPORT(void)
+init_giscanner(void)
+{
+    PyObject *m, *d;
+    gboolean is_uninstalled;
+
+    /* Hack to avoid having to create a fake directory structure; when
+     * running uninstalled, the module will be in the top builddir,
+     * with no _giscanner prefix.
+     */
+    is_uninstalled = g_getenv ("UNINSTALLED_INTROSPECTION_SRCDIR") != NULL;
+    m = Py_InitModule (is_uninstalled ? "_giscanner" : "giscanner._giscanner",
+		       (PyMethodDef*)pyscanner_functions);
+    d = PyModule_GetDict (m);
+
+    PyGISourceScanner_Type.tp_init = (initproc)pygi_source_scanner_init;
+    PyGISourceScanner_Type.tp_methods = (PyMethodDef*)_PyGISourceScanner_methods;
+    REGISTER_TYPE (d, "SourceScanner", PyGISourceScanner_Type);
+
+    PyGISourceSymbol_Type.tp_getset = (PyGetSetDef*)_PyGISourceSymbol_getsets;
+    REGISTER_TYPE (d, "SourceSymbol", PyGISourceSymbol_Type);
+
+    PyGISourceType_Type.tp_getset = (PyGetSetDef*)_PyGISourceType_getsets;
+    REGISTER_TYPE (d, "SourceType", PyGISourceType_Type);
+
+    PyGIGirElement_Type.tp_dealloc = (destructor)pygi_gir_element_dealloc;
+    PyGIGirElement_Type.tp_as_sequence = &_PyGIGirElement_as_sequence;
+    PyGIGirElement_Type.tp_methods = (PyMethodDef*)_PyGIGirElement_methods;
+    PyGIGirElement_Type.tp_members = (PyMemberDef*)_PyGIGirElement_members;
+    REGISTER_TYPE (d, "GirElement", PyGIGirElement_Type);
 }
@@ -34,6 +34,11 @@ from .annotationparser import (OPT_ARRAY_FIXED_SIZE, OPT_ARRAY_LENGTH, OPT_ARRAY
 
 from .utils import to_underscores_noprefix
 
+# What a pass has to run after: the passes before it having been
+# through the whole namespace, or only through the node it is called on
+_AFTER_NAMESPACE = 0
+_AFTER_NODE = 1
+
 
 class MainTransformer(object):
 
@@ -42,6 +47,8 @@ class MainTransformer(object):
         self._blocks = blocks
         self._namespace = transformer.namespace
         self._uscore_type_names = {}
+        self._uscore_type_trie = None
+        self._changed_types = {}
 
     # Public API
 
@@ -51,56 +58,83 @@ class MainTransformer(object):
                           '* Not including .h files to be scanned\n'
                           '* Broken --identifier-prefix')
 
-        # Some initial namespace surgery
-        self._namespace.walk(self._pass_fixup_hidden_fields)
+        # Passes that only depend on what the passes before them did
+        # to the node they are called on share a walk of the namespace
+        self._run_passes([
+            # Some initial namespace surgery
+            (self._pass_fixup_hidden_fields, _AFTER_NODE),
 
-        # We have a rough tree which should have most of of the types
-        # we know about.  Let's attempt closure; walk over all of the
-        # Type() types and see if they match up with something.
-        self._namespace.walk(self._pass_type_resolution)
+            # We have a rough tree which should have most of of the types
+            # we know about.  Let's attempt closure; walk over all of the
+            # Type() types and see if they match up with something.
+            (self._pass_type_resolution, _AFTER_NODE),
 
-        # Read in annotations needed early
-        self._namespace.walk(self._pass_read_annotations_early)
+            # Read in annotations needed early
+            (self._pass_read_annotations_early, _AFTER_NODE),
 
-        # Determine some default values for transfer etc.
-        # based on the current tree.
-        self._namespace.walk(self._pass_callable_defaults)
+            # Determine some default values for transfer etc.
+            # based on the current tree.
+            (self._pass_callable_defaults, _AFTER_NAMESPACE),
 
-        # Read in most annotations now.
-        self._namespace.walk(self._pass_read_annotations)
+            # Read in most annotations now; the defaults above must not
+            # see any of them, (foreign) unions for instance.
+            (self._pass_read_annotations, _AFTER_NAMESPACE),
 
-        # Now that we've possibly seen more types from annotations,
-        # do another type resolution pass.
-        self._namespace.walk(self._pass_type_resolution)
+            # Now that we've possibly seen more types from annotations,
+            # do another type resolution pass.
+            (self._pass_type_resolution_changed, _AFTER_NODE),
 
-        # Generate a reverse mapping "bar_baz" -> BarBaz
-        for node in self._namespace.itervalues():
-            if isinstance(node, ast.Registered) and node.get_type is not None:
-                self._uscore_type_names[node.c_symbol_prefix] = node
-            elif isinstance(node, (ast.Record, ast.Union)):
-                uscored = to_underscores_noprefix(node.name).lower()
-                self._uscore_type_names[uscored] = node
+            # Generate a reverse mapping "bar_baz" -> BarBaz
+            (self._pass_uscore_type_names, _AFTER_NODE)])
 
-        for node in list(self._namespace.itervalues()):
-            if isinstance(node, ast.Function):
-                # Discover which toplevel functions are actually methods
-                self._pair_function(node)
-            if isinstance(node, (ast.Class, ast.Interface)):
-                self._pair_class_virtuals(node)
+        self._pair_functions()
 
-        # Some annotations need to be post function pairing
-        self._namespace.walk(self._pass_read_annotations2)
+        self._run_passes([
+            # Some annotations need to be post function pairing
+            (self._pass_read_annotations2, _AFTER_NAMESPACE),
 
-        # Another type resolution pass after we've parsed virtuals, etc.
-        self._namespace.walk(self._pass_type_resolution)
+            # Another type resolution pass after we've parsed virtuals,
+            # etc.; the invokers of virtuals may come after them.
+            (self._pass_type_resolution_changed, _AFTER_NAMESPACE),
 
-        self._namespace.walk(self._pass3)
+            (self._pass3, _AFTER_NODE)])
 
         # TODO - merge into pass3
         self._pair_quarks_with_enums()
 
     # Private
 
+    def _run_passes(self, passes):
+        callbacks = []
+        for callback, after in passes:
+            if callbacks and after == _AFTER_NAMESPACE:
+                self._walk(callbacks)
+                callbacks = []
+            callbacks.append(callback)
+        if callbacks:
+            self._walk(callbacks)
+
+    def _walk(self, callbacks):
+        """Walk the namespace once, calling each of callbacks on every
+node in turn.  A callback returning False only stops its own descent
+into the children of the node."""
+        def fused(callbacks):
+            def callback(node, chain):
+                descend = [cb for cb in callbacks if cb(node, chain)]
+                if len(descend) == len(callbacks):
+                    return True
+                if descend:
+                    chain.append(node)
+                    node._walk(fused(descend), chain)
+                    chain.pop()
+                return False
+            return callback
+
+        if len(callbacks) == 1:
+            self._namespace.walk(callbacks[0])
+        else:
+            self._namespace.walk(fused(callbacks))
+
     def _pass_fixup_hidden_fields(self, node, chain):
         """Hide all callbacks starting with _; the typical
         usage is void (*_gtk_reserved1)(void);"""
@@ -172,6 +206,11 @@ class MainTransformer(object):
             target.shadowed_by = node.name
             node.shadows = target.name
 
+    def _mark_types_changed(self, node):
+        """Record that annotations replaced types of node, so that the
+        next type resolution pass visits it again."""
+        self._changed_types[id(node)] = node
+
     def _apply_annotations_function(self, node, chain):
         block = self._blocks.get(node.symbol)
         self._apply_annotations_callable(node, chain, block)
@@ -254,8 +293,10 @@ class MainTransformer(object):
     def _adjust_container_type(self, parent, node, annotations):
         if ANN_ARRAY in annotations:
             self._apply_annotations_array(parent, node, annotations)
+            self._mark_types_changed(parent)
         elif ANN_ELEMENT_TYPE in annotations:
             self._apply_annotations_element_type(parent, node, annotations)
+            self._mark_types_changed(parent)
 
         if isinstance(node.type, ast.Array):
             self._check_array_element_type(node.type, annotations)
@@ -540,6 +581,7 @@ class MainTransformer(object):
         if type_annotation:
             node.type = self._resolve_toplevel(type_annotation[0],
                                                node.type, node, parent)
+            self._mark_types_changed(parent)
 
         caller_allocates = False
         annotated_direction = None
@@ -759,6 +801,7 @@ class MainTransformer(object):
         type_annotation = tag.annotations.get(ANN_TYPE)
         if type_annotation:
             field.type = self._transformer.create_type_from_user_string(type_annotation[0])
+            self._mark_types_changed(parent)
         field.doc = tag.description
         try:
             self._adjust_container_type(parent, field, tag.annotations)
@@ -782,6 +825,7 @@ class MainTransformer(object):
         type_annotation = block.annotations.get(ANN_TYPE)
         if type_annotation:
             prop.type = self._resolve_toplevel(type_annotation[0], prop.type, prop, parent)
+            self._mark_types_changed(parent)
 
     def _apply_annotations_signal(self, parent, signal):
         names = []
@@ -814,6 +858,7 @@ class MainTransformer(object):
                     if type_annotation:
                         param.type = self._resolve_toplevel(type_annotation[0], param.type,
                                                             param, parent)
+                        self._mark_types_changed(parent)
             else:
                 tag = None
             self._apply_annotations_param(signal, param, tag)
@@ -915,6 +960,23 @@ the ones that failed to resolve removed."""
             node.prerequisites = self._resolve_and_filter_type_list(node.prerequisites)
         return True
 
+    def _pass_type_resolution_changed(self, node, chain):
+        """Like _pass_type_resolution(), but only for the nodes whose
+        types were replaced since; the namespaces don't change during
+        the transform, so the others would resolve the same again."""
+        if self._changed_types.pop(id(node), None) is not None:
+            self._pass_type_resolution(node, chain)
+        return True
+
+    def _pass_uscore_type_names(self, node, chain):
+        if isinstance(node, ast.Registered) and node.get_type is not None:
+            self._uscore_type_names[node.c_symbol_prefix] = node
+        elif isinstance(node, (ast.Record, ast.Union)):
+            uscored = to_underscores_noprefix(node.name).lower()
+            self._uscore_type_names[uscored] = node
+        # Only the toplevel nodes
+        return False
+
     def _pair_quarks_with_enums(self):
         # self._uscore_type_names is an authoritative mapping of types
         # to underscored versions, since it is based on get_type() methods;
@@ -948,6 +1010,19 @@ the ones that failed to resolve removed."""
                 message.warn_node(node,
                     """%s: Couldn't find corresponding enumeration""" % (node.symbol, ))
 
+    def _build_uscore_type_trie(self):
+        """Index self._uscore_type_names by the components of the
+names, so that a symbol can be split in one pass over it."""
+        trie = {}
+        for uscored, node in self._uscore_type_names.iteritems():
+            if uscored is None:
+                continue
+            level = trie
+            for component in uscored.split('_'):
+                level = level.setdefault(component, {})
+            level[None] = node
+        self._uscore_type_trie = trie
+
     def _split_uscored_by_type(self, uscored):
         """'uscored' should be an un-prefixed uscore string.  This
 function searches through the namespace for the longest type which
@@ -955,19 +1030,29 @@ prefixes uscored, and returns (type, suffix).  Example, assuming
 namespace Gtk, type is TextBuffer:
 
 _split_uscored_by_type(text_buffer_try_new) -> (ast.Class(TextBuffer), 'try_new')"""
+        if self._uscore_type_trie is None:
+            self._build_uscore_type_trie()
         node = None
-        count = 0
-        prev_split_count = -1
-        while True:
-            components = uscored.rsplit('_', count)
-            if len(components) == prev_split_count:
-                return None
-            prev_split_count = len(components)
-            type_string = components[0]
-            node = self._uscore_type_names.get(type_string)
-            if node:
-                return (node, '_'.join(components[1:]))
-            count += 1
+        components = uscored.split('_')
+        level = self._uscore_type_trie
+        for i, component in enumerate(components):
+            level = level.get(component)
+            if level is None:
+                break
+            if level.get(None):
+                node = level[None]
+                end = i + 1
+        if not node:
+            return None
+        return (node, '_'.join(components[end:]))
+
+    def _pair_functions(self):
+        for node in list(self._namespace.itervalues()):
+            if isinstance(node, ast.Function):
+                # Discover which toplevel functions are actually methods
+                self._pair_function(node)
+            if isinstance(node, (ast.Class, ast.Interface)):
+                self._pair_class_virtuals(node)
 
     def _pair_function(self, func):
         """Check to see whether a toplevel function should be a
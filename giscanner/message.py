@@ -78,6 +78,7 @@ class MessageLogger(object):
         self._enable_warnings = []
         self._warning_count = 0
         self._error_count = 0
+        self._records = None
 
     @classmethod
     def get(cls, *args, **kwargs):
@@ -94,11 +95,33 @@ class MessageLogger(object):
     def get_error_count(self):
         return self._error_count
 
+    def start_recording(self):
+        """
+        Keep the messages logged from now on instead of writing them, so
+        that they can be replayed in another process, see replay().
+        """
+        self._records = []
+
+    def stop_recording(self):
+        """Stop recording the messages, returning them."""
+        records = self._records
+        self._records = None
+        return records
+
+    def replay(self, records):
+        """Log messages returned by stop_recording()."""
+        for record in records:
+            self.log(*record)
+
     def log(self, log_type, text, positions=None, prefix=None):
         """
         Log a warning, using optional file positioning information.
         If the warning is related to a ast.Node type, see log_node().
         """
+        if self._records is not None:
+            self._records.append((log_type, text, positions, prefix))
+            return
+
         utils.break_on_debug_flag('warning')
 
         self._warning_count += 1
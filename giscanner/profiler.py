@@ -0,0 +1,167 @@
+# -*- Mode: Python -*-
+# GObject-Introspection - a framework for introspecting GObject libraries
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301, USA.
+#
+
+import json
+import os
+import sys
+import time
+
+from contextlib import contextmanager
+
+from .collections import OrderedDict
+
+try:
+    import resource
+except ImportError:
+    resource = None
+
+# Version of the report format, to be bumped on incompatible changes
+_REPORT_VERSION = 1
+
+
+def _get_max_rss(children=False):
+    """
+    Peak resident set size of the process, or of the largest of its
+    waited for children, in KiB; None where it is not known.
+    """
+    if resource is None:
+        return None
+    if children:
+        max_rss = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss
+    else:
+        max_rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    # Linux reports KiB, OS X bytes
+    if sys.platform == 'darwin':
+        max_rss //= 1024
+    return max_rss
+
+
+class _Sample(object):
+    __slots__ = ('wall', 'user', 'system', 'children')
+
+    def __init__(self):
+        times = os.times()
+        self.wall = time.time()
+        self.user = times[0]
+        self.system = times[1]
+        self.children = times[2] + times[3]
+
+
+class Profiler(object):
+    """
+    Measures where the time and memory of a scanner run go. The phases
+    are named blocks of code, see phase(); a phase run several times is
+    reported once, with the sum of its times. Nothing is measured until
+    enable() is called.
+    """
+
+    _instance = None
+
+    def __init__(self):
+        self._enabled = False
+        self._start = None
+        self._phases = OrderedDict()
+        self._counts = OrderedDict()
+        self._info = OrderedDict()
+
+    @classmethod
+    def get(cls):
+        if cls._instance is None:
+            cls._instance = cls()
+        return cls._instance
+
+    def enable(self):
+        self._enabled = True
+        self._start = _Sample()
+
+    @contextmanager
+    def phase(self, name):
+        if not self._enabled:
+            yield
+            return
+
+        start = _Sample()
+        try:
+            yield
+        finally:
+            end = _Sample()
+            phase = self._phases.get(name)
+            if phase is None:
+                phase = self._phases[name] = OrderedDict([('name', name),
+                                                          ('calls', 0),
+                                                          ('wall', 0.0),
+                                                          ('cpu_user', 0.0),
+                                                          ('cpu_system', 0.0),
+                                                          ('cpu_children', 0.0)])
+            phase['calls'] += 1
+            phase['wall'] += end.wall - start.wall
+            phase['cpu_user'] += end.user - start.user
+            phase['cpu_system'] += end.system - start.system
+            phase['cpu_children'] += end.children - start.children
+            # Peaks so far, the process ones never go down
+            phase['max_rss_kb'] = _get_max_rss()
+            phase['children_max_rss_kb'] = _get_max_rss(children=True)
+
+    def count(self, name, n):
+        """Add n to the counter called name."""
+        if self._enabled:
+            self._counts[name] = self._counts.get(name, 0) + n
+
+    def counted(self, name, iterable):
+        """Count the items of iterable in the counter called name, lazily."""
+        if not self._enabled:
+            return iterable
+        return self._iter_counted(name, iterable)
+
+    def _iter_counted(self, name, iterable):
+        n = 0
+        for item in iterable:
+            n += 1
+            yield item
+        self.count(name, n)
+
+    def set_info(self, name, value):
+        """Record a value in the report, to tell runs apart."""
+        if self._enabled:
+            self._info[name] = value
+
+    def write_report(self, filename):
+        """Write what was measured to filename, as a JSON object."""
+        if not self._enabled:
+            return
+
+        end = _Sample()
+        report = OrderedDict()
+        report['version'] = _REPORT_VERSION
+        report.update(self._info)
+        report['total'] = OrderedDict([('wall', end.wall - self._start.wall),
+                                       ('cpu_user', end.user - self._start.user),
+                                       ('cpu_system', end.system - self._start.system),
+                                       ('cpu_children', end.children - self._start.children),
+                                       ('max_rss_kb', _get_max_rss()),
+                                       ('children_max_rss_kb', _get_max_rss(children=True))])
+        report['phases'] = self._phases.values()
+        report['counts'] = self._counts
+
+        f = open(filename, 'w')
+        try:
+            json.dump(report, f, indent=2, separators=(',', ': '))
+            f.write('\n')
+        finally:
+            f.close()
@@ -38,11 +38,16 @@ from giscanner.introspectablepass import IntrospectablePass
 from giscanner.girparser import GIRParser
 from giscanner.girwriter import GIRWriter
 from giscanner.maintransformer import MainTransformer
+from giscanner.profiler import Profiler
+from giscanner.scannerserver import serve
 from giscanner.shlibs import resolve_shlibs
 from giscanner.sourcescanner import SourceScanner, ALL_EXTS
 from giscanner.transformer import Transformer
 from . import utils
 
+# The GIR is streamed out as it is generated, through a buffer this big
+_OUTPUT_BUFFER_SIZE = 64 * 1024
+
 
 def process_cflags_begin(option, opt, value, parser):
     cflags = getattr(parser.values, option.dest)
@@ -195,6 +200,17 @@ match the namespace prefix.""")
     parser.add_option("", "--filelist",
                       action="store", dest="filelist", default=[],
                       help="file containing headers and sources to be scanned")
+    parser.add_option("-j", "--jobs",
+                      action="store", dest="jobs", type="int", default=1,
+                      help="number of processes used to parse the comment blocks")
+    parser.add_option("", "--profile-report",
+                      action="store", dest="profile_report", default=None,
+                      help="write the time and memory used by each phase to this "
+                           "file, in JSON")
+    parser.add_option("", "--serve",
+                      action="store", dest="serve", default=None, metavar="SOCKET",
+                      help="run the scanners of g-ir-scanner processes started with "
+                           "GI_SCANNER_SERVER=SOCKET, listening on this unix socket")
 
     group = get_preprocessor_option_group(parser)
     parser.add_option_group(group)
@@ -244,8 +260,7 @@ def passthrough_gir(path, f):
     parser = GIRParser()
     parser.parse(path)
 
-    writer = GIRWriter(parser.get_namespace())
-    f.write(writer.get_xml())
+    GIRWriter(parser.get_namespace(), f)
 
 
 def test_codegen(optstring,
@@ -432,17 +447,17 @@ def create_source_scanner(options, args):
     return ss
 
 
-def write_output(data, options):
+def write_output(writer_class, namespace, options):
     if options.output == "-":
         output = sys.stdout
     elif options.reparse_validate_gir:
         main_f, main_f_name = tempfile.mkstemp(suffix='.gir')
-        main_f = os.fdopen(main_f, 'w')
-        main_f.write(data)
+        main_f = os.fdopen(main_f, 'w', _OUTPUT_BUFFER_SIZE)
+        writer_class(namespace, main_f)
         main_f.close()
 
         temp_f, temp_f_name = tempfile.mkstemp(suffix='.gir')
-        temp_f = os.fdopen(temp_f, 'w')
+        temp_f = os.fdopen(temp_f, 'w', _OUTPUT_BUFFER_SIZE)
         passthrough_gir(main_f_name, temp_f)
         temp_f.close()
         if not utils.files_are_identical(main_f_name, temp_f_name):
@@ -459,20 +474,35 @@ def write_output(data, options):
         return 0
     else:
         try:
-            output = open(options.output, "w")
+            output = open(options.output, "w", _OUTPUT_BUFFER_SIZE)
         except IOError as e:
             _error("opening output for writing: %s" % (e.strerror, ))
 
     try:
-        output.write(data)
-    except IOError as e:
-        _error("while writing output: %s" % (e.strerror, ))
+        writer_class(namespace, output)
+        output.flush()
+    except BaseException as e:
+        # Don't leave a truncated file behind
+        if output is not sys.stdout:
+            try:
+                output.close()
+            except IOError:
+                pass
+            os.unlink(options.output)
+        if isinstance(e, IOError):
+            _error("while writing output: %s" % (e.strerror, ))
+        raise
+    if output is not sys.stdout:
+        output.close()
 
 
 def scanner_main(args):
     parser = _get_option_parser()
     (options, args) = parser.parse_args(args)
 
+    if options.serve:
+        return serve(options.serve)
+
     if options.passthrough_gir:
         passthrough_gir(options.passthrough_gir, sys.stdout)
     if options.test_codegen:
@@ -500,27 +530,40 @@ def scanner_main(args):
             or options.header_only):
         _error("Must specify --program or --library")
 
+    profiler = Profiler.get()
+    if options.profile_report:
+        profiler.enable()
+
     namespace = create_namespace(options)
     logger = message.MessageLogger.get(namespace=namespace)
     if options.warn_all:
         logger.enable_warnings((message.WARNING, message.ERROR, message.FATAL))
 
-    transformer = create_transformer(namespace, options)
+    profiler.set_info('namespace', '%s-%s' % (namespace.name, namespace.version))
+
+    with profiler.phase('includes'):
+        transformer = create_transformer(namespace, options)
 
     packages = set(options.packages)
     packages.update(transformer.get_pkgconfig_packages())
     if packages:
-        exit_code = process_packages(options, packages)
+        with profiler.phase('packages'):
+            exit_code = process_packages(options, packages)
         if exit_code:
             return exit_code
 
     ss = create_source_scanner(options, args)
 
-    cbp = GtkDocCommentBlockParser()
-    blocks = cbp.parse_comment_blocks(ss.get_comments())
+    comments = ss.get_comments()
+    profiler.count('comments', len(comments))
+    with profiler.phase('comments'):
+        cbp = GtkDocCommentBlockParser()
+        blocks = cbp.parse_comment_blocks(comments, jobs=options.jobs)
+    profiler.count('comment_blocks', len(blocks))
 
     # Transform the C symbols into AST nodes
-    transformer.parse(ss.get_symbols())
+    with profiler.phase('transformer'):
+        transformer.parse(profiler.counted('symbols', ss.get_symbols()))
 
     if not options.header_only:
         shlibs = create_binary(transformer, options, args)
@@ -529,13 +572,18 @@ def scanner_main(args):
 
     transformer.namespace.shared_libraries = shlibs
 
-    main = MainTransformer(transformer, blocks)
-    main.transform()
+    with profiler.phase('main-transformer'):
+        main = MainTransformer(transformer, blocks)
+        main.transform()
 
     utils.break_on_debug_flag('tree')
 
-    final = IntrospectablePass(transformer, blocks)
-    final.validate()
+    with profiler.phase('introspectable-pass'):
+        final = IntrospectablePass(transformer, blocks)
+        final.validate()
+    profiler.count('nodes', len(transformer.namespace.names))
+    profiler.count('type_resolutions', transformer.resolution_lookups)
+    profiler.count('type_resolution_misses', transformer.resolution_misses)
 
     warning_count = logger.get_warning_count()
     if options.warn_fatal and warning_count > 0:
@@ -553,9 +601,10 @@ def scanner_main(args):
 
     transformer.namespace.c_includes = options.c_includes
     transformer.namespace.exported_packages = exported_packages
-    writer = Writer(transformer.namespace)
-    data = writer.get_xml()
+    with profiler.phase('gir-write'):
+        write_output(Writer, transformer.namespace, options)
 
-    write_output(data, options)
+    if options.profile_report:
+        profiler.write_report(options.profile_report)
 
     return 0
@@ -1767,6 +1767,7 @@ gi_source_scanner_parse_file (GISourceScanner *scanner, FILE *file)
 				       g_free, (GDestroyNotify)gi_source_symbol_unref);
 
   lineno = 1;
+  scanner->decl_started = FALSE;
   yyin = file;
   yyparse (scanner);
 
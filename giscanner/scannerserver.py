@@ -0,0 +1,419 @@
+# -*- Mode: Python -*-
+# GObject-Introspection - a framework for introspecting GObject libraries
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301, USA.
+#
+
+"""
+A server running scanners for g-ir-scanner processes of the same user,
+to spare each of them the start of the scanner in large build trees:
+
+    g-ir-scanner --serve=SOCKET &
+    GI_SCANNER_SERVER=SOCKET make
+
+The server forks a scanner per request, from a process which has already
+imported the scanner and checked its cache, and which keeps the cache
+entries of the includes the scanners used in memory. The scanner runs
+with the arguments, working directory, umask and environment of the
+client, its output is relayed to the client which exits the same way.
+
+This module is imported by clients before anything else of the scanner,
+and should only use the standard library at the top level.
+"""
+
+import errno
+import os
+import select
+import signal
+import socket
+import struct
+import sys
+import traceback
+
+# Bump on incompatible changes of the requests or the frames
+_PROTOCOL_VERSION = '1'
+
+# Replies are frames: a kind, the length of the payload and the payload
+_FRAME_HEADER = struct.Struct('!cI')
+_FRAME_STDOUT = 'o'
+_FRAME_STDERR = 'e'
+_FRAME_EXIT = 'x'
+_FRAME_REFUSED = 'r'
+
+_LENGTH = struct.Struct('!I')
+
+_READ_SIZE = 64 * 1024
+
+
+def _get_identity():
+    """
+    What a client and the server must have in common for the server to
+    run the scanner of the client: the same interpreter, script and
+    modules, with the same data directory.
+    """
+    import giscanner
+    return '\0'.join([_PROTOCOL_VERSION,
+                      sys.executable,
+                      sys.version,
+                      os.path.realpath(sys.argv[0]),
+                      os.path.dirname(os.path.abspath(giscanner.__file__)),
+                      DATADIR,
+                      os.environ.get('UNINSTALLED_INTROSPECTION_SRCDIR', ''),
+                      os.environ.get('UNINSTALLED_INTROSPECTION_BUILDDIR', '')])
+
+
+def _pack_strings(strings):
+    data = [_LENGTH.pack(len(strings))]
+    for string in strings:
+        data.append(_LENGTH.pack(len(string)))
+        data.append(string)
+    return ''.join(data)
+
+
+def _recv_exactly(sock, size):
+    """Receive size bytes from sock; None if it is closed before."""
+    chunks = []
+    while size > 0:
+        chunk = sock.recv(min(size, _READ_SIZE))
+        if not chunk:
+            return None
+        chunks.append(chunk)
+        size -= len(chunk)
+    return ''.join(chunks)
+
+
+def _recv_strings(sock):
+    data = _recv_exactly(sock, _LENGTH.size)
+    if data is None:
+        return None
+    strings = []
+    for i in xrange(_LENGTH.unpack(data)[0]):
+        data = _recv_exactly(sock, _LENGTH.size)
+        if data is None:
+            return None
+        string = _recv_exactly(sock, _LENGTH.unpack(data)[0])
+        if string is None:
+            return None
+        strings.append(string)
+    return strings
+
+
+def _send_frame(sock, kind, payload):
+    sock.sendall(_FRAME_HEADER.pack(kind, len(payload)) + payload)
+
+
+def _recv_frame(sock):
+    header = _recv_exactly(sock, _FRAME_HEADER.size)
+    if header is None:
+        return None
+    kind, size = _FRAME_HEADER.unpack(header)
+    payload = _recv_exactly(sock, size)
+    if payload is None:
+        return None
+    return kind, payload
+
+
+# Client
+
+
+def run_client(path, args, stdout=None, stderr=None):
+    """
+    Run the scanner with args in the server listening on the unix socket
+    path, writing its output to stdout and stderr. Returns its exit code,
+    or None when there is no server which can run it, for the scanner to
+    be run by the caller instead.
+    """
+    if stdout is None:
+        stdout = sys.stdout
+    if stderr is None:
+        stderr = sys.stderr
+    if [arg for arg in args[1:] if arg.startswith('--serve')]:
+        return None
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        try:
+            sock.connect(path)
+        except socket.error:
+            return None
+
+        umask = os.umask(0)
+        os.umask(umask)
+        request = [_get_identity(), os.getcwd(), str(umask), str(len(args))]
+        request.extend(args)
+        request.extend('%s=%s' % item for item in os.environ.iteritems())
+        sock.sendall(_pack_strings(request))
+
+        while True:
+            frame = _recv_frame(sock)
+            if frame is None:
+                stderr.write("g-ir-scanner: lost the connection to the scanner server %s\n"
+                             % (path, ))
+                return 1
+            kind, payload = frame
+            if kind == _FRAME_STDOUT:
+                stdout.write(payload)
+                stdout.flush()
+            elif kind == _FRAME_STDERR:
+                stderr.write(payload)
+                stderr.flush()
+            elif kind == _FRAME_EXIT:
+                how, value = payload.split(':')
+                if how == 'signal':
+                    # Die the way the scanner did
+                    signum = int(value)
+                    signal.signal(signum, signal.SIG_DFL)
+                    os.kill(os.getpid(), signum)
+                    return 128 + signum
+                return int(value)
+            elif kind == _FRAME_REFUSED:
+                return None
+    finally:
+        sock.close()
+
+
+# Server
+
+
+def _listen(path):
+    if os.path.exists(path):
+        probe = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            probe.connect(path)
+        except socket.error:
+            # Left behind by a server which was killed
+            os.unlink(path)
+        else:
+            raise SystemExit("ERROR: a scanner server is already listening on %s" % (path, ))
+        finally:
+            probe.close()
+
+    listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    # Only the user running the server may connect
+    umask = os.umask(0o077)
+    try:
+        listener.bind(path)
+    finally:
+        os.umask(umask)
+    listener.listen(socket.SOMAXCONN)
+    return listener
+
+
+def _exit_status(code):
+    """The exit status of a process in which sys.exit(code) was called."""
+    if code is None:
+        return 0
+    if isinstance(code, (int, long)):
+        return code & 0xff
+    sys.stderr.write('%s\n' % (code, ))
+    return 1
+
+
+def _scan(cwd, umask, args, environ, control_fd):
+    """Run the scanner in the process forked for a request."""
+    os.chdir(cwd)
+    os.umask(umask)
+    os.environ.clear()
+    os.environ.update(environ)
+    sys.argv = args
+
+    from .scannermain import scanner_main
+    try:
+        code = scanner_main(args)
+    except SystemExit as e:
+        code = e.code
+    except:
+        traceback.print_exc()
+        code = 1
+    status = _exit_status(code)
+    sys.stdout.flush()
+    sys.stderr.flush()
+
+    # Tell the server which includes to keep in memory for the next
+    # scanners; lines this short are written atomically
+    from .cachestore import CacheStore
+    for filename in CacheStore.get_used_filenames():
+        line = filename + '\n'
+        if len(line) <= select.PIPE_BUF:
+            os.write(control_fd, line)
+    return status
+
+
+def _relay(conn, pid, out_fd, err_fd):
+    """
+    Send what the scanner process pid writes to out_fd and err_fd to the
+    client, then how it exited. The scanner is killed when the client
+    goes away.
+    """
+    streams = {out_fd: _FRAME_STDOUT, err_fd: _FRAME_STDERR}
+    try:
+        while streams:
+            try:
+                readable = select.select(streams.keys() + [conn], [], [])[0]
+            except select.error as e:
+                if e.args[0] == errno.EINTR:
+                    continue
+                raise
+            if conn in readable:
+                # The client sends nothing after the request
+                raise socket.error(errno.ECONNRESET, "client went away")
+            for fd in readable:
+                data = os.read(fd, _READ_SIZE)
+                if data:
+                    _send_frame(conn, streams[fd], data)
+                else:
+                    del streams[fd]
+    except socket.error:
+        try:
+            os.killpg(pid, signal.SIGTERM)
+        except OSError:
+            pass
+        os.waitpid(pid, 0)
+        return
+
+    status = os.waitpid(pid, 0)[1]
+    if os.WIFSIGNALED(status):
+        payload = 'signal:%d' % (os.WTERMSIG(status), )
+    else:
+        payload = 'exit:%d' % (os.WEXITSTATUS(status), )
+    try:
+        _send_frame(conn, _FRAME_EXIT, payload)
+    except socket.error:
+        pass
+
+
+def _handle(conn, control_fd, identity):
+    """Serve a request, in a process forked for it."""
+    request = _recv_strings(conn)
+    if request is None:
+        return
+    if request[0] != identity:
+        _send_frame(conn, _FRAME_REFUSED, '')
+        return
+    cwd = request[1]
+    umask = int(request[2])
+    n_args = int(request[3])
+    args = request[4:4 + n_args]
+    environ = dict(item.split('=', 1) for item in request[4 + n_args:])
+
+    out_r, out_w = os.pipe()
+    err_r, err_w = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        status = 1
+        try:
+            # In a process group of its own, for _relay() to kill the
+            # compilers and dumpers it runs along with it
+            os.setpgid(0, 0)
+            conn.close()
+            os.close(out_r)
+            os.close(err_r)
+            devnull = os.open(os.devnull, os.O_RDONLY)
+            os.dup2(devnull, 0)
+            os.close(devnull)
+            os.dup2(out_w, 1)
+            os.dup2(err_w, 2)
+            os.close(out_w)
+            os.close(err_w)
+            status = _scan(cwd, umask, args, environ, control_fd)
+        except:
+            traceback.print_exc()
+        finally:
+            os._exit(status)
+
+    os.close(out_w)
+    os.close(err_w)
+    _relay(conn, pid, out_r, err_r)
+
+
+def _reap_children():
+    while True:
+        try:
+            pid = os.waitpid(-1, os.WNOHANG)[0]
+        except OSError as e:
+            if e.errno == errno.ECHILD:
+                return
+            raise
+        if pid == 0:
+            return
+
+
+def _on_terminate(signum, frame):
+    raise SystemExit(0)
+
+
+def _on_child(signum, frame):
+    # Only there to wake up select() and reap the handlers
+    pass
+
+
+def serve(path):
+    """
+    Serve the requests of clients on the unix socket path, until the
+    server is terminated.
+    """
+    from .cachestore import CacheStore
+
+    identity = _get_identity()
+    # Check the scanner version and the cache once for all scanners
+    cachestore = CacheStore()
+    listener = _listen(path)
+    control_r, control_w = os.pipe()
+    pending = ''
+
+    signal.signal(signal.SIGTERM, _on_terminate)
+    signal.signal(signal.SIGCHLD, _on_child)
+    try:
+        while True:
+            _reap_children()
+            try:
+                readable = select.select([listener, control_r], [], [])[0]
+            except select.error as e:
+                if e.args[0] == errno.EINTR:
+                    continue
+                raise
+
+            if control_r in readable:
+                pending += os.read(control_r, _READ_SIZE)
+                lines = pending.split('\n')
+                pending = lines.pop()
+                for filename in lines:
+                    cachestore.preload(filename)
+
+            if listener in readable:
+                try:
+                    conn = listener.accept()[0]
+                except socket.error as e:
+                    if e.args[0] in (errno.EINTR, errno.ECONNABORTED):
+                        continue
+                    raise
+                pid = os.fork()
+                if pid == 0:
+                    try:
+                        listener.close()
+                        os.close(control_r)
+                        signal.signal(signal.SIGTERM, signal.SIG_DFL)
+                        signal.signal(signal.SIGCHLD, signal.SIG_DFL)
+                        _handle(conn, control_w, identity)
+                    finally:
+                        os._exit(0)
+                conn.close()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        listener.close()
+        os.unlink(path)
+    return 0
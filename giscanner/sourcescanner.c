@@ -236,6 +236,7 @@ void
 gi_source_scanner_free (GISourceScanner *scanner)
 {
   g_object_unref (scanner->current_file);
+  g_free (scanner->linemark_filename);
 
   g_hash_table_destroy (scanner->typedef_table);
 
@@ -264,6 +265,25 @@ gi_source_scanner_set_macro_scan (GISourceScanner  *scanner,
   scanner->macro_scan = macro_scan;
 }
 
+/**
+ * gi_source_scanner_take_current_file:
+ * @scanner: scanner instance
+ * @file: (transfer full): the file being lexed
+ *
+ * Makes @file the file the following tokens are attributed to.
+ */
+void
+gi_source_scanner_take_current_file (GISourceScanner *scanner,
+                                     GFile           *file)
+{
+  if (scanner->current_file)
+    g_object_unref (scanner->current_file);
+  scanner->current_file = file;
+  g_free (scanner->linemark_filename);
+  scanner->linemark_filename = NULL;
+  scanner->current_file_scanned = g_hash_table_contains (scanner->files, file);
+}
+
 void
 gi_source_scanner_add_symbol (GISourceScanner  *scanner,
 			      GISourceSymbol   *symbol)
@@ -276,7 +296,7 @@ gi_source_scanner_add_symbol (GISourceScanner  *scanner,
 
   g_assert (scanner->current_file);
 
-  if (scanner->macro_scan || g_hash_table_contains (scanner->files, scanner->current_file))
+  if (scanner->macro_scan || scanner->current_file_scanned)
     scanner->symbols = g_slist_prepend (scanner->symbols,
                                         gi_source_symbol_ref (symbol));
 
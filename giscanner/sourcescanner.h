@@ -107,6 +107,8 @@ struct _GISourceComment
 struct _GISourceScanner
 {
   GFile *current_file;
+  gboolean current_file_scanned; /* current_file is in files */
+  char *linemark_filename; /* as given by the last line marker */
   gboolean macro_scan;
   gboolean private; /* set by gtk-doc comment <private>/<public> */
   gboolean flags; /* set by gtk-doc comment <flags> */
@@ -116,6 +118,13 @@ struct _GISourceScanner
   GHashTable *typedef_table;
   gboolean skipping;
   GQueue conditionals;
+
+  /* Declaration filter for the headers that are not scanned, see yylex() */
+  gboolean decl_started;
+  gboolean decl_skipped;
+  gboolean decl_is_function;
+  int decl_depth;
+  int decl_last_token;
 };
 
 struct _GISourceSymbol
@@ -158,6 +167,8 @@ void                gi_source_scanner_parse_macros     (GISourceScanner  *scanne
 							GList            *filenames);
 void                gi_source_scanner_set_macro_scan   (GISourceScanner  *scanner,
 							gboolean          macro_scan);
+void                gi_source_scanner_take_current_file (GISourceScanner *scanner,
+                                                         GFile           *file);
 GSList *            gi_source_scanner_get_symbols      (GISourceScanner  *scanner);
 GSList *            gi_source_scanner_get_comments     (GISourceScanner  *scanner);
 void                gi_source_scanner_free             (GISourceScanner  *scanner);
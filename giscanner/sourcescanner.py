@@ -18,13 +18,19 @@
 # Boston, MA 02111-1307, USA.
 #
 
-from __future__ import with_statement
+from __future__ import absolute_import, with_statement
+import hashlib
 import os
+import re
 import subprocess
 import tempfile
 
+from collections import namedtuple
+
+from .cachestore import CacheStore
 from .libtoolimporter import LibtoolImporter
 from .message import Position
+from .profiler import Profiler
 
 with LibtoolImporter(None, None):
     if 'UNINSTALLED_INTROSPECTION_SRCDIR' in os.environ:
@@ -110,13 +116,13 @@ def ctype_name(ctype):
         CTYPE_FUNCTION: 'function'}.get(ctype)
 
 
-class SourceType(object):
-    __members__ = ['type', 'base_type', 'name', 'type_qualifier',
-                   'child_list', 'is_bitfield']
-
-    def __init__(self, scanner, stype):
-        self._scanner = scanner
-        self._stype = stype
+class SourceType(namedtuple('SourceType', ['type', 'storage_class_specifier', 'type_qualifier',
+                                           'function_specifier', 'name', 'base_type',
+                                           'child_list', 'is_bitfield'])):
+    """A type of the C scanner, with the symbols of its members or
+parameters in child_list. Instances are made by export_symbols() of the
+C scanner, which fills in the fields in this order."""
+    __slots__ = ()
 
     def __repr__(self):
         return '<%s type=%r name=%r>' % (
@@ -124,42 +130,14 @@ class SourceType(object):
             ctype_name(self.type),
             self.name)
 
-    @property
-    def type(self):
-        return self._stype.type
-
-    @property
-    def base_type(self):
-        if self._stype.base_type is not None:
-            return SourceType(self._scanner, self._stype.base_type)
-
-    @property
-    def name(self):
-        return self._stype.name
-
-    @property
-    def type_qualifier(self):
-        return self._stype.type_qualifier
-
-    @property
-    def child_list(self):
-        for symbol in self._stype.child_list:
-            if symbol is None:
-                continue
-            yield SourceSymbol(self._scanner, symbol)
-
-    @property
-    def is_bitfield(self):
-        return self._stype.is_bitfield
-
 
-class SourceSymbol(object):
-    __members__ = ['const_int', 'const_double', 'const_string', 'const_boolean',
-                   'ident', 'type', 'base_type']
-
-    def __init__(self, scanner, symbol):
-        self._scanner = scanner
-        self._symbol = symbol
+class SourceSymbol(namedtuple('SourceSymbol', ['type', 'ident', 'base_type', 'const_int',
+                                               'const_double', 'const_string', 'const_boolean',
+                                               'source_filename', 'line', 'private'])):
+    """A symbol of the C scanner. Instances are made by export_symbols()
+of the C scanner, which fills in the fields in this order; unlike the
+objects of the C scanner they can be pickled, for the cache."""
+    __slots__ = ()
 
     def __repr__(self):
         src = self.source_filename
@@ -173,59 +151,125 @@ class SourceSymbol(object):
             self.ident,
             src)
 
-    @property
-    def const_int(self):
-        return self._symbol.const_int
-
-    @property
-    def const_double(self):
-        return self._symbol.const_double
-
-    @property
-    def const_string(self):
-        return self._symbol.const_string
-
-    @property
-    def const_boolean(self):
-        return self._symbol.const_boolean
-
-    @property
-    def ident(self):
-        return self._symbol.ident
-
-    @property
-    def type(self):
-        return self._symbol.type
-
-    @property
-    def base_type(self):
-        if self._symbol.base_type is not None:
-            return SourceType(self._scanner, self._symbol.base_type)
-
-    @property
-    def source_filename(self):
-        return self._symbol.source_filename
-
-    @property
-    def line(self):
-        return self._symbol.line
-
-    @property
-    def private(self):
-        return self._symbol.private
-
     @property
     def position(self):
-        return Position(self._symbol.source_filename,
-                        self._symbol.line)
+        return Position(self.source_filename, self.line)
+
+
+_LINEMARK_RE = re.compile(r'^#(?:line)? ([0-9]+) "((?:[^"\\]|\\.)*)"')
+
+
+def _hash_headers(fp, headers, salt):
+    """Split the preprocessor output in fp between the headers it comes
+from, and compute a key for each of them from salt and the output up
+to the end of its last part. Returns a dictionary mapping headers to
+their keys, and the parts of the headers as [header, first line, last
+line] lists, in the order they were met."""
+    total = hashlib.sha1(salt)
+    ends = {}
+    runs = []
+    realpaths = {}
+    current_filename = None
+    lineno = 0
+    for line in fp:
+        match = None
+        if line.startswith('#'):
+            match = _LINEMARK_RE.match(line)
+            if match:
+                if current_filename in headers:
+                    ends[current_filename] = total.copy()
+                name = match.group(2)
+                filename = realpaths.get(name)
+                if filename is None:
+                    filename = os.path.realpath(name.decode('string_escape'))
+                    realpaths[name] = filename
+                lineno = int(match.group(1))
+                # A line marker within the same file only skips lines
+                if filename in headers and filename != current_filename:
+                    runs.append([filename, lineno, lineno])
+                current_filename = filename
+        total.update(line)
+        if not match:
+            lineno += 1
+            if current_filename in headers:
+                runs[-1][2] = lineno
+    if current_filename in headers:
+        ends[current_filename] = total.copy()
+    keys = {}
+    for filename in headers:
+        key = hashlib.sha1(salt)
+        key.update(filename + '\0')
+        # Headers without any content, e.g. because of a guard
+        if filename in ends:
+            key.update(ends[filename].digest())
+        keys[filename] = key.hexdigest()
+    return keys, runs
+
+
+def _find_parts(positions, runs):
+    """Find the parts of the headers in runs that positions, (header,
+line) tuples in the order of the output, are in. Returns for each of
+them the number of the part among those of its header, or None. The
+parts are met in the order of the output as well, which tells the parts
+of a header included more than once apart."""
+    numbers = []
+    counts = {}
+    for run in runs:
+        numbers.append(counts.get(run[0], 0))
+        counts[run[0]] = numbers[-1] + 1
+    parts = []
+    current = 0
+    for filename, line in positions:
+        part = None
+        for i in xrange(current, len(runs)):
+            run_filename, first_line, last_line = runs[i]
+            if run_filename == filename:
+                if part is None:
+                    part = i
+                if first_line <= line <= last_line:
+                    part = i
+                    break
+        if part is None:
+            parts.append(None)
+        else:
+            current = part
+            parts.append(numbers[part])
+    return parts
+
+
+def _sort_by_parts(items, runs):
+    """Order items, (header, part, item) tuples where part counts the
+parts of the header in runs, in the order of the parts."""
+    runs_by_filename = {}
+    for index, run in enumerate(runs):
+        runs_by_filename.setdefault(run[0], []).append(index)
+    parts = [[] for run in runs]
+    rest = []
+    for filename, part, item in items:
+        indexes = runs_by_filename.get(filename)
+        if indexes and part is not None:
+            parts[indexes[min(part, len(indexes) - 1)]].append(item)
+        else:
+            rest.append(item)
+    return [item for items in parts for item in items] + rest
 
 
 class SourceScanner(object):
 
     def __init__(self):
         self._scanner = CSourceScanner()
+        self._cachestore = CacheStore()
         self._filenames = []
+        self._preprocessed = set()
+        # The ranges of the C scanner symbols taken by _parse(), with
+        # the symbols of the headers replacing them
+        self._parsed_spans = []
         self._cpp_options = []
+        # What was extracted from the headers, in the order they were
+        # parsed, see _parse()
+        self._header_comments = []
+        # What the C scanner has, exported at once, see _get_scanner_symbols()
+        self._scanner_symbols = None
 
     # Public API
 
@@ -243,13 +287,17 @@ class SourceScanner(object):
         for filename in filenames:
             # self._scanner expects file names to be canonicalized and symlinks to be resolved
             filename = os.path.realpath(filename)
-            self._scanner.append_filename(filename)
             self._filenames.append(filename)
 
+        # The headers are only added to the scanned files in _parse(),
+        # if they are not in the cache
         headers = []
         for filename in self._filenames:
             if os.path.splitext(filename)[1] in SOURCE_EXTS:
-                self._scanner.lex_filename(filename)
+                self._scanner.append_filename(filename)
+                with Profiler.get().phase('lex'):
+                    self._scanner.lex_filename(filename)
+                self._scanner_symbols = None
             else:
                 headers.append(filename)
 
@@ -258,23 +306,43 @@ class SourceScanner(object):
     def parse_macros(self, filenames):
         self._scanner.set_macro_scan(True)
         # self._scanner expects file names to be canonicalized and symlinks to be resolved
-        self._scanner.parse_macros([os.path.realpath(f) for f in filenames])
+        with Profiler.get().phase('macros'):
+            self._scanner.parse_macros([os.path.realpath(f) for f in filenames])
         self._scanner.set_macro_scan(False)
+        self._scanner_symbols = None
 
     def get_symbols(self):
-        for symbol in self._scanner.get_symbols():
-            yield SourceSymbol(self._scanner, symbol)
+        symbols = self._get_scanner_symbols()
+        start = 0
+        for end, next_start, header_symbols in self._parsed_spans:
+            for symbol in symbols[start:end]:
+                yield symbol
+            for symbol in header_symbols:
+                yield symbol
+            start = next_start
+        for symbol in symbols[start:]:
+            yield symbol
 
     def get_comments(self):
-        return self._scanner.get_comments()
+        comments = [comment for comment in self._scanner.get_comments()
+                    if comment[1] not in self._preprocessed]
+        return comments + self._header_comments
 
     def dump(self):
         print '-' * 30
-        for symbol in self._scanner.get_symbols():
+        for symbol in self.get_symbols():
             print symbol.ident, symbol.base_type.name, symbol.type
 
     # Private
 
+    def _get_scanner_symbols(self):
+        # Converting all of the symbols in a single call is much cheaper
+        # than wrapping them and their types one by one
+        if self._scanner_symbols is None:
+            with Profiler.get().phase('export'):
+                self._scanner_symbols = self._scanner.export_symbols(SourceSymbol, SourceType)
+        return self._scanner_symbols
+
     def _parse(self, filenames):
         if not filenames:
             return
@@ -294,36 +362,94 @@ class SourceScanner(object):
         cpp_args += ['-E', '-C', '-I.', '-']
         cpp_args += self._cpp_options
 
-        proc = subprocess.Popen(cpp_args,
-                                stdin=subprocess.PIPE,
-                                stdout=subprocess.PIPE)
-
-        for define in defines:
-            proc.stdin.write('#ifndef %s\n' % (define, ))
-            proc.stdin.write('# define %s\n' % (define, ))
-            proc.stdin.write('#endif\n')
-        for undef in undefs:
-            proc.stdin.write('#undef %s\n' % (undef, ))
-        for filename in filenames:
-            proc.stdin.write('#include <%s>\n' % (filename, ))
-        proc.stdin.close()
-
-        tmp_fd, tmp_name = tempfile.mkstemp()
-        fp = os.fdopen(tmp_fd, 'w+b')
-        while True:
-            data = proc.stdout.read(4096)
-            if data is None:
-                break
-            fp.write(data)
-            if len(data) < 4096:
-                break
+        profiler = Profiler.get()
+        with profiler.phase('preprocess'):
+            proc = subprocess.Popen(cpp_args,
+                                    stdin=subprocess.PIPE,
+                                    stdout=subprocess.PIPE)
+
+            for define in defines:
+                proc.stdin.write('#ifndef %s\n' % (define, ))
+                proc.stdin.write('# define %s\n' % (define, ))
+                proc.stdin.write('#endif\n')
+            for undef in undefs:
+                proc.stdin.write('#undef %s\n' % (undef, ))
+            for filename in filenames:
+                proc.stdin.write('#include <%s>\n' % (filename, ))
+            proc.stdin.close()
+
+            tmp_fd, tmp_name = tempfile.mkstemp()
+            fp = os.fdopen(tmp_fd, 'w+b')
+            while True:
+                data = proc.stdout.read(4096)
+                if data is None:
+                    break
+                fp.write(data)
+                if len(data) < 4096:
+                    break
+            fp.seek(0, 0)
+
+            assert proc, 'Proc was none'
+            proc.wait()
+            if proc.returncode != 0:
+                raise SystemExit('Error while processing the source.')
+
+        # A header is keyed by the preprocessed output up to the end of
+        # its part, which includes the expansion of the macros it uses
+        # and what it borrows from the headers before it while being
+        # parsed (typedef names, enumeration values used in its constant
+        # expressions). A change in a header therefore also invalidates
+        # the headers which come after it in the output.
+        # The headers found in the cache are not parsed; they stay in
+        # the input for the types they define, which the lexer only
+        # parses the typedefs, enumerations and structures of.
+        salt = '\0'.join(cpp_args) + '\0'
+        keys, runs = _hash_headers(fp, set(filenames), salt)
+        results = {}
+        for filename, key in keys.iteritems():
+            results[filename] = self._cachestore.load_entry(key)
+        stale = set(filename for filename in keys
+                    if results[filename] is None)
+        profiler.count('cached_headers', len(keys) - len(stale))
+        profiler.count('parsed_headers', len(stale))
+
+        # The input is parsed even when every header is cached, as
+        # parse_macros() needs the typedef names it defines
+        for filename in stale:
+            self._scanner.append_filename(filename)
+        start = len(self._get_scanner_symbols())
         fp.seek(0, 0)
-
-        assert proc, 'Proc was none'
-        proc.wait()
-        if proc.returncode != 0:
-            raise SystemExit('Error while processing the source.')
-
-        self._scanner.parse_file(fp.fileno())
+        with profiler.phase('lex'):
+            self._scanner.parse_file(fp.fileno())
+        self._scanner_symbols = None
+        symbols = self._get_scanner_symbols()
+        # Each symbol and comment goes with the part of its header it is
+        # in, counting from the first part of the header, for the cached
+        # ones to be put back between the others in the order of the
+        # output, which the transformer depends on: e.g. the first
+        # typedef of a structure is the one it is named after.
+        symbols = [symbol for symbol in symbols[start:] if symbol.source_filename in stale]
+        comments = [comment for comment in self._scanner.get_comments() if comment[1] in stale]
+        for filename in stale:
+            results[filename] = ([], [])
+        parts = _find_parts([(symbol.source_filename, symbol.line) for symbol in symbols], runs)
+        for part, symbol in zip(parts, symbols):
+            results[symbol.source_filename][0].append((part, symbol))
+        parts = _find_parts([(comment[1], comment[2]) for comment in comments], runs)
+        for part, comment in zip(parts, comments):
+            results[comment[1]][1].append((part, comment))
         fp.close()
         os.unlink(tmp_name)
+
+        header_symbols = []
+        header_comments = []
+        for filename in sorted(keys):
+            symbols, comments = results[filename]
+            if filename in stale:
+                self._cachestore.store_entry(keys[filename], (symbols, comments))
+            header_symbols.extend((filename, part, symbol) for part, symbol in symbols)
+            header_comments.extend((filename, part, comment) for part, comment in comments)
+        self._parsed_spans.append((start, len(self._get_scanner_symbols()),
+                                   _sort_by_parts(header_symbols, runs)))
+        self._header_comments.extend(_sort_by_parts(header_comments, runs))
+        self._preprocessed.update(filenames)
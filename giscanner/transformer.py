@@ -40,11 +40,49 @@ class TransformerException(Exception):
     pass
 
 
-_xdg_data_dirs = [x for x in os.environ.get('XDG_DATA_DIRS', '').split(os.pathsep)]
-_xdg_data_dirs.append(DATADIR)
-
-if os.name != 'nt':
-    _xdg_data_dirs.append('/usr/share')
+def _get_xdg_data_dirs():
+    # Looked up on each use, a scanner server runs scanners with the
+    # environment of its clients
+    xdg_data_dirs = [x for x in os.environ.get('XDG_DATA_DIRS', '').split(os.pathsep)]
+    xdg_data_dirs.append(DATADIR)
+
+    if os.name != 'nt':
+        xdg_data_dirs.append('/usr/share')
+    return xdg_data_dirs
+
+# The kinds of C strings matched against namespace prefixes
+_IDENTIFIER = 0
+_UCASE_SYMBOL = 1
+_SYMBOL = 2
+
+# Marks a C type name or GType name that is not in the resolution caches;
+# None is a valid entry there, for names that do not resolve
+_NOT_CACHED = object()
+
+
+class _PrefixTrie(object):
+    """Finds the values of all of the prefixes a string starts with,
+in one pass over the string."""
+
+    def __init__(self):
+        self._root = {}
+
+    def add(self, prefix, value):
+        node = self._root
+        for c in prefix:
+            node = node.setdefault(c, {})
+        node.setdefault(None, []).append(value)
+
+    def match(self, string):
+        node = self._root
+        values = list(node.get(None, ()))
+        for c in string:
+            node = node.get(c)
+            if node is None:
+                break
+            if None in node:
+                values.extend(node[None])
+        return values
 
 
 class Transformer(object):
@@ -66,6 +104,13 @@ class Transformer(object):
         # https://bugzilla.gnome.org/show_bug.cgi?id=581525
         self._tag_ns = {}
 
+        # Canonical forms of C type strings, see _canonicalize_ctype()
+        self._canonical_ctypes = {}
+        self.resolution_lookups = 0
+        self.resolution_misses = 0
+
+        self._reset_namespace_matches()
+
     def get_pkgconfig_packages(self):
         return self._pkg_config_packages
 
@@ -182,7 +227,7 @@ None."""
 
     def _find_include(self, include):
         searchdirs = self._includepaths[:]
-        for path in _xdg_data_dirs:
+        for path in _get_xdg_data_dirs():
             searchdirs.append(os.path.join(path, 'gir-1.0'))
         searchdirs.append(os.path.join(DATADIR, 'gir-1.0'))
 
@@ -203,7 +248,9 @@ None."""
         self._parse_include(filename)
         parser = self._cachestore.load(filename)
         self._namespace = parser.get_namespace()
+        self._namespace.parse_all()
         del self._parsed_includes[self._namespace.name]
+        self._reset_namespace_matches()
         return self
 
     def _parse_include(self, filename, uninstalled=False):
@@ -211,7 +258,7 @@ None."""
         if self._cachestore is not None:
             parser = self._cachestore.load(filename)
         if parser is None:
-            parser = GIRParser(types_only=not self._passthrough_mode)
+            parser = GIRParser(types_only=not self._passthrough_mode, lazy=True)
             parser.parse(filename)
             if self._cachestore is not None:
                 self._cachestore.store(filename, parser)
@@ -226,6 +273,7 @@ None."""
                 self._pkg_config_packages.add(pkg)
         namespace = parser.get_namespace()
         self._parsed_includes[namespace.name] = namespace
+        self._reset_namespace_matches()
 
     def _iter_namespaces(self):
         """Return an iterator over all included namespaces; the
@@ -241,39 +289,89 @@ currently-scanned namespace is first."""
             return -1
         return cmp(x[2], y[2])
 
-    def _split_c_string_for_namespace_matches(self, name, is_identifier=False):
-        matches = []  # Namespaces which might contain this name
-        unprefixed_namespaces = []  # Namespaces with no prefix, last resort
-        for ns in self._iter_namespaces():
-            if is_identifier:
-                prefixes = ns.identifier_prefixes
-            elif name[0].isupper():
-                prefixes = ns._ucase_symbol_prefixes
-            else:
-                prefixes = ns.symbol_prefixes
-            if prefixes:
-                for prefix in prefixes:
-                    if (not is_identifier) and (not prefix.endswith('_')):
+    def _reset_namespace_matches(self):
+        """Forget the prefix tries and the matches made with them; to be
+called whenever the set of namespaces changes."""
+        self._prefix_tries = None
+        self._namespace_matches = {}
+        self._reset_resolution_caches()
+
+    def _reset_resolution_caches(self):
+        # parse_from_gir() has no namespace until its include is parsed
+        if self._namespace is not None:
+            self._resolution_generation = self._namespace.generation
+        else:
+            self._resolution_generation = None
+        self._resolved_ctypes = {}
+        self._resolved_gtype_names = {}
+
+    def _build_prefix_tries(self):
+        self._prefix_tries = {}
+        for kind in (_IDENTIFIER, _UCASE_SYMBOL, _SYMBOL):
+            trie = _PrefixTrie()
+            unprefixed_namespaces = []
+            for ns_index, ns in enumerate(self._iter_namespaces()):
+                if kind == _IDENTIFIER:
+                    prefixes = ns.identifier_prefixes
+                elif kind == _UCASE_SYMBOL:
+                    prefixes = ns._ucase_symbol_prefixes
+                else:
+                    prefixes = ns.symbol_prefixes
+                if not prefixes:
+                    unprefixed_namespaces.append(ns)
+                    continue
+                for prefix_index, prefix in enumerate(prefixes):
+                    if kind != _IDENTIFIER and not prefix.endswith('_'):
                         prefix = prefix + '_'
-                    if name.startswith(prefix):
-                        matches.append((ns, name[len(prefix):], len(prefix)))
-                        break
-            else:
-                unprefixed_namespaces.append(ns)
-        if matches:
+                    trie.add(prefix, (ns_index, prefix_index, ns, len(prefix)))
+            self._prefix_tries[kind] = (trie, unprefixed_namespaces)
+
+    def _split_c_string_for_namespace_matches(self, name, is_identifier=False):
+        key = (name, is_identifier)
+        matches = self._namespace_matches.get(key)
+        if matches is not None:
+            return list(matches)
+
+        if self._prefix_tries is None:
+            self._build_prefix_tries()
+        if is_identifier:
+            kind = _IDENTIFIER
+        elif name[0].isupper():
+            kind = _UCASE_SYMBOL
+        else:
+            kind = _SYMBOL
+        trie, unprefixed_namespaces = self._prefix_tries[kind]
+
+        # The first of its prefixes that matches wins for a namespace
+        best = {}
+        for value in trie.match(name):
+            ns_index, prefix_index = value[:2]
+            if ns_index not in best or prefix_index < best[ns_index][1]:
+                best[ns_index] = value
+
+        if best:
+            # Namespaces which might contain this name
+            matches = [(ns, name[length:], length)
+                       for ns_index, prefix_index, ns, length in sorted(best.values())]
             matches.sort(self._sort_matches)
-            return map(lambda x: (x[0], x[1]), matches)
+            matches = [(x[0], x[1]) for x in matches]
         elif self._accept_unprefixed:
-            return [(self._namespace, name)]
-        elif unprefixed_namespaces:
+            matches = [(self._namespace, name)]
+        else:
+            # Namespaces with no prefix, last resort; not remembered,
+            # as it depends on what they contain
+            #
             # A bit of a hack; this function ideally shouldn't look through the
             # contents of namespaces; but since we aren't scanning anything
             # without a prefix, it's not too bad.
             for ns in unprefixed_namespaces:
                 if name in ns:
                     return [(ns, name)]
-        raise ValueError("Unknown namespace for %s %r"
-                         % ('identifier' if is_identifier else 'symbol', name, ))
+            raise ValueError("Unknown namespace for %s %r"
+                             % ('identifier' if is_identifier else 'symbol', name, ))
+
+        self._namespace_matches[key] = tuple(matches)
+        return matches
 
     def split_ctype_namespaces(self, ident):
         """Given a StudlyCaps string identifier like FooBar, return a
@@ -601,6 +699,12 @@ raise ValueError."""
         return node
 
     def _canonicalize_ctype(self, ctype):
+        canonical = self._canonical_ctypes.get(ctype)
+        if canonical is None:
+            canonical = self._canonical_ctypes[ctype] = self._canonicalize_ctype_uncached(ctype)
+        return canonical
+
+    def _canonicalize_ctype_uncached(self, ctype):
         # First look up the ctype including any pointers;
         # a few type names like 'char*' have their own aliases
         # and we need pointer information for those.
@@ -886,7 +990,14 @@ Note that type resolution may not succeed."""
             typeval.ctype = None
         return typeval
 
-    def _resolve_type_from_ctype_all_namespaces(self, typeval, pointer_stripped):
+    def _check_resolution_caches(self):
+        """Drop what was resolved if our namespace changed since; the
+includes only change through _parse_include(), which resets the caches
+itself."""
+        if self._namespace.generation != self._resolution_generation:
+            self._reset_resolution_caches()
+
+    def _resolve_ctype_all_namespaces(self, pointer_stripped):
         # If we can't determine the namespace from the type name,
         # fall back to trying all of our includes.  An example of this is mutter,
         # which has nominal namespace of "Meta", but a few classes are
@@ -895,34 +1006,59 @@ Note that type resolution may not succeed."""
         for namespace in self._parsed_includes.itervalues():
             target = namespace.get_by_ctype(pointer_stripped)
             if target:
-                typeval.target_giname = '%s.%s' % (namespace.name, target.name)
-                return True
-        return False
+                return '%s.%s' % (namespace.name, target.name)
+        return None
 
-    def _resolve_type_from_ctype(self, typeval):
-        assert typeval.ctype is not None
-        pointer_stripped = typeval.ctype.replace('*', '')
+    def _resolve_ctype(self, pointer_stripped):
         try:
             matches = self.split_ctype_namespaces(pointer_stripped)
         except ValueError:
-            return self._resolve_type_from_ctype_all_namespaces(typeval, pointer_stripped)
+            return self._resolve_ctype_all_namespaces(pointer_stripped)
         for namespace, name in matches:
             target = namespace.get(name)
             if not target:
                 target = namespace.get_by_ctype(pointer_stripped)
             if target:
-                typeval.target_giname = '%s.%s' % (namespace.name, target.name)
-                return True
-        return False
+                return '%s.%s' % (namespace.name, target.name)
+        return None
 
-    def _resolve_type_from_gtype_name(self, typeval):
-        assert typeval.gtype_name is not None
+    def _resolve_type_from_ctype(self, typeval):
+        assert typeval.ctype is not None
+        # Neither the pointers nor the constness of a C type take part in
+        # its resolution, so all of the spellings of one share an entry.
+        pointer_stripped = typeval.ctype.replace('*', '')
+        self._check_resolution_caches()
+        self.resolution_lookups += 1
+        target_giname = self._resolved_ctypes.get(pointer_stripped, _NOT_CACHED)
+        if target_giname is _NOT_CACHED:
+            self.resolution_misses += 1
+            target_giname = self._resolve_ctype(pointer_stripped)
+            self._resolved_ctypes[pointer_stripped] = target_giname
+        if target_giname is None:
+            return False
+        typeval.target_giname = target_giname
+        return True
+
+    def _resolve_gtype_name(self, gtype_name):
         for ns in self._iter_namespaces():
-            node = ns.type_names.get(typeval.gtype_name, None)
+            node = ns.get_by_gtype_name(gtype_name)
             if node is not None:
-                typeval.target_giname = '%s.%s' % (ns.name, node.name)
-                return True
-        return False
+                return '%s.%s' % (ns.name, node.name)
+        return None
+
+    def _resolve_type_from_gtype_name(self, typeval):
+        assert typeval.gtype_name is not None
+        self._check_resolution_caches()
+        self.resolution_lookups += 1
+        target_giname = self._resolved_gtype_names.get(typeval.gtype_name, _NOT_CACHED)
+        if target_giname is _NOT_CACHED:
+            self.resolution_misses += 1
+            target_giname = self._resolve_gtype_name(typeval.gtype_name)
+            self._resolved_gtype_names[typeval.gtype_name] = target_giname
+        if target_giname is None:
+            return False
+        typeval.target_giname = target_giname
+        return True
 
     def _resolve_type_internal(self, typeval):
         if isinstance(typeval, (ast.Array, ast.List)):
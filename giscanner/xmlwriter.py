@@ -24,42 +24,58 @@ import os
 
 from contextlib import contextmanager
 from cStringIO import StringIO
-from xml.sax.saxutils import escape
 
 from .libtoolimporter import LibtoolImporter
 
 
 with LibtoolImporter(None, None):
     if 'UNINSTALLED_INTROSPECTION_SRCDIR' in os.environ:
-        from _giscanner import collect_attributes
+        from _giscanner import collect_attributes, escape_xml_text
     else:
-        from giscanner._giscanner import collect_attributes
+        from giscanner._giscanner import collect_attributes, escape_xml_text
 
 
-def build_xml_tag(tag_name, attributes=None, data=None, self_indent=0,
-                  self_indent_char=' '):
+def _build_xml_tag(tag_name, attributes, data, self_indent, self_indent_char):
+    # Everything is kept UTF-8 encoded; the lengths passed on to
+    # collect_attributes() are in characters though, as they decide
+    # where the line is broken.
     if attributes is None:
         attributes = []
-    prefix = u'<%s' % (tag_name, )
     if data is not None:
-        if isinstance(data, str):
-            data = data.decode('UTF-8')
-        suffix = u'>%s</%s>' % (escape(data), tag_name)
+        data, data_length = escape_xml_text(data)
+        suffix = '>%s</%s>' % (data, tag_name)
+        suffix_length = data_length + len(tag_name) + 4
     else:
-        suffix = u'/>'
+        suffix = '/>'
+        suffix_length = 2
     attrs = collect_attributes(
         tag_name, attributes,
         self_indent,
         self_indent_char,
-        len(prefix) + len(suffix))
-    return prefix + attrs + suffix
+        len(tag_name) + 1 + suffix_length)
+    return '<%s%s%s' % (tag_name, attrs, suffix)
 
 
-class XMLWriter(object):
+def build_xml_tag(tag_name, attributes=None, data=None, self_indent=0,
+                  self_indent_char=' '):
+    return _build_xml_tag(tag_name, attributes, data, self_indent,
+                          self_indent_char).decode('UTF-8')
+
 
-    def __init__(self):
-        self._data = StringIO()
-        self._data.write('<?xml version="1.0"?>\n')
+class XMLWriter(object):
+    """
+    Writes an XML document line by line, either to the file object
+    output, or when that is None, to memory for get_xml() to return.
+    """
+
+    def __init__(self, output=None):
+        if output is None:
+            self._data = StringIO()
+            output = self._data
+        else:
+            self._data = None
+        self._write = output.write
+        self._write('<?xml version="1.0"?>\n')
         self._tag_stack = []
         self._indent = 0
         self._indent_unit = 2
@@ -72,10 +88,10 @@ class XMLWriter(object):
             attributes = []
         attrs = collect_attributes(tag_name, attributes,
                                    self._indent, self._indent_char, len(tag_name) + 2)
-        self.write_line(u'<%s%s>' % (tag_name, attrs))
+        self.write_line('<%s%s>' % (tag_name, attrs))
 
     def _close_tag(self, tag_name):
-        self.write_line(u'</%s>' % (tag_name, ))
+        self.write_line('</%s>' % (tag_name, ))
 
     # Public API
 
@@ -88,27 +104,27 @@ class XMLWriter(object):
         self._newline_char = ''
 
     def get_xml(self):
+        assert self._data is not None, "the XML was written to a file"
         return self._data.getvalue()
 
-    def write_line(self, line=u'', indent=True, do_escape=False):
-        if isinstance(line, str):
-            line = line.decode('utf-8')
-        assert isinstance(line, unicode)
+    def write_line(self, line='', indent=True, do_escape=False):
+        if isinstance(line, unicode):
+            line = line.encode('UTF-8')
         if do_escape:
-            line = escape(line)
+            line = escape_xml_text(line)[0]
         if indent:
-            self._data.write('%s%s%s' % (self._indent_char * self._indent,
-                                         line.encode('utf-8'),
-                                         self._newline_char))
+            self._write('%s%s%s' % (self._indent_char * self._indent,
+                                    line,
+                                    self._newline_char))
         else:
-            self._data.write('%s%s' % (line.encode('utf-8'), self._newline_char))
+            self._write('%s%s' % (line, self._newline_char))
 
     def write_comment(self, text):
         self.write_line('<!-- %s -->' % (text, ))
 
     def write_tag(self, tag_name, attributes, data=None):
-        self.write_line(build_xml_tag(tag_name, attributes, data,
-                                      self._indent, self._indent_char))
+        self.write_line(_build_xml_tag(tag_name, attributes, data,
+                                       self._indent, self._indent_char))
 
     def push_tag(self, tag_name, attributes=None):
         if attributes is None:
@@ -32,6 +32,7 @@ import subprocess
 import unittest
 import xml.etree.ElementTree as etree
 
+from giscanner import annotationparser
 from giscanner.annotationparser import GtkDocCommentBlockParser, GtkDocCommentBlockWriter
 from giscanner.ast import Namespace
 from giscanner.message import MessageLogger, WARNING, ERROR, FATAL
@@ -74,6 +75,17 @@ def validate(tests_file):
 
 
 class TestCommentBlock(unittest.TestCase):
+    # Whether to parse with the regular expressions instead of the C tokenizer
+    use_fallback = False
+
+    def setUp(self):
+        self._tokenize_comment_line = annotationparser._tokenize_comment_line
+        if self.use_fallback:
+            annotationparser._tokenize_comment_line = None
+
+    def tearDown(self):
+        annotationparser._tokenize_comment_line = self._tokenize_comment_line
+
     @classmethod
     def __create_test__(cls, logger, testcase):
         def do_test(self):
@@ -425,6 +437,12 @@ def create_test_cases():
                 test_case = create_test_case(logger, tests_dir, tests_file)
                 test_cases[test_case.__name__] = test_case
 
+                # Run the same tests without the C tokenizer
+                if annotationparser._tokenize_comment_line is not None:
+                    test_case = type(test_case.__name__ + 'Fallback', (test_case, ),
+                                     {'use_fallback': True})
+                    test_cases[test_case.__name__] = test_case
+
     return test_cases
 
 
@@ -35,7 +35,8 @@ from giscanner.annotationparser import (COMMENT_BLOCK_START_RE, COMMENT_BLOCK_EN
                                         COMMENT_ASTERISK_RE, INDENTATION_RE, EMPTY_LINE_RE,
                                         SECTION_RE, SYMBOL_RE, PROPERTY_RE,
                                         SIGNAL_RE, PARAMETER_RE, TAG_RE,
-                                        TAG_VALUE_VERSION_RE, TAG_VALUE_STABILITY_RE)
+                                        TAG_VALUE_VERSION_RE, TAG_VALUE_STABILITY_RE,
+                                        tokenize_comment_line, _tokenize_comment_line)
 import unittest
 
 
@@ -887,12 +888,28 @@ def create_test_method(testcase):
     return do_test
 
 
-def create_test_case(tests_class_name, testcases):
+def create_tokenizer_test_method(testcase):
+    def do_test(self):
+        (program, text, expected) = testcase
+
+        if _tokenize_comment_line is None:
+            self.skipTest('the C tokenizer is not available')
+
+        for identifier in (True, False):
+            msg = 'C tokenizer does not match the regular expressions for:\n"%s"'
+            self.assertEqual(_tokenize_comment_line(text, identifier),
+                             tokenize_comment_line(text, identifier),
+                             msg % (text, ))
+
+    return do_test
+
+
+def create_test_case(tests_class_name, testcases, create_method=create_test_method):
     test_methods = {}
     for (index, testcase) in enumerate(testcases):
         test_method_name = 'test_%03d' % index
 
-        test_method = create_test_method(testcase)
+        test_method = create_method(testcase)
         test_method.__name__ = test_method_name
         test_methods[test_method_name] = test_method
 
@@ -916,6 +933,16 @@ def create_test_cases():
                             ('TestTagValueStability', tag_value_stability_tests)):
         test_cases[name] = create_test_case(name, test_data)
 
+    # The C tokenizer must split all of the above the same way
+    tokenizer_tests = [testcase for tests in (comment_asterisk_tests, indentaton_tests,
+                                              empty_line_tests, identifier_section_tests,
+                                              identifier_symbol_tests, identifier_property_tests,
+                                              identifier_signal_tests, parameter_tests, tag_tests)
+                       for testcase in tests]
+    test_cases['TestTokenizeCommentLine'] = create_test_case('TestTokenizeCommentLine',
+                                                             tokenizer_tests,
+                                                             create_tokenizer_test_method)
+
     return test_cases
 
 
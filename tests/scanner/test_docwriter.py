@@ -0,0 +1,117 @@
+import os
+import shutil
+import sys
+import tempfile
+import unittest
+import __builtin__
+
+
+os.environ['GI_SCANNER_DISABLE_CACHE'] = '1'
+path = os.getenv('UNINSTALLED_INTROSPECTION_SRCDIR', None)
+assert path is not None
+sys.path.insert(0, path)
+
+# Not correct, but enough to get the tests going uninstalled
+__builtin__.__dict__['DATADIR'] = path
+
+try:
+    from giscanner import docwriter
+except ImportError:
+    # The doctool is optional, and needs Mako
+    docwriter = None
+from giscanner.girparser import GIRParser
+from giscanner.transformer import Transformer
+
+
+def make_gir(nfunctions, nmethods):
+    """
+    A GIR with enough pages for them to be rendered in parallel, using
+    templates which inherit from others.
+    """
+    lines = ['<?xml version="1.0"?>',
+             '<repository version="1.2" xmlns="http://www.gtk.org/introspection/core/1.0"'
+             ' xmlns:c="http://www.gtk.org/introspection/c/1.0">',
+             '  <namespace name="Test" version="1.0" c:identifier-prefixes="Test"'
+             ' c:symbol-prefixes="test">',
+             '    <record name="Box" c:type="TestBox">',
+             '      <doc xml:space="preserve">A box.</doc>',
+             '      <field name="size" writable="1"><type name="gint" c:type="int"/></field>']
+    for i in range(nmethods):
+        lines.extend([
+            '      <method name="get_%d" c:identifier="test_box_get_%d">' % (i, i),
+            '        <doc xml:space="preserve">Gets the item %d of @box.</doc>' % (i, ),
+            '        <return-value transfer-ownership="none">',
+            '          <type name="gint" c:type="int"/>',
+            '        </return-value>',
+            '        <parameters>',
+            '          <instance-parameter name="box" transfer-ownership="none">',
+            '            <type name="Box" c:type="TestBox*"/>',
+            '          </instance-parameter>',
+            '        </parameters>',
+            '      </method>'])
+    lines.append('    </record>')
+    lines.extend([
+        '    <enumeration name="Kind" c:type="TestKind">',
+        '      <member name="a" value="0" c:identifier="TEST_KIND_A"/>',
+        '      <member name="b" value="1" c:identifier="TEST_KIND_B"/>',
+        '    </enumeration>'])
+    for i in range(nfunctions):
+        lines.extend([
+            '    <function name="function_%d" c:identifier="test_function_%d">' % (i, i),
+            '      <doc xml:space="preserve">Does #TestBox thing %d.</doc>' % (i, ),
+            '      <return-value transfer-ownership="none">',
+            '        <type name="none" c:type="void"/>',
+            '      </return-value>',
+            '      <parameters>',
+            '        <parameter name="kind" transfer-ownership="none">',
+            '          <type name="Kind" c:type="TestKind"/>',
+            '        </parameter>',
+            '      </parameters>',
+            '    </function>'])
+    lines.extend(['  </namespace>', '</repository>', ''])
+    return '\n'.join(lines)
+
+
+class TestParallelPages(unittest.TestCase):
+    def setUp(self):
+        if docwriter is None:
+            self.skipTest('Mako is not available')
+        self.tmpdir = tempfile.mkdtemp()
+        self.gir = os.path.join(self.tmpdir, 'Test-1.0.gir')
+        fp = open(self.gir, 'w')
+        fp.write(make_gir(4 * docwriter.PARALLEL_MIN_PAGES, 2 * docwriter.PARALLEL_MIN_PAGES))
+        fp.close()
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def write(self, language, jobs):
+        output = os.path.join(self.tmpdir, '%s-%d' % (language, jobs))
+        parser = GIRParser()
+        parser.parse(self.gir)
+        transformer = Transformer(parser.get_namespace())
+        writer = docwriter.DocWriter(transformer, language)
+        pages, rendered, written = writer.write(output, jobs=jobs)
+        self.assertEqual(pages, written)
+        return output
+
+    def read_pages(self, output):
+        pages = {}
+        for name in os.listdir(output):
+            fp = open(os.path.join(output, name), 'rb')
+            pages[name] = fp.read()
+            fp.close()
+        return pages
+
+    def test_same_output(self):
+        for language in sorted(docwriter.LANGUAGES):
+            serial = self.read_pages(self.write(language, 1))
+            self.assertTrue(len(serial) > 6 * docwriter.PARALLEL_MIN_PAGES)
+            parallel = self.read_pages(self.write(language, 4))
+            self.assertEqual(sorted(serial), sorted(parallel))
+            for name in serial:
+                self.assertEqual(serial[name], parallel[name], name)
+
+
+if __name__ == '__main__':
+    unittest.main()
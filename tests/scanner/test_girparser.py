@@ -0,0 +1,89 @@
+import glob
+import os
+import sys
+import unittest
+import __builtin__
+
+
+os.environ['GI_SCANNER_DISABLE_CACHE'] = '1'
+path = os.getenv('UNINSTALLED_INTROSPECTION_SRCDIR', None)
+assert path is not None
+sys.path.insert(0, path)
+
+# Not correct, but enough to get the tests going uninstalled
+__builtin__.__dict__['DATADIR'] = path
+
+from giscanner import girparser
+from giscanner.girparser import GIRParser
+from giscanner.girwriter import GIRWriter
+
+srcdir = os.getenv('srcdir', os.path.dirname(os.path.abspath(__file__)))
+CORE = '{%s}' % (girparser.CORE_NS, )
+
+
+def passthrough(filename, types_only=False, lazy=False):
+    parser = GIRParser(types_only=types_only, lazy=lazy)
+    parser.parse(filename)
+    namespace = parser.get_namespace()
+    if lazy:
+        namespace.parse_all()
+    return GIRWriter(namespace).get_xml()
+
+
+class TestGIRReader(unittest.TestCase):
+    def setUp(self):
+        if girparser._read_gir is None:
+            self.skipTest('the C reader is not available')
+        self.read_gir = girparser._read_gir
+        self.filenames = sorted(glob.glob(os.path.join(srcdir, '*-expected.gir')))
+        self.assertTrue(self.filenames)
+
+    def tearDown(self):
+        girparser._read_gir = self.read_gir
+
+    def assertSameOutput(self, filename, **kwargs):
+        output = passthrough(filename, **kwargs)
+        girparser._read_gir = None
+        try:
+            self.assertEqual(output, passthrough(filename, **kwargs))
+        finally:
+            girparser._read_gir = self.read_gir
+
+    def test_passthrough(self):
+        for filename in self.filenames:
+            self.assertSameOutput(filename)
+
+    def test_lazy_types_only(self):
+        for filename in self.filenames:
+            self.assertSameOutput(filename, types_only=True, lazy=True)
+
+    def test_text(self):
+        root = self.read_gir('<repository xmlns="%s"><doc>a &amp;&lt;&#233;\r\nb</doc>'
+                             '<doc/><doc></doc></repository>' % (girparser.CORE_NS, ))
+        self.assertEqual([doc.text for doc in root.getchildren()],
+                         [u'a &<\xe9\nb', None, None])
+        self.assertEqual(root.find(CORE + 'doc').text, u'a &<\xe9\nb')
+
+    def test_skip_and_shallow(self):
+        data = ('<repository xmlns="%s"><namespace><class name="A"><method/></class>'
+                '<doc>x</doc></namespace></repository>' % (girparser.CORE_NS, ))
+        root = self.read_gir(data, frozenset([CORE + 'doc']), frozenset([CORE + 'class']))
+        self.assertEqual([node.tag for node in root.getiterator()],
+                         [CORE + 'repository', CORE + 'namespace', CORE + 'class'])
+        self.assertEqual(root.getiterator(CORE + 'class')[0].attrib, {'name': 'A'})
+        self.assertEqual(self.read_gir(root.tostring()).getiterator(CORE + 'class')[0].attrib,
+                         {'name': 'A'})
+
+    def test_unsupported(self):
+        for data in ['<repository xmlns="urn:other"/>',
+                     '<repository xmlns="%s"><doc><!-- x --></doc></repository>'
+                     % (girparser.CORE_NS, ),
+                     '<?xml version="1.0" encoding="ISO-8859-1"?><repository/>',
+                     '<repository><c:include/></repository>',
+                     '<repository>']:
+            self.assertRaises(ValueError, self.read_gir, data)
+            self.assertEqual(girparser._read_element(data), None)
+
+
+if __name__ == '__main__':
+    unittest.main()
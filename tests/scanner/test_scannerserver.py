@@ -0,0 +1,113 @@
+import errno
+import os
+import shutil
+import signal
+import socket
+import sys
+import tempfile
+import time
+import unittest
+import __builtin__
+
+from StringIO import StringIO
+
+
+os.environ['GI_SCANNER_DISABLE_CACHE'] = '1'
+path = os.getenv('UNINSTALLED_INTROSPECTION_SRCDIR', None)
+assert path is not None
+sys.path.insert(0, path)
+
+# Not correct, but enough to get the tests going uninstalled
+__builtin__.__dict__['DATADIR'] = path
+
+from giscanner.scannermain import scanner_main
+from giscanner.scannerserver import run_client, serve, _exit_status
+
+srcdir = os.getenv('srcdir', os.path.dirname(os.path.abspath(__file__)))
+
+
+def run_local(args):
+    stdout, stderr = sys.stdout, sys.stderr
+    sys.stdout, sys.stderr = StringIO(), StringIO()
+    try:
+        try:
+            code = scanner_main(args)
+        except SystemExit as e:
+            code = e.code
+        status = _exit_status(code)
+        return status, sys.stdout.getvalue(), sys.stderr.getvalue()
+    finally:
+        sys.stdout, sys.stderr = stdout, stderr
+
+
+class TestScannerServer(unittest.TestCase):
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.socket = os.path.join(self.tmpdir, 'socket')
+        self.pid = os.fork()
+        if self.pid == 0:
+            try:
+                serve(self.socket)
+            finally:
+                os._exit(0)
+
+        for i in range(100):
+            probe = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            try:
+                probe.connect(self.socket)
+                break
+            except socket.error as e:
+                if e.args[0] not in (errno.ENOENT, errno.ECONNREFUSED):
+                    raise
+                time.sleep(0.1)
+            finally:
+                probe.close()
+
+    def tearDown(self):
+        os.kill(self.pid, signal.SIGTERM)
+        os.waitpid(self.pid, 0)
+        self.assertFalse(os.path.exists(self.socket))
+        shutil.rmtree(self.tmpdir)
+
+    def run_server(self, args):
+        stdout, stderr = StringIO(), StringIO()
+        status = run_client(self.socket, args, stdout=stdout, stderr=stderr)
+        return status, stdout.getvalue(), stderr.getvalue()
+
+    def test_same_output_and_status(self):
+        # Writes the GIR to stdout, then fails for lack of sources
+        args = ['g-ir-scanner', '--passthrough-gir',
+                os.path.join(srcdir, 'Foo-1.0-expected.gir')]
+        status, stdout, stderr = self.run_server(args)
+        self.assertEqual((status, stdout, stderr), run_local(args))
+        self.assertEqual(status, 1)
+        self.assertTrue(stdout.startswith('<?xml'))
+        self.assertEqual(stderr, 'ERROR: Need at least one filename\n')
+
+    def test_working_directory(self):
+        args = ['g-ir-scanner', '--passthrough-gir', 'Foo-1.0-expected.gir']
+        cwd = os.getcwd()
+        os.chdir(srcdir)
+        try:
+            self.assertEqual(self.run_server(args), run_local(args))
+        finally:
+            os.chdir(cwd)
+
+    def test_other_scanner_refused(self):
+        builddir = os.environ.get('UNINSTALLED_INTROSPECTION_BUILDDIR')
+        os.environ['UNINSTALLED_INTROSPECTION_BUILDDIR'] = self.tmpdir
+        try:
+            self.assertEqual(self.run_server(['g-ir-scanner']), (None, '', ''))
+        finally:
+            if builddir is None:
+                del os.environ['UNINSTALLED_INTROSPECTION_BUILDDIR']
+            else:
+                os.environ['UNINSTALLED_INTROSPECTION_BUILDDIR'] = builddir
+
+    def test_no_server(self):
+        status = run_client(os.path.join(self.tmpdir, 'nothing'), ['g-ir-scanner'])
+        self.assertEqual(status, None)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -1,8 +1,12 @@
+import cPickle
+import shutil
 import unittest
 import tempfile
 import os
 
-from giscanner.sourcescanner import SourceScanner
+from giscanner.sourcescanner import (SourceScanner, SourceSymbol, CSYMBOL_TYPE_CONST,
+                                     CSYMBOL_TYPE_FUNCTION, CSYMBOL_TYPE_STRUCT,
+                                     CTYPE_BASIC_TYPE, CTYPE_POINTER, CTYPE_TYPEDEF)
 
 
 two_typedefs_source = """
@@ -17,6 +21,48 @@ typedef struct _spam Spam;
 typedef struct _eggs Eggs;
 """
 
+struct_source = """
+struct _ham {
+  int a;
+  char *b;
+};
+"""
+
+foreign_source = """
+typedef int Foreign;
+int foreign_function (Foreign a);
+static inline int foreign_inline (void) { return 0; }
+"""
+
+inner_source = """
+#ifndef INNER_H
+#define INNER_H
+typedef enum { INNER_A, INNER_B } InnerEnum;
+int inner_function (InnerEnum e);
+#endif
+"""
+
+outer_source = """
+#ifndef OUTER_H
+#define OUTER_H
+typedef int OuterInt;
+OuterInt outer_first (void);
+#include "inner.h"
+OuterInt outer_second (InnerEnum e);
+#endif
+"""
+
+scanned_source = """
+#include "foreign.h"
+
+#define SCANNED_ACTIVE 1
+#ifdef SCANNED_NOT_DEFINED
+#define SCANNED_INACTIVE 2
+#endif
+
+Foreign scanned_function (Foreign a);
+"""
+
 
 class Test(unittest.TestCase):
     def setUp(self):
@@ -37,5 +83,107 @@ class Test(unittest.TestCase):
         self.assertEqual(len(list(self.ss.get_comments())), 2)
 
 
+class TestExport(unittest.TestCase):
+    def setUp(self):
+        self.ss = SourceScanner()
+        tmp_fd, tmp_name = tempfile.mkstemp(suffix='.h')
+        file = os.fdopen(tmp_fd, 'wt')
+        file.write(struct_source)
+        file.close()
+
+        self.ss.parse_files([tmp_name])
+
+    def test_struct_members(self):
+        symbols = list(self.ss.get_symbols())
+        self.assertEqual([symbol.ident for symbol in symbols], ['_ham'])
+        symbol = symbols[0]
+        self.assertTrue(isinstance(symbol, SourceSymbol))
+        self.assertEqual(symbol.type, CSYMBOL_TYPE_STRUCT)
+        members = symbol.base_type.child_list
+        self.assertEqual([member.ident for member in members], ['a', 'b'])
+        self.assertEqual(members[0].base_type.type, CTYPE_BASIC_TYPE)
+        self.assertEqual(members[0].base_type.name, 'int')
+        self.assertEqual(members[1].base_type.type, CTYPE_POINTER)
+        self.assertEqual(members[1].base_type.base_type.name, 'char')
+
+    def test_pickle(self):
+        symbols = list(self.ss.get_symbols())
+        self.assertEqual(cPickle.loads(cPickle.dumps(symbols, cPickle.HIGHEST_PROTOCOL)),
+                         symbols)
+
+
+class TestForeignHeaders(unittest.TestCase):
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        for name, source in [('foreign.h', foreign_source),
+                             ('scanned.h', scanned_source)]:
+            with open(os.path.join(self.tmpdir, name), 'w') as f:
+                f.write(source)
+        filenames = [os.path.join(self.tmpdir, 'scanned.h')]
+
+        self.ss = SourceScanner()
+        self.ss.parse_files(filenames)
+        self.ss.parse_macros(filenames)
+
+    def tearDown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def test_symbols(self):
+        symbols = dict((symbol.ident, symbol) for symbol in self.ss.get_symbols())
+        self.assertEqual(sorted(symbols), ['SCANNED_ACTIVE', 'SCANNED_INACTIVE',
+                                           'scanned_function'])
+        # The typedef of the header which is not scanned is known
+        function = symbols['scanned_function']
+        self.assertEqual(function.type, CSYMBOL_TYPE_FUNCTION)
+        self.assertEqual(function.base_type.child_list[0].base_type.type, CTYPE_TYPEDEF)
+        self.assertEqual(function.base_type.child_list[0].base_type.name, 'Foreign')
+        # Macros are read from the header itself, not as the
+        # preprocessor sees them
+        self.assertEqual(symbols['SCANNED_ACTIVE'].type, CSYMBOL_TYPE_CONST)
+        self.assertEqual(symbols['SCANNED_INACTIVE'].type, CSYMBOL_TYPE_CONST)
+        self.assertEqual(symbols['SCANNED_INACTIVE'].const_int, 2)
+
+
+class TestIncludeOrder(unittest.TestCase):
+    def setUp(self):
+        self.tmpdir = tempfile.mkdtemp()
+        for name, source in [('inner.h', inner_source),
+                             ('outer.h', outer_source)]:
+            with open(os.path.join(self.tmpdir, name), 'w') as f:
+                f.write(source)
+        self.filenames = [os.path.join(self.tmpdir, 'outer.h'),
+                          os.path.join(self.tmpdir, 'inner.h')]
+        # The headers go to a cache of their own
+        self.environ = os.environ.copy()
+        os.environ['HOME'] = self.tmpdir
+        os.environ.pop('GI_SCANNER_DISABLE_CACHE', None)
+
+    def tearDown(self):
+        os.environ.clear()
+        os.environ.update(self.environ)
+        shutil.rmtree(self.tmpdir)
+
+    def get_symbols(self):
+        ss = SourceScanner()
+        ss.parse_files(self.filenames)
+        return [symbol.ident for symbol in ss.get_symbols()]
+
+    def test_order(self):
+        # The symbols are in the order of the preprocessor output, whether
+        # the headers are parsed or read from the cache
+        expected = ['OuterInt', 'outer_first', 'InnerEnum', 'inner_function',
+                    'outer_second']
+        os.environ['GI_SCANNER_DISABLE_CACHE'] = '1'
+        self.assertEqual(self.get_symbols(), expected)
+        del os.environ['GI_SCANNER_DISABLE_CACHE']
+        self.assertEqual(self.get_symbols(), expected)
+        self.assertEqual(self.get_symbols(), expected)
+
+        # Only outer.h changes, inner.h is still read from the cache
+        with open(self.filenames[0], 'a') as f:
+            f.write('int outer_third (void);\n')
+        self.assertEqual(self.get_symbols(), expected + ['outer_third'])
+
+
 if __name__ == '__main__':
     unittest.main()
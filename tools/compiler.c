@@ -42,6 +42,7 @@ gchar *output = NULL;
 gchar *mname = NULL;
 gchar *shlib = NULL;
 gboolean include_cwd = FALSE;
+gboolean validate_markup = FALSE;
 gboolean debug = FALSE;
 gboolean verbose = FALSE;
 
@@ -132,6 +133,7 @@ static GOptionEntry options[] =
   { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "output file", "FILE" }, 
   { "module", 'm', 0, G_OPTION_ARG_STRING, &mname, "module to compile", "NAME" }, 
   { "shared-library", 'l', 0, G_OPTION_ARG_FILENAME, &shlib, "shared library", "FILE" }, 
+  { "validate-markup", 0, 0, G_OPTION_ARG_NONE, &validate_markup, "parse input with GMarkup, validating all of the XML (slower)", NULL },
   { "debug", 0, 0, G_OPTION_ARG_NONE, &debug, "show debug messages", NULL }, 
   { "verbose", 0, 0, G_OPTION_ARG_NONE, &verbose, "show verbose messages", NULL }, 
   { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &input, NULL, NULL },
@@ -179,6 +181,7 @@ main (int argc, char ** argv)
   parser = _g_ir_parser_new ();
 
   _g_ir_parser_set_includes (parser, (const char*const*) includedirs);
+  _g_ir_parser_set_validate_markup (parser, validate_markup);
 
   module = _g_ir_parser_parse_file (parser, input[0], &error);
   if (module == NULL) 